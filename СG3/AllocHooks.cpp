@@ -0,0 +1,158 @@
+﻿#include <cstdlib>
+#include <new>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+#include "Arena.h"
+
+// Глобальные operator new/delete с подсчетом выделений для --alloc-stats.
+// Подключается только в исполняемый файл: библиотека не подменяет кучу
+// приложению, которое ее встраивает
+
+namespace {
+    struct HooksMarker {
+        HooksMarker() { memstats::set_hooks_installed(); }
+    } hooks_marker;
+
+    void* counted_new(std::size_t size) {
+        memstats::count_allocation();
+        if (size == 0) size = 1;
+        for (;;) {
+            void* ptr = std::malloc(size);
+            if (ptr) return ptr;
+            std::new_handler handler = std::get_new_handler();
+            if (!handler) throw std::bad_alloc();
+            handler();
+        }
+    }
+
+    void* counted_new_nothrow(std::size_t size) {
+        try {
+            return counted_new(size);
+        }
+        catch (const std::bad_alloc&) {
+            return NULL;
+        }
+    }
+
+#ifdef __cpp_aligned_new
+    // Выравнивание больше стандартного (alignas(64) и т.п., C++17)
+    void* counted_new_aligned(std::size_t size, std::align_val_t align) {
+        memstats::count_allocation();
+        if (size == 0) size = 1;
+        std::size_t alignment = static_cast<std::size_t>(align);
+        if (alignment < sizeof(void*)) alignment = sizeof(void*);
+        for (;;) {
+#ifdef _WIN32
+            void* ptr = _aligned_malloc(size, alignment);
+#else
+            void* ptr = NULL;
+            if (posix_memalign(&ptr, alignment, size) != 0) ptr = NULL;
+#endif
+            if (ptr) return ptr;
+            std::new_handler handler = std::get_new_handler();
+            if (!handler) throw std::bad_alloc();
+            handler();
+        }
+    }
+
+    void* counted_new_aligned_nothrow(std::size_t size, std::align_val_t align) {
+        try {
+            return counted_new_aligned(size, align);
+        }
+        catch (const std::bad_alloc&) {
+            return NULL;
+        }
+    }
+
+    void free_aligned(void* ptr) {
+#ifdef _WIN32
+        _aligned_free(ptr);
+#else
+        std::free(ptr);
+#endif
+    }
+#endif
+}
+
+void* operator new(std::size_t size) {
+    return counted_new(size);
+}
+
+void* operator new[](std::size_t size) {
+    return counted_new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    return counted_new_nothrow(size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+    return counted_new_nothrow(size);
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept {
+    std::free(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept {
+    std::free(ptr);
+}
+
+#ifdef __cpp_aligned_new
+void* operator new(std::size_t size, std::align_val_t align) {
+    return counted_new_aligned(size, align);
+}
+
+void* operator new[](std::size_t size, std::align_val_t align) {
+    return counted_new_aligned(size, align);
+}
+
+void* operator new(std::size_t size, std::align_val_t align, const std::nothrow_t&) noexcept {
+    return counted_new_aligned_nothrow(size, align);
+}
+
+void* operator new[](std::size_t size, std::align_val_t align, const std::nothrow_t&) noexcept {
+    return counted_new_aligned_nothrow(size, align);
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept {
+    free_aligned(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t) noexcept {
+    free_aligned(ptr);
+}
+
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept {
+    free_aligned(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t, std::align_val_t) noexcept {
+    free_aligned(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept {
+    free_aligned(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept {
+    free_aligned(ptr);
+}
+#endif
@@ -0,0 +1,133 @@
+﻿#include <algorithm>
+#include <atomic>
+#include "Arena.h"
+#include "Framebuffer.h"
+
+namespace memstats {
+    static std::atomic<uint64_t> counter(0);
+    static bool hooks = false;
+    static thread_local bool ignored = false;
+
+    void count_allocation() {
+        if (!ignored) counter.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    uint64_t allocations() {
+        return counter.load(std::memory_order_relaxed);
+    }
+
+    bool hooks_installed() {
+        return hooks;
+    }
+
+    void set_hooks_installed() {
+        hooks = true;
+    }
+
+    void ignore_current_thread() {
+        ignored = true;
+    }
+}
+
+FrameArena::FrameArena(size_t block_bytes)
+    : current_(0), offset_(0), used_before_(0), block_bytes_(std::max<size_t>(block_bytes, 64)), peak_(0) {
+}
+
+FrameArena::~FrameArena() {
+    for (size_t i = 0; i < blocks_.size(); i++) {
+        fbpool::release(blocks_[i].data, blocks_[i].size);
+    }
+    for (size_t i = 0; i < threads_.size(); i++) {
+        delete threads_[i];
+    }
+}
+
+FrameArena::Block FrameArena::new_block(size_t bytes) {
+    // Блоки из пула кадров: выровнены на 64, системные выделения учитывает memstats
+    Block b;
+    b.size = (bytes + 63) & ~static_cast<size_t>(63);
+    b.data = static_cast<char*>(fbpool::acquire(b.size));
+    if (!b.data) throw std::bad_alloc();
+    return b;
+}
+
+void* FrameArena::allocate(size_t bytes, size_t align) {
+    if (align == 0) align = 1;
+    for (;;) {
+        if (current_ < blocks_.size()) {
+            const Block& b = blocks_[current_];
+            size_t start = (offset_ + align - 1) & ~(align - 1);
+            if (start + bytes <= b.size) {
+                offset_ = start + bytes;
+                peak_ = std::max(peak_, used_before_ + offset_);
+                return b.data + start;
+            }
+            if (current_ + 1 < blocks_.size()) {
+                // Следующий блок уже есть (кадр снова перерос первый): переходим в него
+                used_before_ += offset_;
+                current_++;
+                offset_ = 0;
+                continue;
+            }
+            used_before_ += offset_;
+            current_++;
+            offset_ = 0;
+        }
+        blocks_.push_back(new_block(std::max(block_bytes_, bytes + align)));
+        current_ = blocks_.size() - 1;
+    }
+}
+
+void FrameArena::reset() {
+    if (blocks_.size() > 1) {
+        // Кадр вышел за первый блок: один блок на весь объем, со следующего кадра без кучи
+        size_t total = 0;
+        for (size_t i = 0; i < blocks_.size(); i++) {
+            total += blocks_[i].size;
+            fbpool::release(blocks_[i].data, blocks_[i].size);
+        }
+        blocks_.clear();
+        block_bytes_ = std::max(block_bytes_, total);
+        blocks_.push_back(new_block(block_bytes_));
+    }
+    current_ = 0;
+    offset_ = 0;
+    used_before_ = 0;
+    for (size_t i = 0; i < threads_.size(); i++) {
+        if (threads_[i]) threads_[i]->reset();
+    }
+}
+
+FrameArena& FrameArena::thread_arena(int t) {
+    if (t <= 0) return *this;
+    if (threads_.size() < static_cast<size_t>(t)) threads_.resize(t, NULL);
+    if (!threads_[t - 1]) threads_[t - 1] = new FrameArena(std::max<size_t>(block_bytes_ / 8, 4 << 10));
+    return *threads_[t - 1];
+}
+
+size_t FrameArena::used() const {
+    size_t total = used_before_ + offset_;
+    for (size_t i = 0; i < threads_.size(); i++) {
+        if (threads_[i]) total += threads_[i]->used();
+    }
+    return total;
+}
+
+size_t FrameArena::capacity() const {
+    size_t total = 0;
+    for (size_t i = 0; i < blocks_.size(); i++) {
+        total += blocks_[i].size;
+    }
+    for (size_t i = 0; i < threads_.size(); i++) {
+        if (threads_[i]) total += threads_[i]->capacity();
+    }
+    return total;
+}
+
+size_t FrameArena::peak() const {
+    size_t total = peak_;
+    for (size_t i = 0; i < threads_.size(); i++) {
+        if (threads_[i]) total += threads_[i]->peak();
+    }
+    return total;
+}
@@ -0,0 +1,120 @@
+﻿#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Кадровая арена: временные данные конвейера (раскладка кластеров, копии
+// шейдеров потоков, рабочие массивы) берутся сдвигом указателя и не
+// освобождаются по одному — reset() в начале кадра возвращает все сразу.
+// Если кадр не уместился в блок, reset() сливает блоки в один общего
+// размера, так что после первых кадров к куче арена больше не обращается.
+// У каждого потока рендера своя под-арена: выделения идут без блокировок
+class FrameArena {
+public:
+    explicit FrameArena(size_t block_bytes = 256 << 10);
+    ~FrameArena();
+
+    void* allocate(size_t bytes, size_t align = 16);
+
+    // Массив из count value-инициализированных объектов; деструкторы не вызываются
+    template <class T>
+    T* allocate_array(size_t count) {
+        static_assert(std::is_trivially_destructible<T>::value, "arena arrays are never destroyed");
+        T* p = static_cast<T*>(allocate(count * sizeof(T), alignof(T)));
+        for (size_t i = 0; i < count; i++) {
+            new (p + i) T();
+        }
+        return p;
+    }
+
+    // Объект в арене; разрушается destroy() (только деструктор, память уйдет при reset())
+    template <class T, class... Args>
+    T* create(Args&&... args) {
+        return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    template <class T>
+    static void destroy(T* p) {
+        if (p) p->~T();
+    }
+
+    // Освобождает все выделения кадра, включая под-арены потоков
+    void reset();
+
+    // Под-арена потока t (0 — сама арена). Создается при первом обращении,
+    // поэтому запрашивать ее нужно из управляющего потока до запуска рабочих
+    FrameArena& thread_arena(int t);
+
+    size_t used() const;     // занято в текущем кадре (с под-аренами)
+    size_t capacity() const; // размер блоков (с под-аренами)
+    size_t peak() const;     // наибольшее заполнение за все кадры (с под-аренами)
+
+private:
+    struct Block {
+        char* data;
+        size_t size;
+    };
+
+    std::vector<Block> blocks_;
+    size_t current_;      // текущий блок
+    size_t offset_;       // занято в текущем блоке
+    size_t used_before_;  // занято в предыдущих блоках
+    size_t block_bytes_;
+    size_t peak_;
+    std::vector<FrameArena*> threads_;
+
+    Block new_block(size_t bytes);
+
+    FrameArena(const FrameArena&);
+    FrameArena& operator=(const FrameArena&);
+};
+
+// Временный массив для функций, которым арену могут и не передать:
+// с ареной память берется из нее, без — из кучи, как раньше
+template <class T>
+class ScratchArray {
+public:
+    ScratchArray(FrameArena* arena, size_t count) : data_(NULL) {
+        if (arena) {
+            data_ = arena->allocate_array<T>(count);
+        }
+        else {
+            heap_.resize(count);
+            data_ = heap_.empty() ? NULL : &heap_[0];
+        }
+    }
+
+    T& operator[](size_t i) { return data_[i]; }
+    const T& operator[](size_t i) const { return data_[i]; }
+    T* data() { return data_; }
+
+private:
+    std::vector<T> heap_;
+    T* data_;
+
+    ScratchArray(const ScratchArray&);
+    ScratchArray& operator=(const ScratchArray&);
+};
+
+// Счетчик обращений к куче. Глобальные operator new/delete с подсчетом
+// подключает AllocHooks.cpp (только в исполняемом файле, библиотека кучу не
+// подменяет), системные выделения пула кадров считаются всегда
+namespace memstats {
+    void count_allocation();
+    uint64_t allocations();
+
+    // Подсчет operator new подключен
+    bool hooks_installed();
+    void set_hooks_installed();
+
+    // Выделения текущего потока не считаются (например, запись файлов
+    // в фоновом потоке — она не входит в бюджет кадра)
+    void ignore_current_thread();
+}
+
+#endif
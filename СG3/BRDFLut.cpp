@@ -0,0 +1,152 @@
+﻿#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include "BRDFLut.h"
+
+namespace {
+    const float PI = 3.14159265f;
+    const char MAGIC[4] = { 'B', 'R', 'D', 'F' };
+    const int VERSION = 2;
+
+    float table_roughness(int iv) {
+        return std::max(BRDFLut::MIN_ROUGHNESS, iv / float(BRDFLut::ROUGHNESS_SIZE - 1));
+    }
+
+    // Путь кэша и признак того, что таблицы уже построены
+    std::mutex cache_mutex;
+    std::string cache_file = "brdf_lut.bin";
+    bool cache_enabled = true;
+    bool built = false;
+
+    float smith_g1(float ndotx, float alpha) {
+        float a2 = alpha * alpha;
+        return 2.f * ndotx / (ndotx + std::sqrt(a2 + (1.f - a2) * ndotx * ndotx));
+    }
+
+    float radical_inverse(unsigned int bits) {
+        bits = (bits << 16u) | (bits >> 16u);
+        bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+        bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+        bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+        bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+        return bits * 2.3283064365386963e-10f;
+    }
+}
+
+// Минимальная шероховатость: при нуле GGX вырождается в дельта-функцию
+const float BRDFLut::MIN_ROUGHNESS = 0.04f;
+
+static BRDFLut load_or_build() {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    built = true;
+    BRDFLut lut;
+    if (!cache_enabled) {
+        lut.build();
+    }
+    else if (!lut.load(cache_file.c_str())) {
+        lut.build();
+        if (!lut.save(cache_file.c_str())) {
+            std::cerr << "can't write BRDF cache " << cache_file << std::endl;
+        }
+    }
+    return lut;
+}
+
+bool BRDFLut::set_cache_path(const char* cache_path) {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    if (built) return false;
+    cache_enabled = cache_path != NULL;
+    cache_file = cache_path ? cache_path : "";
+    return true;
+}
+
+const BRDFLut& BRDFLut::instance() {
+    static const BRDFLut lut = load_or_build();
+    return lut;
+}
+
+void BRDFLut::build() {
+    const int size = COS_SIZE * ROUGHNESS_SIZE;
+    smith_.assign(size, 0.f);
+    env_scale_.assign(size, 0.f);
+    env_bias_.assign(size, 0.f);
+
+    for (int iv = 0; iv < ROUGHNESS_SIZE; iv++) {
+        float roughness = table_roughness(iv);
+        float alpha = roughness * roughness;
+        float a2 = alpha * alpha;
+        for (int iu = 0; iu < COS_SIZE; iu++) {
+            float c = std::max(1e-4f, iu / float(COS_SIZE - 1));
+            int idx = iv * COS_SIZE + iu;
+
+            smith_[idx] = smith_g1(c, alpha);
+
+            // Интеграл спекулярного BRDF по полусфере (Karis, split-sum),
+            // выборка по значимости распределения GGX
+            Vec3f v(std::sqrt(1.f - c * c), 0.f, c);
+            float scale = 0.f;
+            float bias = 0.f;
+            for (int i = 0; i < ENV_SAMPLES; i++) {
+                float xi0 = (i + 0.5f) / ENV_SAMPLES;
+                float xi1 = radical_inverse(static_cast<unsigned int>(i));
+                float phi = 2.f * PI * xi0;
+                float cos_theta = std::sqrt((1.f - xi1) / (1.f + (a2 - 1.f) * xi1));
+                float sin_theta = std::sqrt(1.f - cos_theta * cos_theta);
+                Vec3f h(sin_theta * std::cos(phi), sin_theta * std::sin(phi), cos_theta);
+                float vdoth = v * h;
+                Vec3f l = h * (2.f * vdoth) - v;
+                if (l.z <= 0.f) continue;
+                float g = smith_g1(l.z, alpha) * smith_g1(c, alpha);
+                float g_vis = g * vdoth / (h.z * c);
+                float fc = std::pow(1.f - vdoth, 5.f);
+                scale += (1.f - fc) * g_vis;
+                bias += fc * g_vis;
+            }
+            env_scale_[idx] = scale / ENV_SAMPLES;
+            env_bias_[idx] = bias / ENV_SAMPLES;
+        }
+    }
+}
+
+bool BRDFLut::load(const char* path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open()) return false;
+
+    char magic[4];
+    int header[4];
+    in.read(magic, sizeof(magic));
+    in.read((char*)header, sizeof(header));
+    if (!in.good() || memcmp(magic, MAGIC, sizeof(MAGIC)) != 0 || header[0] != VERSION ||
+        header[1] != COS_SIZE || header[2] != ROUGHNESS_SIZE || header[3] != ENV_SAMPLES) {
+        return false;
+    }
+
+    const int size = COS_SIZE * ROUGHNESS_SIZE;
+    std::vector<float>* tables[3] = { &smith_, &env_scale_, &env_bias_ };
+    for (int t = 0; t < 3; t++) {
+        tables[t]->resize(size);
+        in.read((char*)&(*tables[t])[0], size * sizeof(float));
+    }
+    if (!in.good()) {
+        smith_.clear();
+        return false;
+    }
+    return true;
+}
+
+bool BRDFLut::save(const char* path) const {
+    std::ofstream out(path, std::ios::binary);
+    if (!out.is_open()) return false;
+
+    int header[4] = { VERSION, COS_SIZE, ROUGHNESS_SIZE, ENV_SAMPLES };
+    out.write(MAGIC, sizeof(MAGIC));
+    out.write((const char*)header, sizeof(header));
+    const std::vector<float>* tables[3] = { &smith_, &env_scale_, &env_bias_ };
+    for (int t = 0; t < 3; t++) {
+        out.write((const char*)&(*tables[t])[0], tables[t]->size() * sizeof(float));
+    }
+    return out.good();
+}
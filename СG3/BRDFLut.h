@@ -0,0 +1,67 @@
+﻿#ifndef BRDF_LUT_H
+#define BRDF_LUT_H
+
+#include <algorithm>
+#include <vector>
+#include "geometry.h"
+
+// Таблицы для Cook-Torrance (Smith + split-sum), строятся один раз при запуске
+// и кэшируются на диске. По осям: косинус угла [0, 1] и шероховатость [0, 1].
+// GGX D не табулируется: при малой шероховатости весь лепесток уже одной ячейки
+// по n.h, а аналитическая формула обходится без pow()
+class BRDFLut {
+public:
+    static const int COS_SIZE = 128;
+    static const int ROUGHNESS_SIZE = 32;
+    static const int ENV_SAMPLES = 512;
+
+    static const float MIN_ROUGHNESS;
+
+    // Файл кэша таблиц; задается до первого instance(). NULL — только в памяти,
+    // по умолчанию brdf_lut.bin в текущем каталоге. false — таблицы уже построены
+    // и путь не применен
+    static bool set_cache_path(const char* cache_path);
+    // Таблицы из файла кэша; если его нет — строятся и сохраняются туда
+    static const BRDFLut& instance();
+
+    bool load(const char* path);
+    bool save(const char* path) const;
+    void build();
+
+    // Распределение нормалей GGX D(n.h, roughness)
+    float ggx(float ndoth, float roughness) const {
+        float alpha = std::max(MIN_ROUGHNESS, roughness);
+        alpha *= alpha;
+        float a2 = alpha * alpha;
+        float d = ndoth * ndoth * (a2 - 1.f) + 1.f;
+        return a2 / (3.14159265f * d * d);
+    }
+    // Маскирование Smith G1(n.v, roughness); G = G1(n.l) * G1(n.v)
+    float smith(float ndotx, float roughness) const { return sample(smith_, ndotx, roughness); }
+    // Split-sum: спекулярное окружение = F0 * scale + bias
+    Vec2f env(float ndotv, float roughness) const {
+        return Vec2f(sample(env_scale_, ndotv, roughness), sample(env_bias_, ndotv, roughness));
+    }
+
+private:
+    std::vector<float> smith_;
+    std::vector<float> env_scale_;
+    std::vector<float> env_bias_;
+
+    // Билинейная выборка из таблицы COS_SIZE x ROUGHNESS_SIZE
+    static float sample(const std::vector<float>& lut, float u, float v) {
+        float fu = std::min(1.f, std::max(0.f, u)) * (COS_SIZE - 1);
+        float fv = std::min(1.f, std::max(0.f, v)) * (ROUGHNESS_SIZE - 1);
+        int iu = std::min(static_cast<int>(fu), COS_SIZE - 2);
+        int iv = std::min(static_cast<int>(fv), ROUGHNESS_SIZE - 2);
+        float tu = fu - iu;
+        float tv = fv - iv;
+        const float* row0 = &lut[iv * COS_SIZE + iu];
+        const float* row1 = row0 + COS_SIZE;
+        float a = row0[0] + (row0[1] - row0[0]) * tu;
+        float b = row1[0] + (row1[1] - row1[0]) * tu;
+        return a + (b - a) * tv;
+    }
+};
+
+#endif
@@ -0,0 +1,585 @@
+﻿#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <limits>
+#include <thread>
+#include "BVH.h"
+#include "Framebuffer.h"
+#include "Trace.h"
+
+#if defined(_M_X64) || defined(_M_AMD64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define BVH_USE_SSE 1
+#endif
+
+namespace {
+    const int BIN_COUNT = 16;
+    // Поддеревья от этого числа треугольников строятся в отдельном потоке
+    const int PARALLEL_MIN_PRIMS = 4096;
+    // Глубже этого уровня узлы делятся пополам по числу, чтобы стек обхода был ограничен
+    const int MAX_SAH_DEPTH = 48;
+    const int STACK_SIZE = 256;
+    const float INF = std::numeric_limits<float>::infinity();
+
+    // Рамка при построении; четвертая компонента — выравнивание под SSE
+    struct AABB {
+        float lo[4];
+        float hi[4];
+
+        AABB() {
+            for (int k = 0; k < 4; k++) {
+                lo[k] = INF;
+                hi[k] = -INF;
+            }
+        }
+
+        void grow(const float* p) {
+#ifdef BVH_USE_SSE
+            __m128 v = _mm_loadu_ps(p);
+            _mm_storeu_ps(lo, _mm_min_ps(_mm_loadu_ps(lo), v));
+            _mm_storeu_ps(hi, _mm_max_ps(_mm_loadu_ps(hi), v));
+#else
+            for (int k = 0; k < 3; k++) {
+                lo[k] = std::min(lo[k], p[k]);
+                hi[k] = std::max(hi[k], p[k]);
+            }
+#endif
+        }
+
+        void grow(const AABB& b) {
+#ifdef BVH_USE_SSE
+            _mm_storeu_ps(lo, _mm_min_ps(_mm_loadu_ps(lo), _mm_loadu_ps(b.lo)));
+            _mm_storeu_ps(hi, _mm_max_ps(_mm_loadu_ps(hi), _mm_loadu_ps(b.hi)));
+#else
+            for (int k = 0; k < 3; k++) {
+                lo[k] = std::min(lo[k], b.lo[k]);
+                hi[k] = std::max(hi[k], b.hi[k]);
+            }
+#endif
+        }
+
+        float area() const {
+            float dx = hi[0] - lo[0], dy = hi[1] - lo[1], dz = hi[2] - lo[2];
+            if (dx < 0.f) return 0.f;
+            return 2.f * (dx * dy + dy * dz + dz * dx);
+        }
+    };
+
+    // Ссылка на треугольник при построении: границы и центр
+    struct PrimRef {
+        AABB box;
+        float centroid[4];
+        int index;
+    };
+
+    // Луч, подготовленный для теста с рамками
+    struct RayData {
+        float origin[3];
+        float inv_dir[3];
+        float tmin;
+    };
+
+    RayData prepare(const Ray& ray) {
+        RayData r;
+        for (int k = 0; k < 3; k++) {
+            r.origin[k] = ray.origin[k];
+            r.inv_dir[k] = 1.f / ray.dir[k];
+        }
+        r.tmin = ray.tmin;
+        return r;
+    }
+
+    // Пересечение луча с четырьмя рамками узла на [tmin, tmax].
+    // Биты результата — попавшие дети, dist — расстояние входа
+    int intersect_children(const BVHNode& n, const RayData& r, float tmax, float* dist) {
+#ifdef BVH_USE_SSE
+        __m128 ox = _mm_set1_ps(r.origin[0]), oy = _mm_set1_ps(r.origin[1]), oz = _mm_set1_ps(r.origin[2]);
+        __m128 ix = _mm_set1_ps(r.inv_dir[0]), iy = _mm_set1_ps(r.inv_dir[1]), iz = _mm_set1_ps(r.inv_dir[2]);
+        __m128 tx0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(n.min_x), ox), ix);
+        __m128 tx1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(n.max_x), ox), ix);
+        __m128 ty0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(n.min_y), oy), iy);
+        __m128 ty1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(n.max_y), oy), iy);
+        __m128 tz0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(n.min_z), oz), iz);
+        __m128 tz1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(n.max_z), oz), iz);
+        // NaN (0 * inf на грани рамки) _mm_max_ps/_mm_min_ps заменяют вторым операндом
+        __m128 tnear = _mm_max_ps(_mm_min_ps(tx0, tx1), _mm_set1_ps(r.tmin));
+        __m128 tfar = _mm_min_ps(_mm_max_ps(tx0, tx1), _mm_set1_ps(tmax));
+        tnear = _mm_max_ps(_mm_min_ps(ty0, ty1), tnear);
+        tfar = _mm_min_ps(_mm_max_ps(ty0, ty1), tfar);
+        tnear = _mm_max_ps(_mm_min_ps(tz0, tz1), tnear);
+        tfar = _mm_min_ps(_mm_max_ps(tz0, tz1), tfar);
+        _mm_storeu_ps(dist, tnear);
+        return _mm_movemask_ps(_mm_cmple_ps(tnear, tfar));
+#else
+        const float* lo[3] = { n.min_x, n.min_y, n.min_z };
+        const float* hi[3] = { n.max_x, n.max_y, n.max_z };
+        int mask = 0;
+        for (int i = 0; i < 4; i++) {
+            float tnear = r.tmin;
+            float tfar = tmax;
+            for (int k = 0; k < 3; k++) {
+                float t0 = (lo[k][i] - r.origin[k]) * r.inv_dir[k];
+                float t1 = (hi[k][i] - r.origin[k]) * r.inv_dir[k];
+                if (t0 > t1) std::swap(t0, t1);
+                tnear = t0 > tnear ? t0 : tnear;
+                tfar = t1 < tfar ? t1 : tfar;
+            }
+            dist[i] = tnear;
+            if (tnear <= tfar) mask |= 1 << i;
+        }
+        return mask;
+#endif
+    }
+
+    // Мёллер-Трумбор; true и t, u, v — попадание на [tmin, tmax]
+    inline bool intersect_triangle(const BVHTriangle& tri, const Ray& ray, float tmax, float& t, float& u, float& v) {
+        Vec3f p = cross(ray.dir, tri.e2);
+        float det = tri.e1 * p;
+        if (std::abs(det) < 1e-12f) return false;
+        float inv = 1.f / det;
+        Vec3f s = ray.origin - tri.v0;
+        u = (s * p) * inv;
+        if (u < 0.f || u > 1.f) return false;
+        Vec3f q = cross(s, tri.e1);
+        v = (ray.dir * q) * inv;
+        if (v < 0.f || u + v > 1.f) return false;
+        t = (tri.e2 * q) * inv;
+        return t >= ray.tmin && t <= tmax;
+    }
+
+    struct StackEntry {
+        int node;
+        float t;
+    };
+}
+
+// Построение: узел получает до четырех детей последовательным делением
+// самого большого по площади диапазона лучшим разрезом SAH
+struct BVHBuilder {
+    BVH& bvh;
+    std::vector<PrimRef>& prims;
+    std::atomic<int> next_node;
+    std::atomic<int> spare_threads;
+    std::atomic<int> max_depth;
+
+    BVHBuilder(BVH& b, std::vector<PrimRef>& p, int threads)
+        : bvh(b), prims(p), next_node(0), spare_threads(threads - 1), max_depth(0) {
+    }
+
+    AABB bounds(int begin, int end) const {
+        AABB box;
+        for (int i = begin; i < end; i++) {
+            box.grow(prims[i].box);
+        }
+        return box;
+    }
+
+    // Делит [begin, end) по лучшей корзине SAH, mid — граница, left/right — рамки половин.
+    // false — лист дешевле (только для диапазонов не больше MAX_LEAF_SIZE)
+    bool split(int begin, int end, const AABB& box, int depth, int& mid, AABB& left, AABB& right) {
+        const int count = end - begin;
+        if (count <= 1) return false;
+
+        AABB centroids;
+        for (int i = begin; i < end; i++) {
+            centroids.grow(prims[i].centroid);
+        }
+
+        int best_axis = -1;
+        int best_bin = 0;
+        float best_cost = INF;
+        // Корзины всех трех осей заполняются за один проход по диапазону
+        int bin_count[3][BIN_COUNT];
+        AABB bin_box[3][BIN_COUNT];
+        float scale[3];
+        if (depth < MAX_SAH_DEPTH) {
+            for (int axis = 0; axis < 3; axis++) {
+                float extent = centroids.hi[axis] - centroids.lo[axis];
+                scale[axis] = extent > 0.f ? BIN_COUNT / extent : 0.f;
+                for (int b = 0; b < BIN_COUNT; b++) {
+                    bin_count[axis][b] = 0;
+                }
+            }
+            for (int i = begin; i < end; i++) {
+                const PrimRef& p = prims[i];
+                for (int axis = 0; axis < 3; axis++) {
+                    int b = std::min(BIN_COUNT - 1, static_cast<int>((p.centroid[axis] - centroids.lo[axis]) * scale[axis]));
+                    bin_count[axis][b]++;
+                    bin_box[axis][b].grow(p.box);
+                }
+            }
+            for (int axis = 0; axis < 3; axis++) {
+                if (scale[axis] <= 0.f) continue;
+                // Площади и числа слева от каждого разреза, затем проход справа
+                float left_area[BIN_COUNT];
+                int left_count[BIN_COUNT];
+                AABB acc;
+                int n = 0;
+                for (int b = 0; b < BIN_COUNT - 1; b++) {
+                    acc.grow(bin_box[axis][b]);
+                    n += bin_count[axis][b];
+                    left_area[b] = acc.area();
+                    left_count[b] = n;
+                }
+                acc = AABB();
+                n = 0;
+                for (int b = BIN_COUNT - 1; b > 0; b--) {
+                    acc.grow(bin_box[axis][b]);
+                    n += bin_count[axis][b];
+                    if (left_count[b - 1] == 0 || n == 0) continue;
+                    float cost = left_area[b - 1] * left_count[b - 1] + acc.area() * n;
+                    if (cost < best_cost) {
+                        best_cost = cost;
+                        best_axis = axis;
+                        best_bin = b;
+                    }
+                }
+            }
+        }
+
+        if (best_axis >= 0) {
+            // Стоимость в единицах теста треугольника: обход узла ~ одному тесту
+            float area = box.area();
+            float split_cost = 1.f + (area > 0.f ? best_cost / area : count);
+            if (count <= BVH::MAX_LEAF_SIZE && split_cost >= count) return false;
+            const float lo = centroids.lo[best_axis];
+            const float s = scale[best_axis];
+            const int axis = best_axis;
+            const int bin = best_bin;
+            PrimRef* m = std::partition(&prims[0] + begin, &prims[0] + end, [lo, s, axis, bin](const PrimRef& p) {
+                return std::min(BIN_COUNT - 1, static_cast<int>((p.centroid[axis] - lo) * s)) < bin;
+            });
+            mid = static_cast<int>(m - &prims[0]);
+            if (mid > begin && mid < end) {
+                left = AABB();
+                right = AABB();
+                for (int b = 0; b < BIN_COUNT; b++) {
+                    (b < bin ? left : right).grow(bin_box[axis][b]);
+                }
+                return true;
+            }
+        }
+        if (count <= BVH::MAX_LEAF_SIZE) return false;
+
+        // Центры совпадают или слишком глубоко: пополам по числу вдоль самой длинной оси
+        int axis = 0;
+        for (int k = 1; k < 3; k++) {
+            if (centroids.hi[k] - centroids.lo[k] > centroids.hi[axis] - centroids.lo[axis]) axis = k;
+        }
+        mid = begin + count / 2;
+        std::nth_element(&prims[0] + begin, &prims[0] + mid, &prims[0] + end, [axis](const PrimRef& a, const PrimRef& b) {
+            return a.centroid[axis] < b.centroid[axis];
+        });
+        left = bounds(begin, mid);
+        right = bounds(mid, end);
+        return true;
+    }
+
+    // Строит узел над [begin, end) с рамкой box, возвращает его индекс
+    int build_node(int begin, int end, const AABB& box, int depth) {
+        int expected = max_depth.load();
+        while (depth + 1 > expected && !max_depth.compare_exchange_weak(expected, depth + 1)) {
+        }
+
+        const int index = next_node.fetch_add(1);
+        struct Range {
+            int begin;
+            int end;
+            AABB box;
+            bool leaf;
+        };
+        Range ranges[4];
+        ranges[0].begin = begin;
+        ranges[0].end = end;
+        ranges[0].box = box;
+        ranges[0].leaf = false;
+        int n = 1;
+        while (n < 4) {
+            int pick = -1;
+            for (int i = 0; i < n; i++) {
+                if (ranges[i].leaf) continue;
+                if (pick < 0 || ranges[i].box.area() > ranges[pick].box.area()) pick = i;
+            }
+            if (pick < 0) break;
+            int mid;
+            AABB left, right;
+            if (!split(ranges[pick].begin, ranges[pick].end, ranges[pick].box, depth, mid, left, right)) {
+                ranges[pick].leaf = true;
+                continue;
+            }
+            ranges[n].begin = mid;
+            ranges[n].end = ranges[pick].end;
+            ranges[n].box = right;
+            ranges[n].leaf = false;
+            ranges[pick].end = mid;
+            ranges[pick].box = left;
+            n++;
+        }
+
+        // Дети-узлы: крупные поддеревья — в свободные потоки
+        int child[4];
+        std::vector<std::thread> workers;
+        for (int i = 0; i < n; i++) {
+            const Range& r = ranges[i];
+            if (r.end - r.begin <= BVH::MAX_LEAF_SIZE) {
+                child[i] = r.begin;
+                continue;
+            }
+            if (r.end - r.begin >= PARALLEL_MIN_PRIMS && spare_threads.fetch_sub(1) > 0) {
+                int* out = &child[i];
+                workers.push_back(std::thread([this, r, depth, out]() {
+                    TRACE_SCOPE("BVH subtree");
+                    *out = build_node(r.begin, r.end, r.box, depth + 1);
+                    spare_threads.fetch_add(1);
+                }));
+                continue;
+            }
+            if (r.end - r.begin >= PARALLEL_MIN_PRIMS) spare_threads.fetch_add(1);
+            child[i] = build_node(r.begin, r.end, r.box, depth + 1);
+        }
+        for (size_t t = 0; t < workers.size(); t++) {
+            workers[t].join();
+        }
+
+        BVHNode& node = bvh.nodes_[index];
+        for (int i = 0; i < 4; i++) {
+            if (i >= n) {
+                // Пустая рамка в бесконечности: вход и выход по каждой оси
+                // совпадают (+-inf), так что тест луча промахивается без проверки слота
+                node.min_x[i] = node.min_y[i] = node.min_z[i] = INF;
+                node.max_x[i] = node.max_y[i] = node.max_z[i] = INF;
+                node.child[i] = -1;
+                node.count[i] = 0;
+                continue;
+            }
+            const Range& r = ranges[i];
+            node.min_x[i] = r.box.lo[0];
+            node.min_y[i] = r.box.lo[1];
+            node.min_z[i] = r.box.lo[2];
+            node.max_x[i] = r.box.hi[0];
+            node.max_y[i] = r.box.hi[1];
+            node.max_z[i] = r.box.hi[2];
+            node.child[i] = child[i];
+            node.count[i] = r.end - r.begin <= BVH::MAX_LEAF_SIZE ? r.end - r.begin : 0;
+        }
+        return index;
+    }
+};
+
+BVH::BVH() : nodes_(NULL), nnodes_(0), capacity_(0), depth_(0) {
+}
+
+BVH::~BVH() {
+    clear();
+}
+
+void BVH::clear() {
+    if (nodes_) fbpool::release(nodes_, capacity_ * sizeof(BVHNode));
+    nodes_ = NULL;
+    nnodes_ = 0;
+    capacity_ = 0;
+    depth_ = 0;
+    triangles_.clear();
+}
+
+size_t BVH::memory_bytes() const {
+    return nnodes_ * sizeof(BVHNode) + triangles_.size() * sizeof(BVHTriangle);
+}
+
+void BVH::build(Model& model, int threads) {
+    TRACE_SCOPE("BVH::build");
+    clear();
+
+    std::vector<BVHTriangle> source;
+    std::vector<PrimRef> prims;
+    source.reserve(model.nfaces());
+    prims.reserve(model.nfaces());
+    for (int f = 0; f < model.nfaces(); f++) {
+        if (model.face(f).size() < 3) continue;
+        Vec3f v[3];
+        PrimRef ref;
+        for (int k = 0; k < 3; k++) {
+            v[k] = model.vert(f, k);
+            float p[4] = { v[k].x, v[k].y, v[k].z, 0.f };
+            ref.box.grow(p);
+        }
+        for (int k = 0; k < 4; k++) {
+            ref.centroid[k] = 0.5f * (ref.box.lo[k] + ref.box.hi[k]);
+        }
+        ref.index = static_cast<int>(source.size());
+        prims.push_back(ref);
+
+        BVHTriangle tri;
+        tri.v0 = v[0];
+        tri.e1 = v[1] - v[0];
+        tri.e2 = v[2] - v[0];
+        tri.face = f;
+        source.push_back(tri);
+    }
+    if (prims.empty()) return;
+
+    if (threads <= 0) {
+        threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    }
+    // У каждого внутреннего узла не меньше двух детей, так что узлов меньше, чем треугольников
+    capacity_ = static_cast<int>(prims.size());
+    nodes_ = static_cast<BVHNode*>(fbpool::acquire(capacity_ * sizeof(BVHNode)));
+
+    BVHBuilder builder(*this, prims, threads);
+    builder.build_node(0, static_cast<int>(prims.size()), builder.bounds(0, static_cast<int>(prims.size())), 0);
+    nnodes_ = builder.next_node.load();
+    depth_ = builder.max_depth.load();
+
+    // Лишний хвост массива узлов возвращаем в пул
+    if (nnodes_ < capacity_) {
+        BVHNode* compact = static_cast<BVHNode*>(fbpool::acquire(nnodes_ * sizeof(BVHNode)));
+        memcpy(compact, nodes_, nnodes_ * sizeof(BVHNode));
+        fbpool::release(nodes_, capacity_ * sizeof(BVHNode));
+        nodes_ = compact;
+        capacity_ = nnodes_;
+    }
+
+    // Треугольники в порядке листьев: лист читает их подряд
+    triangles_.resize(prims.size());
+    for (size_t i = 0; i < prims.size(); i++) {
+        triangles_[i] = source[prims[i].index];
+    }
+}
+
+bool BVH::intersect(const Ray& ray, RayHit& hit) const {
+    hit = RayHit();
+    if (empty()) return false;
+    const RayData r = prepare(ray);
+    float best = ray.tmax;
+
+    StackEntry stack[STACK_SIZE];
+    int sp = 0;
+    stack[sp].node = 0;
+    stack[sp].t = ray.tmin;
+    sp++;
+    float dist[4];
+    while (sp > 0) {
+        const StackEntry e = stack[--sp];
+        if (e.t > best) continue;
+        const BVHNode& node = nodes_[e.node];
+        int mask = intersect_children(node, r, best, dist);
+
+        StackEntry next[4];
+        int nnext = 0;
+        for (int i = 0; i < 4; i++) {
+            if (!(mask & (1 << i))) continue;
+            if (node.count[i] == 0) {
+                // Вставкой по убыванию расстояния: ближний ребенок снимается со стека первым
+                int j = nnext++;
+                while (j > 0 && next[j - 1].t < dist[i]) {
+                    next[j] = next[j - 1];
+                    j--;
+                }
+                next[j].node = node.child[i];
+                next[j].t = dist[i];
+                continue;
+            }
+            for (int k = 0; k < node.count[i]; k++) {
+                const BVHTriangle& tri = triangles_[node.child[i] + k];
+                float t, u, v;
+                if (intersect_triangle(tri, ray, best, t, u, v)) {
+                    best = t;
+                    hit.face = tri.face;
+                    hit.t = t;
+                    hit.bar = Vec3f(1.f - u - v, u, v);
+                }
+            }
+        }
+        for (int i = 0; i < nnext; i++) {
+            stack[sp++] = next[i];
+        }
+    }
+    return hit.face >= 0;
+}
+
+bool BVH::occluded(const Ray& ray) const {
+    if (empty()) return false;
+    const RayData r = prepare(ray);
+
+    int stack[STACK_SIZE];
+    int sp = 0;
+    stack[sp++] = 0;
+    float dist[4];
+    while (sp > 0) {
+        const BVHNode& node = nodes_[stack[--sp]];
+        int mask = intersect_children(node, r, ray.tmax, dist);
+        for (int i = 0; i < 4; i++) {
+            if (!(mask & (1 << i))) continue;
+            if (node.count[i] == 0) {
+                stack[sp++] = node.child[i];
+                continue;
+            }
+            for (int k = 0; k < node.count[i]; k++) {
+                float t, u, v;
+                if (intersect_triangle(triangles_[node.child[i] + k], ray, ray.tmax, t, u, v)) return true;
+            }
+        }
+    }
+    return false;
+}
+
+void BVH::query_frustum(const Matrix& clip, std::vector<int>& faces) const {
+    faces.clear();
+    if (empty()) return;
+
+    // Плоскости Гриббса-Хартманна: w + x >= 0, w - x >= 0 и т.д.
+    float planes[6][4];
+    for (int p = 0; p < 6; p++) {
+        float sign = (p & 1) ? -1.f : 1.f;
+        for (int k = 0; k < 4; k++) {
+            planes[p][k] = clip[3][k] + sign * clip[p / 2][k];
+        }
+    }
+
+    // Второе поле — поддерево целиком внутри, плоскости больше не проверяются
+    std::vector<std::pair<int, bool> > stack;
+    stack.push_back(std::make_pair(0, false));
+    while (!stack.empty()) {
+        std::pair<int, bool> e = stack.back();
+        stack.pop_back();
+        const BVHNode& node = nodes_[e.first];
+        for (int i = 0; i < 4; i++) {
+            if (node.child[i] < 0) continue;
+            bool inside = e.second;
+            if (!inside) {
+                const float lo[3] = { node.min_x[i], node.min_y[i], node.min_z[i] };
+                const float hi[3] = { node.max_x[i], node.max_y[i], node.max_z[i] };
+                bool outside = false;
+                inside = true;
+                for (int p = 0; p < 6 && !outside; p++) {
+                    // Дальняя (p) и ближняя (n) по нормали вершины рамки
+                    float dp = planes[p][3];
+                    float dn = planes[p][3];
+                    for (int k = 0; k < 3; k++) {
+                        dp += planes[p][k] * (planes[p][k] >= 0.f ? hi[k] : lo[k]);
+                        dn += planes[p][k] * (planes[p][k] >= 0.f ? lo[k] : hi[k]);
+                    }
+                    if (dp < 0.f) outside = true;
+                    if (dn < 0.f) inside = false;
+                }
+                if (outside) continue;
+            }
+            if (node.count[i] == 0) {
+                stack.push_back(std::make_pair(node.child[i], inside));
+                continue;
+            }
+            for (int k = 0; k < node.count[i]; k++) {
+                faces.push_back(triangles_[node.child[i] + k].face);
+            }
+        }
+    }
+}
+
+Ray screen_ray(const Matrix& screen_from_world, float x, float y, float z_near, float z_far) {
+    Matrix inv = inverse(screen_from_world);
+    Vec4f a = inv * Vec4f(x, y, z_near, 1.f);
+    Vec4f b = inv * Vec4f(x, y, z_far, 1.f);
+    Vec3f from(a.x / a.w, a.y / a.w, a.z / a.w);
+    Vec3f to(b.x / b.w, b.y / b.w, b.z / b.w);
+    return Ray(from, to - from, 0.f, 1.f);
+}
@@ -0,0 +1,91 @@
+﻿#ifndef BVH_H
+#define BVH_H
+
+#include <cstddef>
+#include <vector>
+#include "geometry.h"
+#include "model.h"
+
+struct Ray {
+    Vec3f origin;
+    Vec3f dir;   // не обязательно единичный, t измеряется в его длинах
+    float tmin;
+    float tmax;
+
+    Ray(const Vec3f& o, const Vec3f& d, float t0 = 0.f, float t1 = 1e30f) : origin(o), dir(d), tmin(t0), tmax(t1) {}
+};
+
+struct RayHit {
+    int face;   // -1 — промах
+    float t;
+    Vec3f bar;  // веса вершин 0, 1, 2 грани, как у IShader::fragment()
+
+    RayHit() : face(-1), t(0.f), bar(0, 0, 0) {}
+};
+
+// Узел 4-арного BVH: границы четырех детей лежат по осям (SoA), чтобы
+// проверять луч сразу против всех четырех одним SSE-проходом.
+// 128 байт — ровно две кэш-линии, массив узлов выровнен на 64
+struct BVHNode {
+    float min_x[4], min_y[4], min_z[4];
+    float max_x[4], max_y[4], max_z[4];
+    int child[4]; // индекс узла или первого треугольника листа; -1 — пустой слот
+    int count[4]; // 0 — внутренний узел, иначе число треугольников листа
+};
+
+// Треугольник в виде для теста Мёллера-Трумбора
+struct BVHTriangle {
+    Vec3f v0;
+    Vec3f e1; // v1 - v0
+    Vec3f e2; // v2 - v0
+    int face;
+};
+
+// Иерархия ограничивающих объемов над гранями модели. Строится биннингом
+// по SAH: узел делится до четырех раз по лучшей из 16 корзин на каждой оси.
+// Крупные поддеревья строятся отдельными потоками
+class BVH {
+public:
+    // Больше треугольников лист не хранит
+    static const int MAX_LEAF_SIZE = 4;
+
+    BVH();
+    ~BVH();
+
+    // threads = 0 — по числу ядер. Модель после построения не нужна
+    void build(Model& model, int threads = 0);
+    void clear();
+
+    bool empty() const { return nnodes_ == 0; }
+    int nnodes() const { return nnodes_; }
+    int ntriangles() const { return static_cast<int>(triangles_.size()); }
+    int depth() const { return depth_; }
+    size_t memory_bytes() const;
+
+    // Ближайшее пересечение на [tmin, tmax]; false — промах
+    bool intersect(const Ray& ray, RayHit& hit) const;
+    // Есть ли хоть одно пересечение на [tmin, tmax] (тени, AO) — выход по первому
+    bool occluded(const Ray& ray) const;
+
+    // Грани, чьи листья пересекают пирамиду видимости clip = projection * view
+    // (консервативно: плоскости -w <= x, y, z <= w, лист целиком или никак)
+    void query_frustum(const Matrix& clip, std::vector<int>& faces) const;
+
+private:
+    BVHNode* nodes_;
+    int nnodes_;
+    int capacity_;
+    int depth_;
+    std::vector<BVHTriangle> triangles_;
+
+    friend struct BVHBuilder;
+
+    BVH(const BVH&);
+    BVH& operator=(const BVH&);
+};
+
+// Луч через точку (x, y) экрана: screen_from_world = viewport * projection * view,
+// от глубины z_near до z_far (z/w, больше — ближе к камере). t = 0 на z_near, 1 на z_far
+Ray screen_ray(const Matrix& screen_from_world, float x, float y, float z_near, float z_far);
+
+#endif
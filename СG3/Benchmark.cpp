@@ -0,0 +1,270 @@
+﻿#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <thread>
+#include <vector>
+#include "Benchmark.h"
+#include "model.h"
+#include "Camera.h"
+#include "Framebuffer.h"
+#include "Json.h"
+#include "Meshlet.h"
+#include "Renderer.h"
+#include "ShaderFactory.h"
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+double elapsed_ms(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+const char* const DEFAULT_MODELS[] = { "obj/african_head.obj", "obj/peter_griffin.obj" };
+const int RESOLUTIONS[][2] = { { 256, 256 }, { 800, 800 }, { 1920, 1080 } };
+
+// Ячейка счетчика копии шейдера (потока) — ровно строка кэша
+struct CounterSlot {
+    long long fragments;
+    char padding[56];
+};
+
+// Ячейки всех копий в одном буфере из пула кадров: он выровнен на 64 байта,
+// поэтому соседние потоки не делят строку кэша
+class CounterSlots {
+public:
+    explicit CounterSlots(size_t capacity)
+        : capacity_(std::max<size_t>(1, capacity)), size_(0),
+          data_(static_cast<CounterSlot*>(fbpool::acquire(capacity_ * sizeof(CounterSlot)))) {
+        if (!data_) throw std::bad_alloc();
+        std::fill(data_, data_ + capacity_, CounterSlot());
+    }
+
+    ~CounterSlots() {
+        fbpool::release(data_, capacity_ * sizeof(CounterSlot));
+    }
+
+    // NULL — ячейки кончились
+    CounterSlot* add() {
+        return size_ < capacity_ ? &data_[size_++] : NULL;
+    }
+
+    long long fragments() const {
+        long long total = 0;
+        for (size_t i = 0; i < size_; i++) total += data_[i].fragments;
+        return total;
+    }
+
+private:
+    size_t capacity_;
+    size_t size_;
+    CounterSlot* data_;
+
+    CounterSlots(const CounterSlots&);
+    CounterSlots& operator=(const CounterSlots&);
+};
+
+// Счетчик вызовов фрагментного шейдера. У каждой копии (потока) своя ячейка,
+// копии создаются до запуска потоков
+struct CountingShader : public IShader {
+    IShader* inner;
+    bool owns_inner;
+    CounterSlots* slots;
+    CounterSlot* slot;
+
+    CountingShader(IShader* shader, CounterSlots* counters, CounterSlot* own)
+        : inner(shader), owns_inner(false), slots(counters), slot(own) {
+    }
+
+    ~CountingShader() {
+        if (owns_inner) delete inner;
+    }
+
+    virtual IShader* clone() const {
+        CounterSlot* own = slots->add();
+        if (!own) return NULL;
+        IShader* copy = inner->clone();
+        if (!copy) return NULL;
+        CountingShader* c = new CountingShader(copy, slots, own);
+        c->owns_inner = true;
+        return c;
+    }
+
+    virtual Vec4f vertex(int iface, int nthvert) {
+        return inner->vertex(iface, nthvert);
+    }
+
+    virtual int varying_size() const {
+        return inner->varying_size();
+    }
+
+    virtual Vec4f vertex_varying(int iface, int nthvert, float* out) {
+        return inner->vertex_varying(iface, nthvert, out);
+    }
+
+    virtual void load_varyings(int iface, const float* const* varyings) {
+        inner->load_varyings(iface, varyings);
+    }
+
+    virtual bool fragment_linear(Vec3f bar, Vec4f& color) {
+        slot->fragments++;
+        inner->gl_FragCoord = gl_FragCoord;
+        return inner->fragment_linear(bar, color);
+    }
+
+    virtual bool fragment(Vec3f bar, TGAColor& color) {
+        slot->fragments++;
+        inner->gl_FragCoord = gl_FragCoord;
+        return inner->fragment(bar, color);
+    }
+};
+
+struct Result {
+    std::string model;
+    int faces;
+    double load_ms;
+    double meshlet_ms;
+    const char* shader;
+    int width;
+    int height;
+    double draw_ms;      // draw_meshlets() целиком, без счетчиков
+    double draw_min_ms;
+    double vertex_ms;    // стадии по PipelineStats (сумма по потокам)
+    double bin_ms;
+    double raster_ms;
+    long long fragments;
+    long long covered;
+};
+
+void write_json(std::ostream& out, const BenchmarkOptions& options, int threads, const std::vector<Result>& results) {
+    out << std::fixed << std::setprecision(3);
+    out << "{\n";
+    out << "  \"iterations\": " << options.iterations << ",\n";
+    out << "  \"threads\": " << threads << ",\n";
+    out << "  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result& r = results[i];
+        double overdraw = r.covered > 0 ? double(r.fragments) / r.covered : 0.0;
+        double fps = r.draw_ms > 0.0 ? 1000.0 / r.draw_ms : 0.0;
+        out << "    {\"model\": \"" << json_escape(r.model) << "\", \"faces\": " << r.faces
+            << ", \"shader\": \"" << json_escape(r.shader) << "\", \"width\": " << r.width << ", \"height\": " << r.height
+            << ", \"load_ms\": " << r.load_ms << ", \"meshlet_ms\": " << r.meshlet_ms
+            << ", \"draw_ms\": " << r.draw_ms << ", \"draw_min_ms\": " << r.draw_min_ms
+            << ", \"vertex_ms\": " << r.vertex_ms << ", \"bin_ms\": " << r.bin_ms << ", \"raster_ms\": " << r.raster_ms
+            << ", \"fragments\": " << r.fragments << ", \"covered_pixels\": " << r.covered
+            << ", \"overdraw\": " << overdraw << ", \"fps\": " << fps << "}"
+            << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n";
+    out << "}\n";
+}
+
+}
+
+int run_benchmark(const BenchmarkOptions& options) {
+    std::vector<std::string> models = options.models;
+    if (models.empty()) {
+        models.assign(DEFAULT_MODELS, DEFAULT_MODELS + sizeof(DEFAULT_MODELS) / sizeof(DEFAULT_MODELS[0]));
+    }
+    int iterations = std::max(1, options.iterations);
+    int threads = options.threads > 0 ? options.threads : static_cast<int>(std::thread::hardware_concurrency());
+
+    std::vector<Result> results;
+    for (size_t m = 0; m < models.size(); m++) {
+        Clock::time_point start = Clock::now();
+        Model model(models[m].c_str());
+        double load_ms = elapsed_ms(start);
+        if (model.nfaces() == 0) {
+            std::cerr << "ERROR: Model not loaded: " << models[m] << std::endl;
+            return -1;
+        }
+        start = Clock::now();
+        MeshletMesh meshlets;
+        meshlets.build(model);
+        double meshlet_ms = elapsed_ms(start);
+
+        for (int s = 0; s < SHADER_COUNT; s++) {
+            for (size_t r = 0; r < sizeof(RESOLUTIONS) / sizeof(RESOLUTIONS[0]); r++) {
+                int width = RESOLUTIONS[r][0];
+                int height = RESOLUTIONS[r][1];
+                std::cerr << "Benchmark: " << models[m] << " " << SHADER_NAMES[s] << " "
+                          << width << "x" << height << std::endl;
+
+                // Та же сцена, что и в main по умолчанию
+                Framebuffer fb(width, height);
+                Camera camera(Vec3f(1, 0, 1), Vec3f(0, 0, 0), Vec3f(0, 1, 0));
+                IShader* shader = create_shader(SHADER_NAMES[s], &model, camera, Vec3f(1, 1, 1).normalize());
+                RenderOptions render;
+                render.threads = threads;
+                render.clip_plane = 0.15f;
+
+                Result res;
+                res.model = models[m];
+                res.faces = model.nfaces();
+                res.load_ms = load_ms;
+                res.meshlet_ms = meshlet_ms;
+                res.shader = SHADER_NAMES[s];
+                res.width = width;
+                res.height = height;
+                // Прогрев: пул памяти, LUT'ы, кэши
+                fb.clear();
+                draw_meshlets(meshlets, camera, *shader, fb, render);
+
+                double total = 0.0;
+                res.draw_min_ms = 0.0;
+                for (int it = 0; it < iterations; it++) {
+                    fb.clear();
+                    start = Clock::now();
+                    draw_meshlets(meshlets, camera, *shader, fb, render);
+                    double ms = elapsed_ms(start);
+                    total += ms;
+                    res.draw_min_ms = it == 0 ? ms : std::min(res.draw_min_ms, ms);
+                }
+                res.draw_ms = total / iterations;
+
+                // Время стадий меряет сам рендерер; счетчики замедляют растеризацию,
+                // поэтому это отдельные кадры, не входящие в draw_ms
+                PipelineStats stats;
+                RenderOptions staged = render;
+                staged.stats = &stats;
+                for (int it = 0; it < iterations; it++) {
+                    fb.clear();
+                    draw_meshlets(meshlets, camera, *shader, fb, staged);
+                }
+                res.vertex_ms = stats.vertex_ns / 1e6 / iterations;
+                res.bin_ms = stats.bin_ns / 1e6 / iterations;
+                res.raster_ms = stats.raster_ns / 1e6 / iterations;
+
+                // Отдельный проход со счетчиком фрагментов
+                CounterSlots slots(threads);
+                CountingShader counting(shader, &slots, slots.add());
+                fb.clear();
+                float cleared = fb.depth_at(0);
+                draw_meshlets(meshlets, camera, counting, fb, render);
+                res.fragments = slots.fragments();
+                res.covered = 0;
+                for (size_t k = 0; k < fb.pixel_count(); k++) {
+                    if (fb.depth_at(k) != cleared) res.covered++;
+                }
+                results.push_back(res);
+                delete shader;
+            }
+        }
+    }
+
+    if (options.output_path.empty()) {
+        write_json(std::cout, options, threads, results);
+    }
+    else {
+        std::ofstream out(options.output_path.c_str());
+        if (!out) {
+            std::cerr << "ERROR: cannot write " << options.output_path << std::endl;
+            return -1;
+        }
+        write_json(out, options, threads, results);
+    }
+    return 0;
+}
@@ -0,0 +1,22 @@
+﻿#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <string>
+#include <vector>
+
+struct BenchmarkOptions {
+    std::vector<std::string> models; // пусто — модели из obj/
+    int iterations;                  // кадров на каждую конфигурацию
+    int threads;                     // 0 — по числу ядер
+    std::string output_path;         // пусто — JSON в stdout
+
+    BenchmarkOptions() : iterations(10), threads(0) {}
+};
+
+// Прогоняет модели через все шейдеры на нескольких разрешениях и пишет
+// JSON: время загрузки, кадра целиком (draw_ms) и его стадий — вершинной,
+// раскладки и растеризации по счетчикам рендерера, число фрагментов,
+// перерисовку и кадры в секунду. Возвращает код завершения для main
+int run_benchmark(const BenchmarkOptions& options);
+
+#endif
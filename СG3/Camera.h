@@ -1,6 +1,7 @@
-#ifndef CAMERA_H
+﻿#ifndef CAMERA_H
 #define CAMERA_H
 
+#include <cmath>
 #include "geometry.h"
 
 class Camera {
@@ -10,10 +11,11 @@ private:
     Vec3f up;
     Matrix view_matrix;
     Matrix projection_matrix;
+    bool perspective;
 
 public:
     Camera(Vec3f eye_pos, Vec3f look_at, Vec3f up_dir)
-        : eye(eye_pos), center(look_at), up(up_dir) {
+        : eye(eye_pos), center(look_at), up(up_dir), perspective(false) {
         update_view_matrix();
         update_projection_matrix();
     }
@@ -30,14 +32,46 @@ public:
             view_matrix[2][i] = z[i];
             view_matrix[i][3] = -center[i];
         }
+        if (perspective) {
+            // Для перспективы камера должна стоять в eye, а не в center
+            view_matrix[0][3] = -(x * eye);
+            view_matrix[1][3] = -(y * eye);
+            view_matrix[2][3] = -(z * eye);
+        }
     }
 
     void update_projection_matrix(float coeff = 0.f) {
+        perspective = false;
         projection_matrix = Matrix::identity();
         projection_matrix[3][2] = coeff;
+        update_view_matrix();
     }
 
+    // Перспективная проекция. Глубина z/w: +1 на near, -1 на far
+    // (больше — ближе, как и в z-буфере), w = расстояние вдоль оси взгляда.
+    // reversed_z: z/w = near / w, то есть 1 на near и 0 на бесконечности —
+    // точность float распределяется равномерно по дальности (far не используется)
+    void set_perspective(float fov_deg, float aspect, float near_plane, float far_plane, bool reversed_z = false) {
+        perspective = true;
+        float f = 1.f / std::tan(fov_deg * 3.14159265f / 360.f);
+        projection_matrix = Matrix();
+        projection_matrix[0][0] = f / aspect;
+        projection_matrix[1][1] = f;
+        projection_matrix[2][2] = (far_plane + near_plane) / (far_plane - near_plane);
+        projection_matrix[2][3] = 2.f * far_plane * near_plane / (far_plane - near_plane);
+        projection_matrix[3][2] = -1.f;
+        if (reversed_z) {
+            projection_matrix[2][2] = 0.f;
+            projection_matrix[2][3] = near_plane;
+        }
+        update_view_matrix();
+    }
+
+    bool is_perspective() const { return perspective; }
+
     Matrix get_view_matrix() const { return view_matrix; }
+    Vec3f get_eye() const { return eye; }
+    Vec3f get_center() const { return center; }
     Matrix get_projection_matrix() const { return projection_matrix; }
 
     void set_eye(const Vec3f& new_eye) {
@@ -0,0 +1,419 @@
+﻿#include <algorithm>
+#include <cstring>
+#include "Deflate.h"
+
+namespace {
+    const int LITLEN_CODES = 286;
+    const int DIST_CODES = 30;
+    const int CODELEN_CODES = 19;
+    const int END_OF_BLOCK = 256;
+
+    const int MIN_MATCH = 4; // совпадения из 3 байт почти не окупаются
+    const int MAX_MATCH = 258;
+    const int WINDOW = 32768;
+    const int HASH_BITS = 15;
+    const size_t BLOCK_SYMBOLS = 1 << 15;
+
+    const int LENGTH_BASE[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+    const int LENGTH_EXTRA[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                  3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+    const int DIST_BASE[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+                               257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+    const int DIST_EXTRA[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+                                7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+    // Порядок длин кодов длин в заголовке динамического блока
+    const int CODELEN_ORDER[CODELEN_CODES] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+    // Биты пишутся начиная с младшего
+    struct BitWriter {
+        std::vector<unsigned char>& out;
+        uint64_t bits;
+        int count;
+
+        explicit BitWriter(std::vector<unsigned char>& buffer) : out(buffer), bits(0), count(0) {}
+
+        void put(uint32_t value, int n) {
+            bits |= static_cast<uint64_t>(value) << count;
+            count += n;
+            while (count >= 8) {
+                out.push_back(static_cast<unsigned char>(bits));
+                bits >>= 8;
+                count -= 8;
+            }
+        }
+
+        void align() {
+            if (count > 0) put(0, 8 - count);
+        }
+    };
+
+    // dist = 0 — литерал value, иначе совпадение длины value
+    struct Symbol {
+        uint16_t value;
+        uint16_t dist;
+    };
+
+    struct Code {
+        uint16_t bits; // код Хаффмана с обращенным порядком битов
+        uint8_t length;
+    };
+
+    int length_code(int length) {
+        return static_cast<int>(std::upper_bound(LENGTH_BASE, LENGTH_BASE + 29, length) - LENGTH_BASE) - 1;
+    }
+
+    int dist_code(int dist) {
+        return static_cast<int>(std::upper_bound(DIST_BASE, DIST_BASE + 30, dist) - DIST_BASE) - 1;
+    }
+
+    // Длины кодов Хаффмана не длиннее max_bits. Дерево строится методом двух
+    // очередей, переполнение длин исправляется перераспределением (как в miniz)
+    void build_lengths(const uint32_t* freq, int n, int max_bits, uint8_t* lengths) {
+        std::vector<int> symbols;
+        for (int i = 0; i < n; i++) {
+            lengths[i] = 0;
+            if (freq[i] > 0) symbols.push_back(i);
+        }
+        int m = static_cast<int>(symbols.size());
+        if (m == 0) return;
+        if (m == 1) {
+            lengths[symbols[0]] = 1;
+            return;
+        }
+        std::stable_sort(symbols.begin(), symbols.end(), [freq](int a, int b) { return freq[a] < freq[b]; });
+
+        // Листья 0..m-1 по возрастанию частоты, внутренние узлы m..2m-2
+        std::vector<uint64_t> weight(2 * m - 1);
+        std::vector<int> parent(2 * m - 1, 0);
+        for (int i = 0; i < m; i++) {
+            weight[i] = freq[symbols[i]];
+        }
+        int leaf = 0;
+        int node = m;
+        for (int next = m; next < 2 * m - 1; next++) {
+            int pick[2];
+            for (int k = 0; k < 2; k++) {
+                if (leaf < m && (node >= next || weight[leaf] <= weight[node])) pick[k] = leaf++;
+                else pick[k] = node++;
+            }
+            weight[next] = weight[pick[0]] + weight[pick[1]];
+            parent[pick[0]] = next;
+            parent[pick[1]] = next;
+        }
+        std::vector<int> depth(2 * m - 1, 0);
+        int num_codes[32] = {0};
+        for (int i = 2 * m - 3; i >= 0; i--) {
+            depth[i] = depth[parent[i]] + 1;
+            if (i < m) num_codes[std::min(depth[i], max_bits)]++;
+        }
+
+        uint32_t total = 0;
+        for (int i = max_bits; i > 0; i--) {
+            total += static_cast<uint32_t>(num_codes[i]) << (max_bits - i);
+        }
+        while (total != (1u << max_bits)) {
+            num_codes[max_bits]--;
+            for (int i = max_bits - 1; i > 0; i--) {
+                if (num_codes[i]) {
+                    num_codes[i]--;
+                    num_codes[i + 1] += 2;
+                    break;
+                }
+            }
+            total--;
+        }
+
+        // Самые редкие символы получают самые длинные коды
+        int s = 0;
+        for (int len = max_bits; len > 0; len--) {
+            for (int k = 0; k < num_codes[len]; k++) {
+                lengths[symbols[s++]] = static_cast<uint8_t>(len);
+            }
+        }
+    }
+
+    // Канонические коды по длинам
+    void assign_codes(const uint8_t* lengths, int n, Code* codes) {
+        int bl_count[16] = {0};
+        for (int i = 0; i < n; i++) {
+            bl_count[lengths[i]]++;
+        }
+        bl_count[0] = 0;
+        int next_code[16] = {0};
+        int code = 0;
+        for (int len = 1; len < 16; len++) {
+            code = (code + bl_count[len - 1]) << 1;
+            next_code[len] = code;
+        }
+        for (int i = 0; i < n; i++) {
+            int len = lengths[i];
+            codes[i].length = static_cast<uint8_t>(len);
+            codes[i].bits = 0;
+            if (len == 0) continue;
+            int c = next_code[len]++;
+            int reversed = 0;
+            for (int b = 0; b < len; b++) {
+                reversed = (reversed << 1) | ((c >> b) & 1);
+            }
+            codes[i].bits = static_cast<uint16_t>(reversed);
+        }
+    }
+
+    // Декодеры не принимают неполный код из одного символа для длин кодов,
+    // поэтому в каждом алфавите используется хотя бы два символа
+    void ensure_two_symbols(uint32_t* freq, int n) {
+        int used = 0;
+        for (int i = 0; i < n && used < 2; i++) {
+            if (freq[i] > 0) used++;
+        }
+        for (int i = 0; i < n && used < 2; i++) {
+            if (freq[i] == 0) {
+                freq[i] = 1;
+                used++;
+            }
+        }
+    }
+
+    void write_block(BitWriter& out, const std::vector<Symbol>& symbols, bool final) {
+        uint32_t litlen_freq[LITLEN_CODES] = {0};
+        uint32_t dist_freq[DIST_CODES] = {0};
+        for (size_t i = 0; i < symbols.size(); i++) {
+            const Symbol& s = symbols[i];
+            if (s.dist == 0) {
+                litlen_freq[s.value]++;
+            }
+            else {
+                litlen_freq[257 + length_code(s.value)]++;
+                dist_freq[dist_code(s.dist)]++;
+            }
+        }
+        litlen_freq[END_OF_BLOCK] = 1;
+        ensure_two_symbols(litlen_freq, LITLEN_CODES);
+        ensure_two_symbols(dist_freq, DIST_CODES);
+
+        uint8_t lengths[LITLEN_CODES + DIST_CODES];
+        build_lengths(litlen_freq, LITLEN_CODES, 15, lengths);
+        build_lengths(dist_freq, DIST_CODES, 15, lengths + LITLEN_CODES);
+        Code litlen_codes[LITLEN_CODES];
+        Code dist_codes[DIST_CODES];
+        assign_codes(lengths, LITLEN_CODES, litlen_codes);
+        assign_codes(lengths + LITLEN_CODES, DIST_CODES, dist_codes);
+
+        int hlit = LITLEN_CODES;
+        while (hlit > 257 && lengths[hlit - 1] == 0) hlit--;
+        int hdist = DIST_CODES;
+        while (hdist > 1 && lengths[LITLEN_CODES + hdist - 1] == 0) hdist--;
+
+        // Длины обоих алфавитов подряд, сжатые повторами (коды 16, 17, 18)
+        uint8_t all[LITLEN_CODES + DIST_CODES];
+        memcpy(all, lengths, hlit);
+        memcpy(all + hlit, lengths + LITLEN_CODES, hdist);
+        int total = hlit + hdist;
+        std::vector<uint8_t> cl_symbols;
+        std::vector<uint8_t> cl_extra;
+        uint32_t cl_freq[CODELEN_CODES] = {0};
+        for (int i = 0; i < total;) {
+            int len = all[i];
+            int run = 1;
+            while (i + run < total && all[i + run] == len) run++;
+            i += run;
+            if (len == 0) {
+                while (run >= 11) {
+                    int r = std::min(run, 138);
+                    cl_symbols.push_back(18);
+                    cl_extra.push_back(static_cast<uint8_t>(r - 11));
+                    run -= r;
+                }
+                if (run >= 3) {
+                    cl_symbols.push_back(17);
+                    cl_extra.push_back(static_cast<uint8_t>(run - 3));
+                    run = 0;
+                }
+            }
+            else {
+                cl_symbols.push_back(static_cast<uint8_t>(len));
+                cl_extra.push_back(0);
+                run--;
+                while (run >= 3) {
+                    int r = std::min(run, 6);
+                    cl_symbols.push_back(16);
+                    cl_extra.push_back(static_cast<uint8_t>(r - 3));
+                    run -= r;
+                }
+            }
+            for (; run > 0; run--) {
+                cl_symbols.push_back(static_cast<uint8_t>(len));
+                cl_extra.push_back(0);
+            }
+        }
+        for (size_t i = 0; i < cl_symbols.size(); i++) {
+            cl_freq[cl_symbols[i]]++;
+        }
+        ensure_two_symbols(cl_freq, CODELEN_CODES);
+        uint8_t cl_lengths[CODELEN_CODES];
+        Code cl_codes[CODELEN_CODES];
+        build_lengths(cl_freq, CODELEN_CODES, 7, cl_lengths);
+        assign_codes(cl_lengths, CODELEN_CODES, cl_codes);
+        int hclen = CODELEN_CODES;
+        while (hclen > 4 && cl_lengths[CODELEN_ORDER[hclen - 1]] == 0) hclen--;
+
+        out.put(final ? 1 : 0, 1);
+        out.put(2, 2);
+        out.put(hlit - 257, 5);
+        out.put(hdist - 1, 5);
+        out.put(hclen - 4, 4);
+        for (int i = 0; i < hclen; i++) {
+            out.put(cl_lengths[CODELEN_ORDER[i]], 3);
+        }
+        for (size_t i = 0; i < cl_symbols.size(); i++) {
+            int s = cl_symbols[i];
+            out.put(cl_codes[s].bits, cl_codes[s].length);
+            if (s == 16) out.put(cl_extra[i], 2);
+            else if (s == 17) out.put(cl_extra[i], 3);
+            else if (s == 18) out.put(cl_extra[i], 7);
+        }
+
+        for (size_t i = 0; i < symbols.size(); i++) {
+            const Symbol& s = symbols[i];
+            if (s.dist == 0) {
+                out.put(litlen_codes[s.value].bits, litlen_codes[s.value].length);
+                continue;
+            }
+            int lc = length_code(s.value);
+            out.put(litlen_codes[257 + lc].bits, litlen_codes[257 + lc].length);
+            if (LENGTH_EXTRA[lc]) out.put(s.value - LENGTH_BASE[lc], LENGTH_EXTRA[lc]);
+            int dc = dist_code(s.dist);
+            out.put(dist_codes[dc].bits, dist_codes[dc].length);
+            if (DIST_EXTRA[dc]) out.put(s.dist - DIST_BASE[dc], DIST_EXTRA[dc]);
+        }
+        out.put(litlen_codes[END_OF_BLOCK].bits, litlen_codes[END_OF_BLOCK].length);
+    }
+
+    inline uint32_t read32(const unsigned char* p) {
+        uint32_t v;
+        memcpy(&v, p, 4);
+        return v;
+    }
+
+    inline uint32_t hash4(uint32_t v) {
+        return (v * 2654435761u) >> (32 - HASH_BITS);
+    }
+
+    struct CrcTable {
+        uint32_t entries[256];
+
+        CrcTable() {
+            for (uint32_t n = 0; n < 256; n++) {
+                uint32_t c = n;
+                for (int k = 0; k < 8; k++) {
+                    c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                }
+                entries[n] = c;
+            }
+        }
+    };
+}
+
+namespace deflate {
+    void compress(const unsigned char* data, size_t size, bool final, std::vector<unsigned char>& out) {
+        BitWriter writer(out);
+        std::vector<int> head(1 << HASH_BITS, -1);
+        std::vector<Symbol> symbols;
+        symbols.reserve(BLOCK_SYMBOLS);
+
+        size_t i = 0;
+        while (i < size) {
+            Symbol s;
+            s.value = data[i];
+            s.dist = 0;
+            size_t advance = 1;
+            if (i + MIN_MATCH <= size) {
+                uint32_t v = read32(data + i);
+                uint32_t h = hash4(v);
+                int candidate = head[h];
+                head[h] = static_cast<int>(i);
+                if (candidate >= 0 && i - candidate <= WINDOW && read32(data + candidate) == v) {
+                    size_t limit = std::min<size_t>(MAX_MATCH, size - i);
+                    size_t length = MIN_MATCH;
+                    while (length < limit && data[candidate + length] == data[i + length]) length++;
+                    s.value = static_cast<uint16_t>(length);
+                    s.dist = static_cast<uint16_t>(i - candidate);
+                    advance = length;
+                    // Позиции внутри совпадения тоже попадают в словарь
+                    for (size_t k = i + 1; k < i + length && k + MIN_MATCH <= size; k++) {
+                        head[hash4(read32(data + k))] = static_cast<int>(k);
+                    }
+                }
+            }
+            symbols.push_back(s);
+            i += advance;
+
+            if (symbols.size() == BLOCK_SYMBOLS && i < size) {
+                write_block(writer, symbols, false);
+                symbols.clear();
+            }
+        }
+
+        if (!symbols.empty()) {
+            write_block(writer, symbols, final);
+        }
+        else if (final) {
+            // Пустой последний stored-блок
+            writer.put(1, 1);
+            writer.put(0, 2);
+            writer.align();
+            writer.put(0x0000, 16);
+            writer.put(0xFFFF, 16);
+            return;
+        }
+        if (!final) {
+            writer.put(0, 1);
+            writer.put(0, 2);
+            writer.align();
+            writer.put(0x0000, 16);
+            writer.put(0xFFFF, 16);
+        }
+        writer.align();
+    }
+
+    uint32_t adler32(uint32_t adler, const unsigned char* data, size_t size) {
+        uint32_t a = adler & 0xFFFF;
+        uint32_t b = adler >> 16;
+        while (size > 0) {
+            // 5552 — наибольшая длина, при которой b не переполняется до взятия остатка
+            size_t n = std::min<size_t>(size, 5552);
+            size -= n;
+            for (; n > 0; n--) {
+                a += *data++;
+                b += a;
+            }
+            a %= 65521;
+            b %= 65521;
+        }
+        return a | (b << 16);
+    }
+
+    uint32_t adler32_combine(uint32_t adler1, uint32_t adler2, size_t size2) {
+        const uint32_t BASE = 65521;
+        uint32_t rem = static_cast<uint32_t>(size2 % BASE);
+        uint32_t sum1 = adler1 & 0xFFFF;
+        uint32_t sum2 = static_cast<uint32_t>((static_cast<uint64_t>(rem) * sum1) % BASE);
+        sum1 += (adler2 & 0xFFFF) + BASE - 1;
+        sum2 += (adler1 >> 16) + (adler2 >> 16) + BASE - rem;
+        if (sum1 >= BASE) sum1 -= BASE;
+        if (sum1 >= BASE) sum1 -= BASE;
+        if (sum2 >= 2 * BASE) sum2 -= 2 * BASE;
+        if (sum2 >= BASE) sum2 -= BASE;
+        return sum1 | (sum2 << 16);
+    }
+
+    uint32_t crc32(uint32_t crc, const unsigned char* data, size_t size) {
+        static const CrcTable table;
+        crc = ~crc;
+        for (size_t i = 0; i < size; i++) {
+            crc = table.entries[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+        }
+        return ~crc;
+    }
+}
@@ -0,0 +1,25 @@
+﻿#ifndef DEFLATE_H
+#define DEFLATE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Быстрый кодер deflate (RFC 1951) для записи PNG: жадный LZ77 с одной
+// пробой хеш-таблицы и динамические коды Хаффмана на каждый блок.
+// Сжимает хуже zlib -9, зато на порядок быстрее
+namespace deflate {
+    // Дописывает в out блоки deflate для data, выровненные на границу байта.
+    // final = false заканчивается пустым stored-блоком (как Z_SYNC_FLUSH):
+    // куски, сжатые независимо (например, в разных потоках), можно склеивать,
+    // последний кусок сжимается с final = true
+    void compress(const unsigned char* data, size_t size, bool final, std::vector<unsigned char>& out);
+
+    uint32_t adler32(uint32_t adler, const unsigned char* data, size_t size);
+    // Adler-32 склейки A + B по контрольным суммам кусков и длине B
+    uint32_t adler32_combine(uint32_t adler1, uint32_t adler2, size_t size2);
+
+    uint32_t crc32(uint32_t crc, const unsigned char* data, size_t size);
+}
+
+#endif
@@ -0,0 +1,251 @@
+﻿#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include "Arena.h"
+#include "Framebuffer.h"
+
+#if defined(_M_X64) || defined(_M_AMD64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define FB_USE_SSE 1
+#endif
+
+Matrix viewport(int x, int y, int w, int h) {
+    Matrix m = Matrix::identity();
+    m[0][0] = w / 2.f;
+    m[1][1] = h / 2.f;
+    m[2][2] = 1.f;
+    m[0][3] = x + w / 2.f;
+    m[1][3] = y + h / 2.f;
+    return m;
+}
+
+namespace fbpool {
+    // Не держим в пуле больше этого объема свободной памяти
+    const size_t MAX_POOLED_BYTES = 256u << 20;
+
+    static std::mutex pool_mutex;
+    static std::multimap<size_t, void*> free_blocks;
+    static size_t pooled_bytes = 0;
+
+    static void* aligned_alloc_bytes(size_t bytes) {
+#ifdef _WIN32
+        return _aligned_malloc(bytes, ALIGNMENT);
+#else
+        void* ptr = NULL;
+        if (posix_memalign(&ptr, ALIGNMENT, bytes) != 0) return NULL;
+        return ptr;
+#endif
+    }
+
+    static void aligned_free_bytes(void* ptr) {
+#ifdef _WIN32
+        _aligned_free(ptr);
+#else
+        free(ptr);
+#endif
+    }
+
+    void* acquire(size_t bytes) {
+        // Округляем до ALIGNMENT, чтобы SIMD-циклы не требовали хвоста
+        bytes = (bytes + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+        {
+            std::lock_guard<std::mutex> lock(pool_mutex);
+            std::multimap<size_t, void*>::iterator it = free_blocks.find(bytes);
+            if (it != free_blocks.end()) {
+                void* ptr = it->second;
+                free_blocks.erase(it);
+                pooled_bytes -= bytes;
+                return ptr;
+            }
+        }
+        memstats::count_allocation();
+        void* ptr = aligned_alloc_bytes(bytes);
+        if (!ptr) throw std::bad_alloc();
+        return ptr;
+    }
+
+    void release(void* ptr, size_t bytes) {
+        if (!ptr) return;
+        bytes = (bytes + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        if (pooled_bytes + bytes > MAX_POOLED_BYTES) {
+            aligned_free_bytes(ptr);
+            return;
+        }
+        free_blocks.insert(std::make_pair(bytes, ptr));
+        pooled_bytes += bytes;
+    }
+
+    void trim() {
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        for (std::multimap<size_t, void*>::iterator it = free_blocks.begin(); it != free_blocks.end(); ++it) {
+            aligned_free_bytes(it->second);
+        }
+        free_blocks.clear();
+        pooled_bytes = 0;
+    }
+}
+
+void fill_floats(float* dst, size_t count, float value) {
+    size_t i = 0;
+#ifdef FB_USE_SSE
+    // Буферы из пула выровнены на 64 байта и дополнены до кратного размера
+    __m128 v = _mm_set1_ps(value);
+    for (; i + 16 <= count; i += 16) {
+        _mm_store_ps(dst + i, v);
+        _mm_store_ps(dst + i + 4, v);
+        _mm_store_ps(dst + i + 8, v);
+        _mm_store_ps(dst + i + 12, v);
+    }
+#endif
+    for (; i < count; i++) {
+        dst[i] = value;
+    }
+}
+
+Framebuffer::Framebuffer(int w, int h, TGAImage::Format format, DepthFormat depth)
+    : width(w), height(h), color_(w, h, format), depth_(NULL), depth_format_(depth),
+      depth_scale_(0.5f), depth_bias_(-1.f), hdr_(NULL), blend_(BLEND_REPLACE),
+      transparency_(NULL) {
+    allocate();
+    clear_depth();
+}
+
+Framebuffer::~Framebuffer() {
+    deallocate();
+}
+
+void Framebuffer::allocate() {
+    depth_ = fbpool::acquire(pixel_count() * depth_bytes_per_pixel());
+    for (std::map<std::string, Attachment>::iterator it = attachments_.begin(); it != attachments_.end(); ++it) {
+        it->second.data = static_cast<float*>(fbpool::acquire(plane_stride() * it->second.components * sizeof(float)));
+    }
+    hdr_ = attachment("hdr");
+    viewport_ = ::viewport(0, 0, width, height);
+    set_lattice(1, 0, 0, width, height);
+}
+
+void Framebuffer::set_lattice(int step, int x0, int y0, int frame_width, int frame_height) {
+    lattice_step_ = step;
+    lattice_x0_ = x0;
+    lattice_y0_ = y0;
+    frame_width_ = frame_width;
+    frame_height_ = frame_height;
+}
+
+void Framebuffer::deallocate() {
+    fbpool::release(depth_, pixel_count() * depth_bytes_per_pixel());
+    depth_ = NULL;
+    for (std::map<std::string, Attachment>::iterator it = attachments_.begin(); it != attachments_.end(); ++it) {
+        fbpool::release(it->second.data, plane_stride() * it->second.components * sizeof(float));
+        it->second.data = NULL;
+    }
+    hdr_ = NULL;
+}
+
+void Framebuffer::resize(int w, int h) {
+    if (w == width && h == height) return;
+    deallocate();
+    width = w;
+    height = h;
+    color_ = TGAImage(w, h, color_.get_bytespp());
+    allocate();
+    clear();
+}
+
+void Framebuffer::clear() {
+    clear_color();
+    clear_depth();
+    for (std::map<std::string, Attachment>::iterator it = attachments_.begin(); it != attachments_.end(); ++it) {
+        fill_floats(it->second.data, plane_stride() * it->second.components, 0.f);
+    }
+}
+
+void Framebuffer::clear_color() {
+    color_.clear();
+}
+
+void Framebuffer::clear_depth() {
+    switch (depth_format_) {
+    case DEPTH_FLOAT32:
+        fill_floats(static_cast<float*>(depth_), pixel_count(), -std::numeric_limits<float>::max());
+        break;
+    default:
+        // Для reversed-Z и целочисленных форматов "далеко" — это нулевые биты.
+        // Размер блока из пула кратен 64 байтам, так что заполняем его целиком
+        fill_floats(static_cast<float*>(depth_), (pixel_count() * depth_bytes_per_pixel() + 3) / 4, 0.f);
+        break;
+    }
+}
+
+size_t Framebuffer::depth_bytes_per_pixel() const {
+    switch (depth_format_) {
+    case DEPTH_UNORM24:
+        return 3;
+    case DEPTH_UNORM16:
+        return sizeof(unsigned short);
+    default:
+        return sizeof(float);
+    }
+}
+
+void Framebuffer::set_depth_format(DepthFormat format) {
+    if (format == depth_format_) return;
+    fbpool::release(depth_, pixel_count() * depth_bytes_per_pixel());
+    depth_format_ = format;
+    depth_ = fbpool::acquire(pixel_count() * depth_bytes_per_pixel());
+    clear_depth();
+}
+
+void Framebuffer::set_depth_range(float depth_min, float depth_max) {
+    depth_bias_ = depth_min;
+    depth_scale_ = depth_max > depth_min ? 1.f / (depth_max - depth_min) : 1.f;
+}
+
+float Framebuffer::depth_at(size_t idx) const {
+    switch (depth_format_) {
+    case DEPTH_UNORM24:
+        return DepthUnorm24Traits::decode(DepthUnorm24Traits::load(depth_, idx), depth_scale_, depth_bias_);
+    case DEPTH_UNORM16:
+        return DepthUnorm16Traits::decode(DepthUnorm16Traits::load(depth_, idx), depth_scale_, depth_bias_);
+    default:
+        return static_cast<const float*>(depth_)[idx];
+    }
+}
+
+float* Framebuffer::add_attachment(const std::string& name, int components) {
+    std::map<std::string, Attachment>::iterator it = attachments_.find(name);
+    if (it != attachments_.end()) {
+        if (it->second.components == components) return it->second.data;
+        remove_attachment(name);
+    }
+    Attachment a;
+    a.components = components;
+    a.data = static_cast<float*>(fbpool::acquire(plane_stride() * components * sizeof(float)));
+    fill_floats(a.data, plane_stride() * components, 0.f);
+    attachments_[name] = a;
+    return a.data;
+}
+
+float* Framebuffer::attachment(const std::string& name) {
+    std::map<std::string, Attachment>::iterator it = attachments_.find(name);
+    return it == attachments_.end() ? NULL : it->second.data;
+}
+
+void Framebuffer::remove_attachment(const std::string& name) {
+    std::map<std::string, Attachment>::iterator it = attachments_.find(name);
+    if (it == attachments_.end()) return;
+    fbpool::release(it->second.data, plane_stride() * it->second.components * sizeof(float));
+    if (it->second.data == hdr_) hdr_ = NULL;
+    attachments_.erase(it);
+}
+
+void Framebuffer::enable_hdr(bool enable) {
+    if (enable) {
+        hdr_ = add_attachment("hdr", 4);
+    }
+    else {
+        remove_attachment("hdr");
+    }
+}
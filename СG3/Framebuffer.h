@@ -0,0 +1,211 @@
+﻿#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+#include <map>
+#include <string>
+#include "geometry.h"
+#include "tgaimage.h"
+
+// Матрица перевода из NDC в экранные координаты
+Matrix viewport(int x, int y, int w, int h);
+
+// Пул выровненных блоков памяти: буферы кадра переиспользуются между кадрами
+// и между framebuffer'ами одинакового размера вместо new/delete на каждый кадр
+namespace fbpool {
+    const size_t ALIGNMENT = 64;
+
+    void* acquire(size_t bytes);
+    void release(void* ptr, size_t bytes);
+    void trim(); // освобождает все свободные блоки пула
+}
+
+// Быстрое заполнение выровненного массива float (SSE, если доступно)
+void fill_floats(float* dst, size_t count, float value);
+
+class TransparencyBuffer;
+
+// Формат z-буфера. Во всех форматах большее значение — ближе к камере
+enum DepthFormat {
+    DEPTH_FLOAT32,    // z/w как есть, очистка в -max
+    DEPTH_REVERSED_Z, // z/w из reversed-Z проекции (near = 1, бесконечность = 0), очистка в 0
+    DEPTH_UNORM24,    // [depth_min, depth_max] -> 24 бита, упакованы в 3 байта
+    DEPTH_UNORM16     // [depth_min, depth_max] -> 16 бит, вдвое меньше трафика
+};
+
+// Кодирование глубины для конкретного формата; растеризатор инстанцируется
+// по этим типам, так что сравнение не ветвится по формату на каждом пикселе.
+// load/store читают и пишут ячейку idx z-буфера в его формате хранения
+struct DepthFloatTraits {
+    typedef float type;
+    static type encode(float d, float, float) { return d; }
+    static float decode(type v, float, float) { return v; }
+    static type load(const void* buf, size_t idx) { return static_cast<const type*>(buf)[idx]; }
+    static void store(void* buf, size_t idx, type v) { static_cast<type*>(buf)[idx] = v; }
+};
+
+template <typename T, unsigned int MAX_VALUE>
+struct DepthUnormTraits {
+    typedef T type;
+    // scale и bias переводят глубину в [0, 1]: (d - bias) * scale.
+    // Код 0 занят очисткой, поэтому [0, 1] ложится на [1, MAX_VALUE]:
+    // иначе фрагмент ровно на границе depth_min не проходил бы тест zbuffer < z
+    static type encode(float d, float scale, float bias) {
+        float x = (d - bias) * scale;
+        x = x < 0.f ? 0.f : (x > 1.f ? 1.f : x);
+        return static_cast<type>(x * (MAX_VALUE - 1) + 0.5f) + 1;
+    }
+    static float decode(type v, float scale, float bias) {
+        return (v - 1.f) / (float)(MAX_VALUE - 1) / scale + bias;
+    }
+    static type load(const void* buf, size_t idx) { return static_cast<const type*>(buf)[idx]; }
+    static void store(void* buf, size_t idx, type v) { static_cast<type*>(buf)[idx] = v; }
+};
+
+// 24-битная глубина хранится в трех байтах (младший первым): на четверть
+// меньше памяти и трафика, чем в 32-битной ячейке
+struct DepthUnorm24Traits : public DepthUnormTraits<unsigned int, 0xFFFFFFu> {
+    static type load(const void* buf, size_t idx) {
+        const unsigned char* p = static_cast<const unsigned char*>(buf) + idx * 3;
+        return p[0] | (p[1] << 8) | (static_cast<type>(p[2]) << 16);
+    }
+    static void store(void* buf, size_t idx, type v) {
+        unsigned char* p = static_cast<unsigned char*>(buf) + idx * 3;
+        p[0] = static_cast<unsigned char>(v);
+        p[1] = static_cast<unsigned char>(v >> 8);
+        p[2] = static_cast<unsigned char>(v >> 16);
+    }
+};
+
+typedef DepthUnormTraits<unsigned short, 0xFFFFu> DepthUnorm16Traits;
+
+// Смешивание в линейном HDR-буфере
+enum BlendMode {
+    BLEND_REPLACE,
+    BLEND_ADD,  // накопление (например, проходы от нескольких источников света)
+    BLEND_OVER  // альфа-смешивание поверх уже записанного цвета
+};
+
+class Framebuffer {
+public:
+    Framebuffer(int w, int h, TGAImage::Format format = TGAImage::RGB, DepthFormat depth = DEPTH_FLOAT32);
+    ~Framebuffer();
+
+    // Меняет разрешение; буферы возвращаются в пул и берутся заново
+    void resize(int w, int h);
+
+    void clear();
+    void clear_color();
+    void clear_depth(); // в значение "бесконечно далеко" для текущего формата
+
+    // Смена формата z-буфера (содержимое очищается)
+    void set_depth_format(DepthFormat format);
+    DepthFormat depth_format() const { return depth_format_; }
+    // Диапазон глубины, который кодируют целочисленные форматы
+    void set_depth_range(float depth_min, float depth_max);
+    float depth_scale() const { return depth_scale_; }
+    float depth_bias() const { return depth_bias_; }
+    size_t depth_bytes_per_pixel() const;
+
+    // Дополнительные float-вложения (нормали, id и т.п.), components значений на пиксель.
+    // Хранятся по плоскостям (SoA): компонента c лежит по адресу data + c * plane_stride()
+    float* add_attachment(const std::string& name, int components);
+    float* attachment(const std::string& name);
+    void remove_attachment(const std::string& name);
+
+    int get_width() const { return width; }
+    int get_height() const { return height; }
+    size_t pixel_count() const { return (size_t)width * height; }
+    // Число float в одной плоскости вложения (кратно 16, чтобы плоскости были выровнены)
+    size_t plane_stride() const { return (pixel_count() + 15) & ~(size_t)15; }
+
+    // Линейный float-буфер цвета RGBA (плоскости R, G, B, A). Пока он включен,
+    // triangle() пишет в него вместо TGAImage, а в 8 бит кадр переводит resolve_hdr()
+    void enable_hdr(bool enable = true);
+    bool hdr_enabled() const { return hdr_ != NULL; }
+    float* hdr_plane(int channel) { return hdr_ + channel * plane_stride(); }
+
+    // Списки полупрозрачных фрагментов; NULL — вся геометрия непрозрачная
+    void set_transparency(TransparencyBuffer* t) { transparency_ = t; }
+    TransparencyBuffer* transparency() const { return transparency_; }
+
+    void set_blend_mode(BlendMode mode) { blend_ = mode; }
+    BlendMode blend_mode() const { return blend_; }
+
+    void blend_hdr(int idx, const Vec4f& c) {
+        size_t stride = plane_stride();
+        float* r = hdr_ + idx;
+        switch (blend_) {
+        case BLEND_REPLACE:
+            r[0] = c.x; r[stride] = c.y; r[2 * stride] = c.z; r[3 * stride] = c.w;
+            break;
+        case BLEND_ADD:
+            r[0] += c.x; r[stride] += c.y; r[2 * stride] += c.z; r[3 * stride] = std::max(r[3 * stride], c.w);
+            break;
+        case BLEND_OVER:
+            r[0] = c.x * c.w + r[0] * (1.f - c.w);
+            r[stride] = c.y * c.w + r[stride] * (1.f - c.w);
+            r[2 * stride] = c.z * c.w + r[2 * stride] * (1.f - c.w);
+            r[3 * stride] = c.w + r[3 * stride] * (1.f - c.w);
+            break;
+        }
+    }
+
+    TGAImage& color() { return color_; }
+    // Сырые данные z-буфера в формате depth_format()
+    void* depth_data() { return depth_; }
+    // z-буфер как float (только для DEPTH_FLOAT32 и DEPTH_REVERSED_Z, иначе NULL)
+    float* depth() {
+        return depth_format_ == DEPTH_FLOAT32 || depth_format_ == DEPTH_REVERSED_Z ? static_cast<float*>(depth_) : NULL;
+    }
+    // Раскодированная глубина пикселя для любого формата
+    float depth_at(size_t idx) const;
+    const Matrix& viewport() const { return viewport_; }
+    // Свой viewport; при смене размера сбрасывается
+    void set_viewport(const Matrix& m) { viewport_ = m; }
+
+    // Буфер как подрешетка кадра frame_width x frame_height: пиксель (i, j) буфера —
+    // пиксель (x0 + i * step, y0 + j * step) кадра. viewport() при этом — вьюпорт
+    // всего кадра, и растеризатор проверяет покрытие в тех же точках кадра, что
+    // и при полной отрисовке. step = 1 — обычный буфер; при смене размера сбрасывается
+    void set_lattice(int step, int x0, int y0, int frame_width, int frame_height);
+    int lattice_step() const { return lattice_step_; }
+    int lattice_x0() const { return lattice_x0_; }
+    int lattice_y0() const { return lattice_y0_; }
+    int frame_width() const { return frame_width_; }
+    int frame_height() const { return frame_height_; }
+
+private:
+    struct Attachment {
+        float* data;
+        int components;
+    };
+
+    int width;
+    int height;
+    TGAImage color_;
+    void* depth_;
+    DepthFormat depth_format_;
+    float depth_scale_;
+    float depth_bias_;
+    float* hdr_;
+    BlendMode blend_;
+    TransparencyBuffer* transparency_;
+    Matrix viewport_;
+    int lattice_step_;
+    int lattice_x0_;
+    int lattice_y0_;
+    int frame_width_;
+    int frame_height_;
+    std::map<std::string, Attachment> attachments_;
+
+    void allocate();
+    void deallocate();
+
+    Framebuffer(const Framebuffer&);
+    Framebuffer& operator=(const Framebuffer&);
+};
+
+#endif
@@ -0,0 +1,306 @@
+﻿#include <cstdlib>
+#include "geometry.h"
+#include "MicroBench.h"
+
+#if defined(_M_X64) || defined(_M_AMD64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define GEOMETRY_BENCH_USE_SSE 1
+#endif
+
+// Замеры примитивов geometry.h. Для каждой операции: текущая реализация,
+// тот же расчет через поля x/y/z/w (без проверяющего operator[]) и SSE-вариант.
+// Данные — массивы случайных значений, по которым итерации идут по кругу
+namespace {
+
+const size_t COUNT = 1024;
+const size_t MASK = COUNT - 1;
+
+float random_float() {
+    return rand() / float(RAND_MAX) * 2.f - 1.f;
+}
+
+struct Data {
+    Vec3f v3[COUNT];
+    Vec4f v4[COUNT];
+    Matrix m[16];
+
+    Data() {
+        srand(12345);
+        for (size_t i = 0; i < COUNT; i++) {
+            v3[i] = Vec3f(random_float(), random_float(), random_float());
+            v4[i] = Vec4f(random_float(), random_float(), random_float(), 1.f);
+        }
+        for (int k = 0; k < 16; k++) {
+            for (int i = 0; i < 4; i++) {
+                for (int j = 0; j < 4; j++) m[k][i][j] = random_float();
+            }
+        }
+    }
+};
+
+const Data& data() {
+    static Data d;
+    return d;
+}
+
+// --- Matrix * Vec4f ---
+
+void matrix_vec4(microbench::State& state) {
+    const Data& d = data();
+    const Matrix& m = d.m[0];
+    size_t i = 0;
+    while (state.keep_running()) {
+        Vec4f r = m * d.v4[i++ & MASK];
+        microbench::do_not_optimize(r);
+    }
+}
+MICROBENCH(matrix_vec4);
+
+void matrix_vec4_fields(microbench::State& state) {
+    const Data& d = data();
+    const Matrix& m = d.m[0];
+    const Vec4f& r0 = m.rows.x;
+    const Vec4f& r1 = m.rows.y;
+    const Vec4f& r2 = m.rows.z;
+    const Vec4f& r3 = m.rows.w;
+    size_t i = 0;
+    while (state.keep_running()) {
+        const Vec4f& v = d.v4[i++ & MASK];
+        Vec4f r(r0.x * v.x + r0.y * v.y + r0.z * v.z + r0.w * v.w,
+                r1.x * v.x + r1.y * v.y + r1.z * v.z + r1.w * v.w,
+                r2.x * v.x + r2.y * v.y + r2.z * v.z + r2.w * v.w,
+                r3.x * v.x + r3.y * v.y + r3.z * v.z + r3.w * v.w);
+        microbench::do_not_optimize(r);
+    }
+}
+MICROBENCH(matrix_vec4_fields);
+
+#ifdef GEOMETRY_BENCH_USE_SSE
+// Матрица по столбцам в регистрах: результат = сумма столбцов, умноженных на компоненты v
+void matrix_vec4_sse(microbench::State& state) {
+    const Data& d = data();
+    const Matrix& m = d.m[0];
+    __m128 c[4];
+    for (int j = 0; j < 4; j++) c[j] = _mm_setr_ps(m[0][j], m[1][j], m[2][j], m[3][j]);
+    size_t i = 0;
+    while (state.keep_running()) {
+        __m128 v = _mm_loadu_ps(&d.v4[i++ & MASK].x);
+        __m128 r = _mm_mul_ps(c[0], _mm_shuffle_ps(v, v, _MM_SHUFFLE(0, 0, 0, 0)));
+        r = _mm_add_ps(r, _mm_mul_ps(c[1], _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1))));
+        r = _mm_add_ps(r, _mm_mul_ps(c[2], _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 2, 2, 2))));
+        r = _mm_add_ps(r, _mm_mul_ps(c[3], _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3))));
+        microbench::do_not_optimize(r);
+    }
+}
+MICROBENCH(matrix_vec4_sse);
+#endif
+
+// --- Matrix * Matrix ---
+
+void matrix_matrix(microbench::State& state) {
+    const Data& d = data();
+    size_t i = 0;
+    while (state.keep_running()) {
+        Matrix r = d.m[i & 15] * d.m[(i + 1) & 15];
+        i++;
+        microbench::do_not_optimize(r);
+    }
+}
+MICROBENCH(matrix_matrix);
+
+#ifdef GEOMETRY_BENCH_USE_SSE
+void matrix_matrix_sse(microbench::State& state) {
+    const Data& d = data();
+    // Строки всех матриц заранее в регистровом формате
+    __m128 rows[16][4];
+    for (int k = 0; k < 16; k++) {
+        for (int r = 0; r < 4; r++) rows[k][r] = _mm_loadu_ps(&d.m[k][r].x);
+    }
+    size_t i = 0;
+    while (state.keep_running()) {
+        const __m128* a = rows[i & 15];
+        const __m128* b = rows[(i + 1) & 15];
+        i++;
+        __m128 out[4];
+        for (int r = 0; r < 4; r++) {
+            // Строка результата = сумма строк b, умноженных на элементы строки a
+            __m128 x = a[r];
+            __m128 s = _mm_mul_ps(_mm_shuffle_ps(x, x, _MM_SHUFFLE(0, 0, 0, 0)), b[0]);
+            s = _mm_add_ps(s, _mm_mul_ps(_mm_shuffle_ps(x, x, _MM_SHUFFLE(1, 1, 1, 1)), b[1]));
+            s = _mm_add_ps(s, _mm_mul_ps(_mm_shuffle_ps(x, x, _MM_SHUFFLE(2, 2, 2, 2)), b[2]));
+            s = _mm_add_ps(s, _mm_mul_ps(_mm_shuffle_ps(x, x, _MM_SHUFFLE(3, 3, 3, 3)), b[3]));
+            out[r] = s;
+        }
+        microbench::do_not_optimize(out);
+    }
+}
+MICROBENCH(matrix_matrix_sse);
+#endif
+
+// --- cross ---
+
+void cross_vec3(microbench::State& state) {
+    const Data& d = data();
+    size_t i = 0;
+    while (state.keep_running()) {
+        Vec3f r = cross(d.v3[i & MASK], d.v3[(i + 1) & MASK]);
+        i++;
+        microbench::do_not_optimize(r);
+    }
+}
+MICROBENCH(cross_vec3);
+
+#ifdef GEOMETRY_BENCH_USE_SSE
+// a.yzx * b.zxy - a.zxy * b.yzx, четвертая компонента не используется
+void cross_sse(microbench::State& state) {
+    const Data& d = data();
+    size_t i = 0;
+    while (state.keep_running()) {
+        __m128 a = _mm_loadu_ps(&d.v4[i & MASK].x);
+        __m128 b = _mm_loadu_ps(&d.v4[(i + 1) & MASK].x);
+        i++;
+        __m128 a_yzx = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+        __m128 b_yzx = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+        __m128 c = _mm_sub_ps(_mm_mul_ps(a, b_yzx), _mm_mul_ps(a_yzx, b));
+        __m128 r = _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1));
+        microbench::do_not_optimize(r);
+    }
+}
+MICROBENCH(cross_sse);
+#endif
+
+// --- normalize ---
+
+void normalize_vec3(microbench::State& state) {
+    const Data& d = data();
+    size_t i = 0;
+    while (state.keep_running()) {
+        Vec3f r = d.v3[i++ & MASK];
+        r.normalize();
+        microbench::do_not_optimize(r);
+    }
+}
+MICROBENCH(normalize_vec3);
+
+#ifdef GEOMETRY_BENCH_USE_SSE
+// Четыре вектора за раз в формате SoA, точный sqrt
+void normalize_sse_x4(microbench::State& state) {
+    const Data& d = data();
+    size_t i = 0;
+    while (state.keep_running()) {
+        const Vec3f* v = &d.v3[i & MASK & ~size_t(3)];
+        i += 4;
+        __m128 x = _mm_setr_ps(v[0].x, v[1].x, v[2].x, v[3].x);
+        __m128 y = _mm_setr_ps(v[0].y, v[1].y, v[2].y, v[3].y);
+        __m128 z = _mm_setr_ps(v[0].z, v[1].z, v[2].z, v[3].z);
+        __m128 len = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z)));
+        __m128 inv = _mm_div_ps(_mm_set1_ps(1.f), len);
+        __m128 r[3] = { _mm_mul_ps(x, inv), _mm_mul_ps(y, inv), _mm_mul_ps(z, inv) };
+        microbench::do_not_optimize(r);
+    }
+}
+MICROBENCH(normalize_sse_x4);
+#endif
+
+// --- embed ---
+
+void embed_vec4(microbench::State& state) {
+    const Data& d = data();
+    size_t i = 0;
+    while (state.keep_running()) {
+        Vec4f r = embed<4>(d.v3[i++ & MASK], 1.f);
+        microbench::do_not_optimize(r);
+    }
+}
+MICROBENCH(embed_vec4);
+
+void embed_vec4_fields(microbench::State& state) {
+    const Data& d = data();
+    size_t i = 0;
+    while (state.keep_running()) {
+        const Vec3f& v = d.v3[i++ & MASK];
+        Vec4f r(v.x, v.y, v.z, 1.f);
+        microbench::do_not_optimize(r);
+    }
+}
+MICROBENCH(embed_vec4_fields);
+
+// --- mat::col / mat::set_col ---
+
+void mat_col(microbench::State& state) {
+    const Data& d = data();
+    size_t i = 0;
+    while (state.keep_running()) {
+        Vec4f r = d.m[i & 15].col(i & 3);
+        i++;
+        microbench::do_not_optimize(r);
+    }
+}
+MICROBENCH(mat_col);
+
+void mat_set_col(microbench::State& state) {
+    const Data& d = data();
+    mat<4, 3, float> m;
+    size_t i = 0;
+    while (state.keep_running()) {
+        m.set_col(i % 3, d.v4[i & MASK]);
+        i++;
+        microbench::do_not_optimize(m);
+    }
+}
+MICROBENCH(mat_set_col);
+
+void mat_set_col_fields(microbench::State& state) {
+    const Data& d = data();
+    float m[4][3];
+    size_t i = 0;
+    while (state.keep_running()) {
+        const Vec4f& v = d.v4[i & MASK];
+        size_t c = i % 3;
+        m[0][c] = v.x;
+        m[1][c] = v.y;
+        m[2][c] = v.z;
+        m[3][c] = v.w;
+        i++;
+        microbench::do_not_optimize(m);
+    }
+}
+MICROBENCH(mat_set_col_fields);
+
+// --- operator[] с проверкой границ против прямого доступа к полям ---
+
+void index_operator_vec4(microbench::State& state) {
+    const Data& d = data();
+    size_t i = 0;
+    while (state.keep_running()) {
+        const Vec4f& v = d.v4[i++ & MASK];
+        float s = 0.f;
+        for (size_t k = 0; k < 4; k++) s += v[k];
+        microbench::do_not_optimize(s);
+    }
+}
+MICROBENCH(index_operator_vec4);
+
+void index_fields_vec4(microbench::State& state) {
+    const Data& d = data();
+    size_t i = 0;
+    while (state.keep_running()) {
+        const Vec4f& v = d.v4[i++ & MASK];
+        float s = v.x + v.y + v.z + v.w;
+        microbench::do_not_optimize(s);
+    }
+}
+MICROBENCH(index_fields_vec4);
+
+// Общий шаблон vec<DIM> хранит std::vector: цена копирования с выделением памяти
+void generic_vec_copy(microbench::State& state) {
+    vec<5, float> a;
+    for (size_t k = 0; k < 5; k++) a[k] = random_float();
+    while (state.keep_running()) {
+        vec<5, float> b = a;
+        microbench::do_not_optimize(b);
+    }
+}
+MICROBENCH(generic_vec_copy);
+
+}
@@ -0,0 +1,148 @@
+﻿#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <limits>
+#include <string>
+#include "Golden.h"
+#include "model.h"
+#include "Camera.h"
+#include "Framebuffer.h"
+#include "ImageDiff.h"
+#include "Meshlet.h"
+#include "Renderer.h"
+#include "ShaderFactory.h"
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+namespace {
+
+const char* const MODELS[] = { "obj/african_head.obj", "obj/peter_griffin.obj" };
+const char* const CAMERAS[] = { "ortho", "perspective" };
+const int SIZE = 256;
+
+// "obj/african_head.obj" -> "african_head"
+std::string base_name(const std::string& path) {
+    size_t slash = path.find_last_of("/\\");
+    std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+    size_t dot = name.find_last_of('.');
+    return dot == std::string::npos ? name : name.substr(0, dot);
+}
+
+void make_directory(const std::string& path) {
+#ifdef _WIN32
+    _mkdir(path.c_str());
+#else
+    mkdir(path.c_str(), 0755);
+#endif
+}
+
+bool file_exists(const std::string& path) {
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f) return false;
+    fclose(f);
+    return true;
+}
+
+// Сцена как в main: камера (1, 0, 1) -> 0, ортография с разрезом 0.15 или перспектива 60.
+// legacy — последовательный draw_model()/triangle(), как в CLI с --no-meshlets
+void render_case(Model& model, const MeshletMesh& meshlets, const char* shader_name, bool perspective,
+                 bool legacy, int threads, TGAImage& out) {
+    Framebuffer fb(SIZE, SIZE);
+    Camera camera(Vec3f(1, 0, 1), Vec3f(0, 0, 0), Vec3f(0, 1, 0));
+    RenderOptions render;
+    render.threads = threads;
+    render.clip_plane = 0.15f;
+    if (perspective) {
+        camera.set_perspective(60.f, 1.f, 0.1f, 10.f);
+        render.clip_plane = std::numeric_limits<float>::max();
+    }
+    IShader* shader = create_shader(shader_name, &model, camera, Vec3f(1, 1, 1).normalize());
+    if (legacy) draw_model(model, *shader, fb, render.clip_plane);
+    else draw_meshlets(meshlets, camera, *shader, fb, render);
+    delete shader;
+    fb.color().flip_vertically();
+    out = fb.color();
+}
+
+// Сравнение с эталоном; карта отличий строится только для непрошедшего случая
+bool check_case(const std::string& name, const std::string& label, TGAImage& actual, TGAImage& reference,
+                const GoldenOptions& options) {
+    ImageDiffResult diff;
+    if (!diff_images(actual, reference, diff)) {
+        std::cout << "FAIL " << label << ": size or format mismatch" << std::endl;
+        return false;
+    }
+    int max_error = 0;
+    for (int k = 0; k < 4; k++) max_error = std::max(max_error, diff.max_error[k]);
+    bool pass = max_error <= options.max_error && diff.psnr >= options.min_psnr;
+
+    std::cout << (pass ? "PASS " : "FAIL ") << label << ": max error " << max_error
+              << " (b " << diff.max_error[0] << ", g " << diff.max_error[1] << ", r " << diff.max_error[2]
+              << "), PSNR " << diff.psnr << " dB, " << diff.differing_pixels << " pixels differ" << std::endl;
+    if (!pass) {
+        TGAImage heatmap;
+        diff_images(actual, reference, diff, &heatmap);
+        actual.write_tga_file((options.dir + "/" + name + ".actual.tga").c_str());
+        heatmap.write_tga_file((options.dir + "/" + name + ".diff.tga").c_str());
+    }
+    return pass;
+}
+
+}
+
+int run_golden(const GoldenOptions& options) {
+    int failed = 0;
+    int total = 0;
+    if (options.update) {
+        make_directory(options.dir);
+    }
+    for (size_t m = 0; m < sizeof(MODELS) / sizeof(MODELS[0]); m++) {
+        Model model(MODELS[m]);
+        if (model.nfaces() == 0) {
+            std::cerr << "ERROR: Model not loaded: " << MODELS[m] << std::endl;
+            return 1;
+        }
+        MeshletMesh meshlets;
+        meshlets.build(model);
+
+        for (int s = 0; s < SHADER_COUNT; s++) {
+            for (int c = 0; c < 2; c++) {
+                std::string name = base_name(MODELS[m]) + "_" + SHADER_NAMES[s] + "_" + CAMERAS[c];
+                std::string reference_path = options.dir + "/" + name + ".tga";
+
+                TGAImage actual;
+                render_case(model, meshlets, SHADER_NAMES[s], c == 1, false, options.threads, actual);
+
+                if (options.update) {
+                    total++;
+                    if (!actual.write_tga_file(reference_path.c_str())) {
+                        failed++;
+                        continue;
+                    }
+                    std::cout << "UPDATED " << name << std::endl;
+                    continue;
+                }
+
+                // Оба пути отрисовки сверяются с одним эталоном
+                total += 2;
+                TGAImage reference;
+                if (!file_exists(reference_path) || !reference.read_tga_file(reference_path.c_str())) {
+                    std::cout << "FAIL " << name << ": no reference " << reference_path << std::endl;
+                    failed += 2;
+                    continue;
+                }
+                if (!check_case(name, name, actual, reference, options)) failed++;
+
+                TGAImage legacy;
+                render_case(model, meshlets, SHADER_NAMES[s], c == 1, true, options.threads, legacy);
+                if (!check_case(name + "_draw_model", name + " (draw_model)", legacy, reference, options)) failed++;
+            }
+        }
+    }
+    std::cout << (total - failed) << "/" << total << " golden images passed" << std::endl;
+    return failed;
+}
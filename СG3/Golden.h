@@ -0,0 +1,22 @@
+﻿#ifndef GOLDEN_H
+#define GOLDEN_H
+
+#include <string>
+
+struct GoldenOptions {
+    std::string dir;   // каталог эталонов
+    bool update;       // перезаписать эталоны текущим рендером
+    int threads;
+    int max_error;     // допустимая ошибка канала
+    double min_psnr;   // дБ
+
+    GoldenOptions() : dir("golden"), update(false), threads(0), max_error(4), min_psnr(45.0) {}
+};
+
+// Рендерит фиксированный набор (модель, шейдер, камера) через draw_meshlets() и
+// draw_model() и сравнивает оба кадра с эталонными TGA (в репозитории — каталог
+// golden/). Нет эталона — случай не пройден. При расхождении рядом с эталоном
+// пишутся <case>.actual.tga и <case>.diff.tga. Возвращает число непрошедших случаев
+int run_golden(const GoldenOptions& options);
+
+#endif
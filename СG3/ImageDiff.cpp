@@ -0,0 +1,105 @@
+﻿#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "ImageDiff.h"
+
+#if defined(_M_X64) || defined(_M_AMD64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define IMAGE_DIFF_USE_SSE 1
+#endif
+
+namespace {
+    // 48 байт — общее кратное 16 (ширина SSE) и размеров пикселя 1, 3 и 4:
+    // байт k блока всегда принадлежит каналу k % bpp
+    const size_t BLOCK = 48;
+
+    unsigned char abs_diff(unsigned char x, unsigned char y) {
+        return x > y ? x - y : y - x;
+    }
+
+    TGAColor heat_color(int error) {
+        float t = std::min(1.f, error / 64.f);
+        unsigned char r = static_cast<unsigned char>(255.f * std::min(1.f, t * 2.f));
+        unsigned char g = static_cast<unsigned char>(255.f * std::max(0.f, t * 2.f - 1.f));
+        unsigned char b = static_cast<unsigned char>(255.f * std::max(0.f, 1.f - t * 2.f));
+        return TGAColor(r, g, b, 255);
+    }
+}
+
+bool diff_images(TGAImage& a, TGAImage& b, ImageDiffResult& result, TGAImage* heatmap) {
+    const int bpp = a.get_bytespp();
+    if (a.get_width() != b.get_width() || a.get_height() != b.get_height() || bpp != b.get_bytespp()) {
+        return false;
+    }
+    const size_t npixels = (size_t)a.get_width() * a.get_height();
+    const size_t nbytes = npixels * bpp;
+    const unsigned char* pa = a.buffer();
+    const unsigned char* pb = b.buffer();
+
+    unsigned char block_max[BLOCK] = { 0 };
+    unsigned long long sq_sum = 0;
+    size_t i = 0;
+#ifdef IMAGE_DIFF_USE_SSE
+    {
+        __m128i vmax[3] = { _mm_setzero_si128(), _mm_setzero_si128(), _mm_setzero_si128() };
+        const __m128i zero = _mm_setzero_si128();
+        __m128i acc = _mm_setzero_si128(); // 4 x uint32 сумм квадратов
+        int pending = 0;
+        for (; i + BLOCK <= nbytes; i += BLOCK) {
+            for (int k = 0; k < 3; k++) {
+                __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pa + i + k * 16));
+                __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pb + i + k * 16));
+                __m128i d = _mm_or_si128(_mm_subs_epu8(x, y), _mm_subs_epu8(y, x));
+                vmax[k] = _mm_max_epu8(vmax[k], d);
+                __m128i lo = _mm_unpacklo_epi8(d, zero);
+                __m128i hi = _mm_unpackhi_epi8(d, zero);
+                acc = _mm_add_epi32(acc, _mm_add_epi32(_mm_madd_epi16(lo, lo), _mm_madd_epi16(hi, hi)));
+            }
+            // За блок в каждую ячейку acc приходит 12 квадратов <= 255^2: 4096 блоков помещаются в uint32
+            if (++pending == 4096) {
+                unsigned int lanes[4];
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), acc);
+                sq_sum += (unsigned long long)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+                acc = _mm_setzero_si128();
+                pending = 0;
+            }
+        }
+        unsigned int lanes[4];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), acc);
+        sq_sum += (unsigned long long)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+        for (int k = 0; k < 3; k++) {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(block_max + k * 16), vmax[k]);
+        }
+    }
+#endif
+    for (; i < nbytes; i++) {
+        unsigned char d = abs_diff(pa[i], pb[i]);
+        block_max[i % BLOCK] = std::max(block_max[i % BLOCK], d);
+        sq_sum += (unsigned long long)d * d;
+    }
+
+    for (int c = 0; c < 4; c++) result.max_error[c] = 0;
+    for (size_t k = 0; k < BLOCK; k++) {
+        int c = static_cast<int>(k % bpp);
+        result.max_error[c] = std::max(result.max_error[c], static_cast<int>(block_max[k]));
+    }
+    result.mse = nbytes > 0 ? double(sq_sum) / nbytes : 0.0;
+    result.psnr = result.mse > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / result.mse)
+                                   : std::numeric_limits<double>::infinity();
+
+    // Попиксельный проход нужен только для счетчика и карты отличий
+    result.differing_pixels = 0;
+    if (sq_sum == 0 && !heatmap) return true;
+    if (heatmap) *heatmap = TGAImage(a.get_width(), a.get_height(), TGAImage::RGB);
+    for (size_t p = 0; p < npixels; p++) {
+        int error = 0;
+        for (int c = 0; c < bpp; c++) {
+            error = std::max(error, static_cast<int>(abs_diff(pa[p * bpp + c], pb[p * bpp + c])));
+        }
+        if (error > 0) result.differing_pixels++;
+        if (heatmap && error > 0) {
+            heatmap->set(static_cast<int>(p % a.get_width()), static_cast<int>(p / a.get_width()), heat_color(error));
+        }
+    }
+    return true;
+}
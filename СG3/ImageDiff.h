@@ -0,0 +1,19 @@
+﻿#ifndef IMAGE_DIFF_H
+#define IMAGE_DIFF_H
+
+#include <cstddef>
+#include "tgaimage.h"
+
+struct ImageDiffResult {
+    int max_error[4];         // по каналам в порядке байт TGA (b, g, r, a)
+    double mse;               // по всем каналам
+    double psnr;              // дБ, для одинаковых изображений — бесконечность
+    size_t differing_pixels;
+};
+
+// Сравнение изображений одинакового размера и формата; false — размеры не совпадают.
+// heatmap (если не NULL) получает карту отличий: черный — совпадает, далее синий,
+// красный и желтый по мере роста максимальной ошибки пикселя
+bool diff_images(TGAImage& a, TGAImage& b, ImageDiffResult& result, TGAImage* heatmap = NULL);
+
+#endif
@@ -0,0 +1,311 @@
+﻿#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "ImageWriter.h"
+#include "Deflate.h"
+#include "Trace.h"
+
+namespace {
+    // Объем отфильтрованных строк в одной независимо сжимаемой полосе PNG
+    const size_t PNG_STRIP_BYTES = 256 * 1024;
+
+    // Вызывает fn(i) для i из [0, count), задания раздаются счетчиком
+    template <class F>
+    void parallel_for(int count, int threads, F fn) {
+        if (threads <= 0) {
+            threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+        }
+        threads = std::min(threads, count);
+        std::atomic<int> next(0);
+        auto worker = [&]() {
+            for (int i = next.fetch_add(1); i < count; i = next.fetch_add(1)) {
+                fn(i);
+            }
+        };
+        std::vector<std::thread> workers;
+        for (int t = 1; t < threads; t++) {
+            workers.push_back(std::thread(worker));
+        }
+        worker();
+        for (size_t t = 0; t < workers.size(); t++) {
+            workers[t].join();
+        }
+    }
+
+    void put_be32(std::vector<unsigned char>& out, uint32_t v) {
+        out.push_back(static_cast<unsigned char>(v >> 24));
+        out.push_back(static_cast<unsigned char>(v >> 16));
+        out.push_back(static_cast<unsigned char>(v >> 8));
+        out.push_back(static_cast<unsigned char>(v));
+    }
+
+    bool write_file(const char* path, const std::vector<unsigned char>& bytes) {
+        std::ofstream out(path, std::ios::binary);
+        if (!out.is_open()) {
+            std::cerr << "can't open file " << path << "\n";
+            return false;
+        }
+        out.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+        if (!out.good()) {
+            std::cerr << "can't write " << path << "\n";
+            return false;
+        }
+        return true;
+    }
+
+    // Строка кадра в порядке каналов RGB(A)
+    void load_row(TGAImage& image, int y, unsigned char* row) {
+        int width = image.get_width();
+        int bpp = image.get_bytespp();
+        const unsigned char* src = image.buffer() + static_cast<size_t>(y) * width * bpp;
+        if (bpp == 1) {
+            memcpy(row, src, width);
+            return;
+        }
+        for (int x = 0; x < width; x++, src += bpp, row += bpp) {
+            row[0] = src[2];
+            row[1] = src[1];
+            row[2] = src[0];
+            if (bpp == 4) row[3] = src[3];
+        }
+    }
+
+    // Без ветвлений, чтобы цикл фильтра векторизовался
+    inline unsigned char paeth(int a, int b, int c) {
+        int pa = std::abs(b - c);
+        int pb = std::abs(a - c);
+        int pc = std::abs(a + b - 2 * c);
+        int ab = pb < pa ? b : a;
+        int pab = pb < pa ? pb : pa;
+        return static_cast<unsigned char>(pc < pab ? c : ab);
+    }
+
+    // Сумма модулей байтов как знаковых — оценка сжимаемости строки
+    inline long filter_cost(const unsigned char* v, int n) {
+        long sum = 0;
+        for (int i = 0; i < n; i++) {
+            sum += v[i] < 128 ? v[i] : 256 - v[i];
+        }
+        return sum;
+    }
+
+    // Фильтрует строку всеми пятью фильтрами PNG и оставляет тот, у которого
+    // меньше сумма модулей байтов (эвристика из спецификации PNG).
+    // prev — предыдущая строка или нули для первой
+    void filter_row(const unsigned char* row, const unsigned char* prev, int stride, int bpp,
+                    unsigned char* candidate, unsigned char* out) {
+        out[0] = 0;
+        memcpy(out + 1, row, stride);
+        long best = filter_cost(row, stride);
+        for (int filter = 1; filter < 5; filter++) {
+            unsigned char* c = candidate;
+            switch (filter) {
+            case 1:
+                for (int i = 0; i < bpp; i++) c[i] = row[i];
+                for (int i = bpp; i < stride; i++) c[i] = static_cast<unsigned char>(row[i] - row[i - bpp]);
+                break;
+            case 2:
+                for (int i = 0; i < stride; i++) c[i] = static_cast<unsigned char>(row[i] - prev[i]);
+                break;
+            case 3:
+                for (int i = 0; i < bpp; i++) c[i] = static_cast<unsigned char>(row[i] - (prev[i] >> 1));
+                for (int i = bpp; i < stride; i++) c[i] = static_cast<unsigned char>(row[i] - ((row[i - bpp] + prev[i]) >> 1));
+                break;
+            case 4:
+                for (int i = 0; i < bpp; i++) c[i] = static_cast<unsigned char>(row[i] - prev[i]);
+                for (int i = bpp; i < stride; i++) c[i] = static_cast<unsigned char>(row[i] - paeth(row[i - bpp], prev[i], prev[i - bpp]));
+                break;
+            }
+            long cost = filter_cost(c, stride);
+            if (cost < best) {
+                best = cost;
+                out[0] = static_cast<unsigned char>(filter);
+                memcpy(out + 1, c, stride);
+            }
+        }
+    }
+
+    void append_chunk(std::vector<unsigned char>& out, const char* type, const unsigned char* data, size_t size) {
+        put_be32(out, static_cast<uint32_t>(size));
+        size_t start = out.size();
+        out.insert(out.end(), type, type + 4);
+        if (size > 0) out.insert(out.end(), data, data + size);
+        put_be32(out, deflate::crc32(0, &out[start], out.size() - start));
+    }
+}
+
+ImageFormat image_format(const std::string& path) {
+    size_t dot = path.find_last_of('.');
+    if (dot == std::string::npos) return IMAGE_TGA;
+    std::string ext = path.substr(dot + 1);
+    for (size_t i = 0; i < ext.size(); i++) {
+        ext[i] = static_cast<char>(tolower(static_cast<unsigned char>(ext[i])));
+    }
+    if (ext == "qoi") return IMAGE_QOI;
+    if (ext == "png") return IMAGE_PNG;
+    return IMAGE_TGA;
+}
+
+bool write_image(TGAImage& image, const char* path, int threads) {
+    switch (image_format(path)) {
+    case IMAGE_QOI: return write_qoi(image, path);
+    case IMAGE_PNG: return write_png(image, path, threads);
+    default: return image.write_tga_file(path);
+    }
+}
+
+bool write_qoi(TGAImage& image, const char* path) {
+    TRACE_SCOPE("write_qoi");
+    int width = image.get_width();
+    int height = image.get_height();
+    int bpp = image.get_bytespp();
+    int channels = bpp == 4 ? 4 : 3;
+    size_t npixels = static_cast<size_t>(width) * height;
+
+    std::vector<unsigned char> out;
+    out.reserve(14 + npixels * (channels + 1) / 2 + 8);
+    out.push_back('q');
+    out.push_back('o');
+    out.push_back('i');
+    out.push_back('f');
+    put_be32(out, width);
+    put_be32(out, height);
+    out.push_back(static_cast<unsigned char>(channels));
+    out.push_back(0); // sRGB
+
+    unsigned char index[64][4];
+    memset(index, 0, sizeof(index));
+    unsigned char prev[4] = {0, 0, 0, 255};
+    int run = 0;
+    const unsigned char* src = image.buffer();
+    for (size_t p = 0; p < npixels; p++, src += bpp) {
+        unsigned char px[4];
+        if (bpp == 1) {
+            px[0] = px[1] = px[2] = src[0];
+            px[3] = 255;
+        }
+        else {
+            px[0] = src[2];
+            px[1] = src[1];
+            px[2] = src[0];
+            px[3] = bpp == 4 ? src[3] : 255;
+        }
+
+        if (!memcmp(px, prev, 4)) {
+            run++;
+            if (run == 62 || p + 1 == npixels) {
+                out.push_back(static_cast<unsigned char>(0xC0 | (run - 1))); // QOI_OP_RUN
+                run = 0;
+            }
+            continue;
+        }
+        if (run > 0) {
+            out.push_back(static_cast<unsigned char>(0xC0 | (run - 1)));
+            run = 0;
+        }
+
+        int slot = (px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64;
+        if (!memcmp(index[slot], px, 4)) {
+            out.push_back(static_cast<unsigned char>(slot)); // QOI_OP_INDEX
+        }
+        else {
+            memcpy(index[slot], px, 4);
+            if (px[3] == prev[3]) {
+                int vr = static_cast<signed char>(px[0] - prev[0]);
+                int vg = static_cast<signed char>(px[1] - prev[1]);
+                int vb = static_cast<signed char>(px[2] - prev[2]);
+                int vg_r = vr - vg;
+                int vg_b = vb - vg;
+                if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2) {
+                    out.push_back(static_cast<unsigned char>(0x40 | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2))); // QOI_OP_DIFF
+                }
+                else if (vg_r > -9 && vg_r < 8 && vg > -33 && vg < 32 && vg_b > -9 && vg_b < 8) {
+                    out.push_back(static_cast<unsigned char>(0x80 | (vg + 32))); // QOI_OP_LUMA
+                    out.push_back(static_cast<unsigned char>((vg_r + 8) << 4 | (vg_b + 8)));
+                }
+                else {
+                    out.push_back(0xFE); // QOI_OP_RGB
+                    out.push_back(px[0]);
+                    out.push_back(px[1]);
+                    out.push_back(px[2]);
+                }
+            }
+            else {
+                out.push_back(0xFF); // QOI_OP_RGBA
+                out.insert(out.end(), px, px + 4);
+            }
+        }
+        memcpy(prev, px, 4);
+    }
+    static const unsigned char padding[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+    out.insert(out.end(), padding, padding + 8);
+    return write_file(path, out);
+}
+
+bool write_png(TGAImage& image, const char* path, int threads) {
+    TRACE_SCOPE("write_png");
+    int width = image.get_width();
+    int height = image.get_height();
+    int bpp = image.get_bytespp();
+    int stride = width * bpp;
+    size_t line = static_cast<size_t>(stride) + 1;
+
+    int rows_per_strip = static_cast<int>(std::max<size_t>(1, PNG_STRIP_BYTES / line));
+    int nstrips = std::max(1, (height + rows_per_strip - 1) / rows_per_strip);
+    std::vector<unsigned char> filtered(line * height);
+    std::vector<std::vector<unsigned char> > compressed(nstrips);
+    std::vector<uint32_t> adler(nstrips);
+
+    // Полоса фильтруется и сжимается целиком в одном потоке
+    parallel_for(nstrips, threads, [&](int s) {
+        TRACE_SCOPE("png strip");
+        int y0 = s * rows_per_strip;
+        int y1 = std::min(height, y0 + rows_per_strip);
+        std::vector<unsigned char> row(stride);
+        std::vector<unsigned char> prev(stride, 0);
+        std::vector<unsigned char> candidate(stride);
+        if (y0 > 0) load_row(image, y0 - 1, prev.data());
+        for (int y = y0; y < y1; y++) {
+            load_row(image, y, row.data());
+            filter_row(row.data(), prev.data(), stride, bpp, candidate.data(), &filtered[line * y]);
+            row.swap(prev);
+        }
+        const unsigned char* data = &filtered[line * y0];
+        size_t size = line * (y1 - y0);
+        deflate::compress(data, size, s + 1 == nstrips, compressed[s]);
+        adler[s] = deflate::adler32(1, data, size);
+    });
+
+    std::vector<unsigned char> idat;
+    idat.push_back(0x78); // zlib: deflate, окно 32 КБ
+    idat.push_back(0x01); // самый быстрый уровень, без словаря
+    uint32_t checksum = 1;
+    for (int s = 0; s < nstrips; s++) {
+        idat.insert(idat.end(), compressed[s].begin(), compressed[s].end());
+        int y0 = s * rows_per_strip;
+        int y1 = std::min(height, y0 + rows_per_strip);
+        checksum = deflate::adler32_combine(checksum, adler[s], line * (y1 - y0));
+    }
+    put_be32(idat, checksum);
+
+    std::vector<unsigned char> header;
+    put_be32(header, width);
+    put_be32(header, height);
+    header.push_back(8); // бит на канал
+    header.push_back(static_cast<unsigned char>(bpp == 1 ? 0 : (bpp == 4 ? 6 : 2)));
+    header.push_back(0);
+    header.push_back(0);
+    header.push_back(0);
+
+    static const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    std::vector<unsigned char> out(signature, signature + 8);
+    append_chunk(out, "IHDR", header.data(), header.size());
+    append_chunk(out, "IDAT", idat.data(), idat.size());
+    append_chunk(out, "IEND", NULL, 0);
+    return write_file(path, out);
+}
@@ -0,0 +1,29 @@
+﻿#ifndef IMAGE_WRITER_H
+#define IMAGE_WRITER_H
+
+#include <string>
+#include "tgaimage.h"
+
+enum ImageFormat {
+    IMAGE_TGA,
+    IMAGE_QOI,
+    IMAGE_PNG
+};
+
+// Формат по расширению файла (без учета регистра), неизвестное — TGA
+ImageFormat image_format(const std::string& path);
+
+// Пишет кадр в формате по расширению. Кадр хранится как в TGA:
+// BGR(A), первая строка верхняя (после flip_vertically)
+bool write_image(TGAImage& image, const char* path, int threads = 0);
+
+// QOI: кодер однопроходный, поток по определению последовательный.
+// Полутоновый кадр пишется как RGB
+bool write_qoi(TGAImage& image, const char* path);
+
+// PNG: фильтр каждой строки выбирается отдельно, кадр режется на полосы,
+// сжимаемые параллельно и склеиваемые в один поток zlib.
+// Разбиение не зависит от threads, поэтому файл одинаков при любом числе потоков
+bool write_png(TGAImage& image, const char* path, int threads = 0);
+
+#endif
@@ -5,8 +5,10 @@
 #include "tgaimage.h"
 #include "model.h"
 #include "ishader.h"
+#include "Arena.h"
+#include "Lights.h"
 
-struct ImprovedShader : public IShader {
+struct ImprovedShader : public IShader, public LightList {
     Model* model;
     Matrix ModelView;
     Matrix Projection;
@@ -38,15 +40,9 @@ struct ImprovedShader : public IShader {
         //      
         world_coords[nthvert] = model->vert(iface, nthvert);
 
-        //       
+        //      
         if (nthvert == 0) {
-            Vec3f v0 = world_coords[0];
-            Vec3f v1 = world_coords[1];
-            Vec3f v2 = world_coords[2];
-
-            Vec3f edge1 = v1 - v0;
-            Vec3f edge2 = v2 - v0;
-            face_normal = cross(edge1, edge2).normalize();
+            face_normal = model->face_normal(iface);
         }
 
         //   
@@ -55,7 +51,25 @@ struct ImprovedShader : public IShader {
         return gl_Vertex;
     }
 
-    virtual bool fragment(Vec3f bar, TGAColor& color) {
+    //  :  ;     load_varyings()
+    virtual int varying_size() const { return 3; }
+
+    virtual Vec4f vertex_varying(int iface, int nthvert, float* out) {
+        Vec3f world = model->vert(iface, nthvert);
+        out[0] = world.x;
+        out[1] = world.y;
+        out[2] = world.z;
+        return Projection * ModelView * embed<4>(world, 1.0f);
+    }
+
+    virtual void load_varyings(int iface, const float* const* varyings) {
+        face_normal = model->face_normal(iface);
+        for (int i = 0; i < 3; i++) {
+            world_coords[i] = Vec3f(varyings[i][0], varyings[i][1], varyings[i][2]);
+        }
+    }
+
+    virtual bool fragment_linear(Vec3f bar, Vec4f& color) {
         //   
         Vec3f n = face_normal;
 
@@ -80,16 +94,37 @@ struct ImprovedShader : public IShader {
 
         //   
         float intensity = ambient + diffuse + specular;
-        intensity = std::min(1.0f, intensity); //   
 
-        //    
-        int col = static_cast<int>(255 * intensity);
-        col = std::max(0, std::min(255, col));
-        color = TGAColor(col, col, col, 255);
+        //     (   )
+        color = Vec4f(intensity, intensity, intensity, 1.0f);
+
+        //     (    )
+        if (!lights_cam.empty()) {
+            Vec3f world_pos = world_coords[0] * bar.x + world_coords[1] * bar.y + world_coords[2] * bar.z;
+            Vec4f pos_camera = ModelView * embed<4>(world_pos, 1.0f);
+            Vec3f extra = shade_lights(gl_FragCoord, Vec3f(pos_camera.x, pos_camera.y, pos_camera.z), n_cam, view_dir,
+                                       diffuse_k, specular_k, shiny_k);
+            color = Vec4f(intensity + extra.x, intensity + extra.y, intensity + extra.z, 1.0f);
+        }
 
         return false;
     }
 
+    virtual IShader* clone() const {
+        return new ImprovedShader(*this);
+    }
+
+    virtual IShader* clone_in(FrameArena& arena) const {
+        return arena.create<ImprovedShader>(*this);
+    }
+
+    virtual bool fragment(Vec3f bar, TGAColor& color) {
+        Vec4f linear;
+        bool discard = fragment_linear(bar, linear);
+        color = quantize_color(linear);
+        return discard;
+    }
+
     //    
     void set_material(float amb, float diff, float spec, float shine) {
         ambient_k = amb;
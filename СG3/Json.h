@@ -0,0 +1,36 @@
+﻿#ifndef JSON_H
+#define JSON_H
+
+#include <cstdio>
+#include <string>
+
+// Строка для вставки в JSON между кавычками: экранирует кавычку, обратную косую
+// черту и управляющие символы. Пути Windows (obj\head.obj) иначе дают битый JSON.
+// Байты >= 0x80 остаются как есть: UTF-8 в JSON допустим без экранирования
+inline std::string json_escape(const std::string& s) {
+    std::string out;
+    out.reserve(s.size());
+    for (size_t i = 0; i < s.size(); i++) {
+        unsigned char c = static_cast<unsigned char>(s[i]);
+        switch (c) {
+        case '"':  out += "\\\""; break;
+        case '\\': out += "\\\\"; break;
+        case '\n': out += "\\n"; break;
+        case '\r': out += "\\r"; break;
+        case '\t': out += "\\t"; break;
+        case '\b': out += "\\b"; break;
+        case '\f': out += "\\f"; break;
+        default:
+            if (c < 0x20) {
+                char buf[8];
+                std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+                out += buf;
+            } else {
+                out += static_cast<char>(c);
+            }
+        }
+    }
+    return out;
+}
+
+#endif
@@ -0,0 +1,192 @@
+﻿#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "Arena.h"
+#include "Lights.h"
+
+static const float DEG_TO_RAD = 3.14159265f / 180.f;
+
+Light Light::directional(const Vec3f& dir, const Vec3f& color) {
+    Light l;
+    l.type = LIGHT_DIRECTIONAL;
+    l.direction = Vec3f(dir.x, dir.y, dir.z).normalize();
+    l.color = color;
+    l.range = std::numeric_limits<float>::max();
+    l.cos_inner = l.cos_outer = -1.f;
+    return l;
+}
+
+Light Light::point(const Vec3f& pos, const Vec3f& color, float range) {
+    Light l;
+    l.type = LIGHT_POINT;
+    l.position = pos;
+    l.direction = Vec3f(0, 0, -1);
+    l.color = color;
+    l.range = range;
+    l.cos_inner = l.cos_outer = -1.f;
+    return l;
+}
+
+Light Light::spot(const Vec3f& pos, const Vec3f& dir, const Vec3f& color, float range,
+                  float inner_deg, float outer_deg) {
+    Light l = point(pos, color, range);
+    l.type = LIGHT_SPOT;
+    l.direction = Vec3f(dir.x, dir.y, dir.z).normalize();
+    l.cos_inner = std::cos(inner_deg * DEG_TO_RAD);
+    l.cos_outer = std::cos(outer_deg * DEG_TO_RAD);
+    return l;
+}
+
+LightClusters::LightClusters(int tile_size, int depth_slices)
+    : tile_size_(tile_size), slices_(depth_slices), tiles_x_(0), tiles_y_(0),
+      depth_min_(0.f), depth_scale_(0.f) {
+}
+
+void LightClusters::build(const std::vector<Light>& lights, const Matrix& transform,
+                          int width, int height, float depth_min, float depth_max, FrameArena* arena) {
+    tiles_x_ = (width + tile_size_ - 1) / tile_size_;
+    tiles_y_ = (height + tile_size_ - 1) / tile_size_;
+    depth_min_ = depth_min;
+    depth_scale_ = depth_max > depth_min ? slices_ / (depth_max - depth_min) : 0.f;
+
+    int nclusters = tiles_x_ * tiles_y_ * slices_;
+    counts_.assign(nclusters, 0);
+    offsets_.assign(nclusters, 0);
+    indices_.clear();
+
+    // Экранные границы сферы влияния каждого источника: проецируем углы
+    // описанного куба, это консервативно и для перспективной проекции
+    struct Bounds { int x0, y0, s0, x1, y1, s1; };
+    ScratchArray<Bounds> bounds(arena, lights.size());
+    ScratchArray<int> culled(arena, lights.size());
+    size_t nbounds = 0;
+    for (size_t i = 0; i < lights.size(); i++) {
+        const Light& l = lights[i];
+        if (l.type == LIGHT_DIRECTIONAL) continue;
+
+        float xmin = std::numeric_limits<float>::max(), ymin = xmin, zmin = xmin;
+        float xmax = -xmin, ymax = -xmin, zmax = -xmin;
+        bool behind = false;
+        for (int c = 0; c < 8; c++) {
+            Vec4f corner(l.position.x + (c & 1 ? l.range : -l.range),
+                         l.position.y + (c & 2 ? l.range : -l.range),
+                         l.position.z + (c & 4 ? l.range : -l.range), 1.f);
+            Vec4f p = transform * corner;
+            if (p.w <= 1e-6f) {
+                behind = true;
+                break;
+            }
+            xmin = std::min(xmin, p.x / p.w); xmax = std::max(xmax, p.x / p.w);
+            ymin = std::min(ymin, p.y / p.w); ymax = std::max(ymax, p.y / p.w);
+            zmin = std::min(zmin, p.z / p.w); zmax = std::max(zmax, p.z / p.w);
+        }
+
+        Bounds b;
+        if (behind) {
+            // Источник пересекает плоскость камеры: покрываем весь экран
+            b.x0 = 0; b.y0 = 0; b.s0 = 0;
+            b.x1 = tiles_x_ - 1; b.y1 = tiles_y_ - 1; b.s1 = slices_ - 1;
+        }
+        else {
+            if (xmax < 0 || ymax < 0 || xmin >= width || ymin >= height) continue;
+            b.x0 = std::max(0, static_cast<int>(xmin) / tile_size_);
+            b.y0 = std::max(0, static_cast<int>(ymin) / tile_size_);
+            b.x1 = std::min(tiles_x_ - 1, static_cast<int>(xmax) / tile_size_);
+            b.y1 = std::min(tiles_y_ - 1, static_cast<int>(ymax) / tile_size_);
+            b.s0 = slice_of(zmin);
+            b.s1 = slice_of(zmax);
+        }
+        bounds[nbounds] = b;
+        culled[nbounds] = static_cast<int>(i);
+        nbounds++;
+    }
+
+    // Два прохода: подсчет, затем заполнение плотного массива индексов
+    for (size_t k = 0; k < nbounds; k++) {
+        const Bounds& b = bounds[k];
+        for (int s = b.s0; s <= b.s1; s++)
+            for (int ty = b.y0; ty <= b.y1; ty++)
+                for (int tx = b.x0; tx <= b.x1; tx++)
+                    counts_[cluster_index(tx, ty, s)]++;
+    }
+    int total = 0;
+    for (int c = 0; c < nclusters; c++) {
+        offsets_[c] = total;
+        total += counts_[c];
+    }
+    indices_.resize(total);
+    ScratchArray<int> fill(arena, nclusters);
+    std::copy(offsets_.begin(), offsets_.end(), fill.data());
+    for (size_t k = 0; k < nbounds; k++) {
+        const Bounds& b = bounds[k];
+        for (int s = b.s0; s <= b.s1; s++)
+            for (int ty = b.y0; ty <= b.y1; ty++)
+                for (int tx = b.x0; tx <= b.x1; tx++)
+                    indices_[fill[cluster_index(tx, ty, s)]++] = culled[k];
+    }
+}
+
+void LightList::prepare_lights(const Matrix& ModelView) {
+    lights_cam.resize(lights.size());
+    directional.clear();
+    local.clear();
+    for (size_t i = 0; i < lights.size(); i++) {
+        Light l = lights[i];
+        Vec4f p = ModelView * embed<4>(l.position, 1.0f);
+        Vec4f d = ModelView * embed<4>(l.direction, 0.0f);
+        l.position = Vec3f(p.x, p.y, p.z);
+        l.direction = Vec3f(d.x, d.y, d.z).normalize();
+        lights_cam[i] = l;
+        if (l.type == LIGHT_DIRECTIONAL) directional.push_back(static_cast<int>(i));
+        else local.push_back(static_cast<int>(i));
+    }
+}
+
+float light_attenuation(const Light& l, const Vec3f& pos, Vec3f& to_light) {
+    if (l.type == LIGHT_DIRECTIONAL) {
+        to_light = l.direction * -1.f;
+        return 1.f;
+    }
+    to_light = l.position - pos;
+    float dist2 = to_light * to_light;
+    float r2 = l.range * l.range;
+    if (dist2 >= r2) return 0.f;
+    to_light = to_light / std::sqrt(dist2);
+    // Плавное затухание до нуля на границе range (совпадает с границами кластеров)
+    float f = dist2 / r2;
+    float window = 1.f - f * f;
+    float attenuation = window * window / (1.f + dist2);
+    if (l.type == LIGHT_SPOT) {
+        float cd = -(to_light * l.direction);
+        if (cd <= l.cos_outer) return 0.f;
+        float t = std::min(1.f, (cd - l.cos_outer) / std::max(1e-4f, l.cos_inner - l.cos_outer));
+        attenuation *= t * t;
+    }
+    return attenuation;
+}
+
+static Vec3f shade_one(const Light& l, const Vec3f& pos, const Vec3f& n, const Vec3f& view_dir,
+                       float diffuse_k, float specular_k, float shininess) {
+    Vec3f to_light;
+    float attenuation = light_attenuation(l, pos, to_light);
+    if (attenuation <= 0.f) return Vec3f(0, 0, 0);
+    float ndotl = n * to_light;
+    if (ndotl <= 0.f) return Vec3f(0, 0, 0);
+    Vec3f h = (to_light + view_dir).normalize();
+    float spec = specular_k * std::pow(std::max(0.f, n * h), shininess);
+    return l.color * ((diffuse_k * ndotl + spec) * attenuation);
+}
+
+Vec3f LightList::shade_lights(const Vec3f& frag_coord, const Vec3f& pos, const Vec3f& n, const Vec3f& view_dir,
+                              float diffuse_k, float specular_k, float shininess) const {
+    Vec3f sum(0, 0, 0);
+    for (size_t i = 0; i < directional.size(); i++) {
+        sum = sum + shade_one(lights_cam[directional[i]], pos, n, view_dir, diffuse_k, specular_k, shininess);
+    }
+    int count = 0;
+    const int* ids = local_lights(frag_coord, count);
+    for (int i = 0; i < count; i++) {
+        sum = sum + shade_one(lights_cam[ids[i]], pos, n, view_dir, diffuse_k, specular_k, shininess);
+    }
+    return sum;
+}
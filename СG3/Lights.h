@@ -0,0 +1,113 @@
+﻿#ifndef LIGHTS_H
+#define LIGHTS_H
+
+#include <vector>
+#include "geometry.h"
+
+class FrameArena;
+
+enum LightType {
+    LIGHT_DIRECTIONAL,
+    LIGHT_POINT,
+    LIGHT_SPOT
+};
+
+struct Light {
+    LightType type;
+    Vec3f position;   // мировые координаты (point, spot)
+    Vec3f direction;  // куда светит источник (directional, spot)
+    Vec3f color;      // линейный цвет, уже умноженный на интенсивность
+    float range;      // радиус влияния, за ним вклад равен нулю
+    float cos_inner;  // косинусы углов конуса (spot)
+    float cos_outer;
+
+    static Light directional(const Vec3f& dir, const Vec3f& color);
+    static Light point(const Vec3f& pos, const Vec3f& color, float range);
+    static Light spot(const Vec3f& pos, const Vec3f& dir, const Vec3f& color, float range,
+                      float inner_deg, float outer_deg);
+};
+
+// Ослабление источника в точке pos и единичное направление на него (to_light).
+// Ноль — точка вне радиуса или конуса
+float light_attenuation(const Light& l, const Vec3f& pos, Vec3f& to_light);
+
+// Разбиение экрана на тайлы × срезы глубины с заранее посчитанными списками
+// источников, попадающих в каждый кластер. Строится один раз на кадр
+class LightClusters {
+public:
+    LightClusters(int tile_size = 32, int depth_slices = 16);
+
+    // transform — полная матрица мир -> экран (Viewport * Projection * ModelView),
+    // [depth_min, depth_max] — диапазон глубины сцены, который делится на срезы.
+    // arena — память для рабочих массивов построения (NULL — куча)
+    void build(const std::vector<Light>& lights, const Matrix& transform,
+               int width, int height, float depth_min, float depth_max, FrameArena* arena = NULL);
+
+    // Источники кластера, в котором лежит фрагмент (x, y в пикселях)
+    const int* lights_at(int x, int y, float depth, int& count) const {
+        int cluster = cluster_index(x / tile_size_, y / tile_size_, slice_of(depth));
+        count = counts_[cluster];
+        return indices_.empty() ? 0 : &indices_[offsets_[cluster]];
+    }
+
+    int tiles_x() const { return tiles_x_; }
+    int tiles_y() const { return tiles_y_; }
+    int slices() const { return slices_; }
+    size_t total_assignments() const { return indices_.size(); }
+
+private:
+    int tile_size_;
+    int slices_;
+    int tiles_x_;
+    int tiles_y_;
+    float depth_min_;
+    float depth_scale_;
+    std::vector<int> offsets_;
+    std::vector<int> counts_;
+    std::vector<int> indices_;
+
+    int cluster_index(int tx, int ty, int slice) const {
+        return (slice * tiles_y_ + ty) * tiles_x_ + tx;
+    }
+
+    int slice_of(float depth) const {
+        int s = static_cast<int>((depth - depth_min_) * depth_scale_);
+        return s < 0 ? 0 : (s >= slices_ ? slices_ - 1 : s);
+    }
+};
+
+// Список источников на шейдере. Направленные источники действуют везде,
+// точечные и прожекторы выбираются через кластеры по координатам фрагмента
+struct LightList {
+    std::vector<Light> lights;
+    const LightClusters* clusters;
+
+    // Источники в пространстве камеры, пересчитываются в prepare_lights()
+    std::vector<Light> lights_cam;
+    std::vector<int> directional;
+    std::vector<int> local; // точечные и прожекторы, если кластеры не заданы
+
+    LightList() : clusters(0) {}
+
+    void add_light(const Light& light) { lights.push_back(light); }
+    void clear_lights() { lights.clear(); lights_cam.clear(); directional.clear(); local.clear(); }
+
+    // Переводит источники в пространство камеры один раз на кадр
+    void prepare_lights(const Matrix& ModelView);
+
+    // Индексы локальных источников (в lights_cam), влияющих на фрагмент
+    const int* local_lights(const Vec3f& frag_coord, int& count) const {
+        if (clusters) {
+            return clusters->lights_at(static_cast<int>(frag_coord.x), static_cast<int>(frag_coord.y),
+                                       frag_coord.z, count);
+        }
+        count = static_cast<int>(local.size());
+        return local.empty() ? 0 : &local[0];
+    }
+
+    // Суммарный диффузный и бликовый вклад источников в точке pos (пространство камеры)
+    Vec3f shade_lights(const Vec3f& frag_coord, const Vec3f& pos, const Vec3f& n, const Vec3f& view_dir,
+                       float diffuse_k, float specular_k, float shininess) const;
+};
+
+#endif
@@ -0,0 +1,412 @@
+﻿#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <queue>
+#include "Lod.h"
+#include "Trace.h"
+
+namespace {
+
+// Симметричная матрица 4x4 квадрики: xx xy xz xw yy yz yw zz zw ww,
+// weight — сумма весов плоскостей
+struct Quadric {
+    double a[10];
+    double weight;
+
+    Quadric() : weight(0.0) {
+        std::fill(a, a + 10, 0.0);
+    }
+
+    // Квадрат расстояния до плоскости n * p + d = 0 с весом w
+    static Quadric plane(const Vec3f& n, float d, double w) {
+        Quadric q;
+        double v[4] = { n.x, n.y, n.z, d };
+        int k = 0;
+        for (int i = 0; i < 4; i++) {
+            for (int j = i; j < 4; j++) {
+                q.a[k++] = w * v[i] * v[j];
+            }
+        }
+        q.weight = w;
+        return q;
+    }
+
+    Quadric& operator+=(const Quadric& other) {
+        for (int i = 0; i < 10; i++) a[i] += other.a[i];
+        weight += other.weight;
+        return *this;
+    }
+
+    double error(const Vec3f& p) const {
+        double x = p.x, y = p.y, z = p.z;
+        return a[0] * x * x + 2 * a[1] * x * y + 2 * a[2] * x * z + 2 * a[3] * x
+             + a[4] * y * y + 2 * a[5] * y * z + 2 * a[6] * y
+             + a[7] * z * z + 2 * a[8] * z
+             + a[9];
+    }
+
+    // Среднеквадратичное расстояние до плоскостей (в квадрате)
+    double mean_error(const Vec3f& p) const {
+        return weight > 0.0 ? std::max(0.0, error(p)) / weight : 0.0;
+    }
+};
+
+// Вес плоскостей, удерживающих границы и швы на месте
+const double SEAM_WEIGHT = 10.0;
+
+struct Collapse {
+    double cost;
+    int from;
+    int to;
+    unsigned from_stamp;
+    unsigned to_stamp;
+
+    bool operator>(const Collapse& other) const { return cost > other.cost; }
+};
+
+class Simplifier {
+public:
+    explicit Simplifier(Model& model)
+        : positions(model.nverts()), vfaces(model.nverts()), quadrics(model.nverts()),
+          stamps(model.nverts(), 0), removed(model.nverts(), 0), live_faces(0), max_cost(0.0) {
+        for (int i = 0; i < model.nverts(); i++) {
+            positions[i] = model.vert(i);
+        }
+        for (int f = 0; f < model.nfaces(); f++) {
+            std::vector<int> face = model.face(f);
+            if (face.size() < 3) continue;
+            for (int k = 0; k < 3; k++) {
+                tri.push_back(face[k]);
+                tuv.push_back(model.uv_index(f, k));
+                tnorm.push_back(model.normal_index(f, k));
+            }
+            vfaces[face[0]].push_back(live_faces);
+            vfaces[face[1]].push_back(live_faces);
+            vfaces[face[2]].push_back(live_faces);
+            alive.push_back(1);
+            live_faces++;
+        }
+        init_quadrics();
+        for (int v = 0; v < static_cast<int>(positions.size()); v++) {
+            push_edges(v);
+        }
+    }
+
+    int faces() const { return live_faces; }
+    float error() const { return static_cast<float>(std::sqrt(max_cost)); }
+
+    // Схлопывает ребра, пока граней больше target; false — больше нечего схлопнуть
+    bool reduce(int target) {
+        while (live_faces > target) {
+            if (heap.empty()) return false;
+            Collapse c = heap.top();
+            heap.pop();
+            if (removed[c.from] || removed[c.to]) continue;
+            if (stamps[c.from] != c.from_stamp || stamps[c.to] != c.to_stamp) continue;
+            if (!collapse(c.from, c.to)) continue;
+            max_cost = std::max(max_cost, c.cost);
+        }
+        return true;
+    }
+
+    Model* snapshot(Model& base) const {
+        std::vector<std::vector<int> > faces, faces_uv, faces_norms;
+        for (size_t f = 0; f < alive.size(); f++) {
+            if (!alive[f]) continue;
+            faces.push_back(std::vector<int>(&tri[f * 3], &tri[f * 3] + 3));
+            faces_uv.push_back(std::vector<int>(&tuv[f * 3], &tuv[f * 3] + 3));
+            faces_norms.push_back(std::vector<int>(&tnorm[f * 3], &tnorm[f * 3] + 3));
+        }
+        return new Model(base, faces, faces_uv, faces_norms);
+    }
+
+private:
+    std::vector<Vec3f> positions;
+    std::vector<int> tri;   // по 3 вершины на грань
+    std::vector<int> tuv;   // индексы uv углов
+    std::vector<int> tnorm; // индексы нормалей углов
+    std::vector<char> alive;
+    std::vector<std::vector<int> > vfaces; // грани вершины (включая удаленные)
+    std::vector<Quadric> quadrics;
+    std::vector<unsigned> stamps;          // меняется при каждом изменении квадрики вершины
+    std::vector<char> removed;
+    std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse> > heap;
+    int live_faces;
+    double max_cost;
+
+    int corner(int f, int v) const {
+        for (int k = 0; k < 3; k++) {
+            if (tri[f * 3 + k] == v) return f * 3 + k;
+        }
+        return -1;
+    }
+
+    bool same_wedge(int c0, int c1) const {
+        return tuv[c0] == tuv[c1] && tnorm[c0] == tnorm[c1];
+    }
+
+    Vec3f face_normal(int f, int replace = -1, const Vec3f& pos = Vec3f()) const {
+        Vec3f p[3];
+        for (int k = 0; k < 3; k++) {
+            int v = tri[f * 3 + k];
+            p[k] = v == replace ? pos : positions[v];
+        }
+        return cross(p[1] - p[0], p[2] - p[0]);
+    }
+
+    void live_faces_of(int v, std::vector<int>& out) const {
+        out.clear();
+        for (size_t i = 0; i < vfaces[v].size(); i++) {
+            if (alive[vfaces[v][i]]) out.push_back(vfaces[v][i]);
+        }
+    }
+
+    void neighbors(int v, std::vector<int>& out) const {
+        out.clear();
+        for (size_t i = 0; i < vfaces[v].size(); i++) {
+            int f = vfaces[v][i];
+            if (!alive[f]) continue;
+            for (int k = 0; k < 3; k++) {
+                int n = tri[f * 3 + k];
+                if (n != v && std::find(out.begin(), out.end(), n) == out.end()) out.push_back(n);
+            }
+        }
+    }
+
+    void init_quadrics() {
+        std::vector<std::vector<std::pair<int, int> > > edges(positions.size());
+        for (size_t f = 0; f < alive.size(); f++) {
+            Vec3f n = face_normal(static_cast<int>(f));
+            if (n.norm() <= 0.f) continue;
+            n.normalize();
+            const Vec3f& p = positions[tri[f * 3]];
+            Quadric q = Quadric::plane(n, -(n * p), 1.0);
+            for (int k = 0; k < 3; k++) {
+                quadrics[tri[f * 3 + k]] += q;
+            }
+        }
+        // Ребра по меньшей вершине: (большая вершина, грань). Ребро с одной гранью — граница,
+        // с двумя гранями и разными атрибутами на концах — шов
+        for (size_t f = 0; f < alive.size(); f++) {
+            for (int k = 0; k < 3; k++) {
+                int a = tri[f * 3 + k];
+                int b = tri[f * 3 + (k + 1) % 3];
+                int lo = std::min(a, b), hi = std::max(a, b);
+                edges[lo].push_back(std::make_pair(hi, static_cast<int>(f)));
+            }
+        }
+        for (int lo = 0; lo < static_cast<int>(edges.size()); lo++) {
+            std::vector<std::pair<int, int> >& list = edges[lo];
+            std::sort(list.begin(), list.end());
+            for (size_t i = 0; i < list.size();) {
+                size_t j = i;
+                while (j < list.size() && list[j].first == list[i].first) j++;
+                int hi = list[i].first;
+                bool seam = j - i != 2;
+                for (size_t k = i + 1; k < j && !seam; k++) {
+                    int f0 = list[i].second, f1 = list[k].second;
+                    seam = !same_wedge(corner(f0, lo), corner(f1, lo)) ||
+                           !same_wedge(corner(f0, hi), corner(f1, hi));
+                }
+                if (seam) {
+                    // Плоскость через ребро, перпендикулярная грани: держит границу/шов
+                    for (size_t k = i; k < j; k++) {
+                        Vec3f n = face_normal(list[k].second);
+                        Vec3f e = positions[hi] - positions[lo];
+                        if (n.norm() <= 0.f || e.norm() <= 0.f) continue;
+                        Vec3f side = cross(e, n).normalize();
+                        Quadric q = Quadric::plane(side, -(side * positions[lo]), SEAM_WEIGHT);
+                        quadrics[lo] += q;
+                        quadrics[hi] += q;
+                    }
+                }
+                i = j;
+            }
+        }
+    }
+
+    void push(int from, int to) {
+        Quadric q = quadrics[from];
+        q += quadrics[to];
+        Collapse c;
+        c.cost = q.mean_error(positions[to]);
+        c.from = from;
+        c.to = to;
+        c.from_stamp = stamps[from];
+        c.to_stamp = stamps[to];
+        heap.push(c);
+    }
+
+    void push_edges(int v) {
+        std::vector<int> ns;
+        neighbors(v, ns);
+        for (size_t i = 0; i < ns.size(); i++) {
+            push(v, ns[i]);
+            push(ns[i], v);
+        }
+    }
+
+    bool collapse(int a, int b) {
+        std::vector<int> faces_a, shared, na, nb;
+        live_faces_of(a, faces_a);
+        for (size_t i = 0; i < faces_a.size(); i++) {
+            if (corner(faces_a[i], b) >= 0) shared.push_back(faces_a[i]);
+        }
+        if (shared.empty()) return false;
+
+        // Каждому набору атрибутов a нужен парный набор b на общей грани,
+        // иначе схлопывание разорвет или сдвинет шов
+        std::vector<std::pair<int, int> > wedge_map; // угол a -> угол b
+        for (size_t i = 0; i < shared.size(); i++) {
+            int ca = corner(shared[i], a);
+            int cb = corner(shared[i], b);
+            for (size_t k = 0; k < wedge_map.size(); k++) {
+                if (same_wedge(wedge_map[k].first, ca) && !same_wedge(wedge_map[k].second, cb)) return false;
+            }
+            wedge_map.push_back(std::make_pair(ca, cb));
+        }
+
+        // Условие связности: общие соседи a и b — только вершины общих граней
+        neighbors(a, na);
+        neighbors(b, nb);
+        size_t common = 0;
+        for (size_t i = 0; i < na.size(); i++) {
+            if (std::find(nb.begin(), nb.end(), na[i]) != nb.end()) common++;
+        }
+        if (common != shared.size()) return false;
+
+        // Граничная вершина может двигаться только вдоль границы
+        if (shared.size() != 2) {
+            if (shared.size() != 1) return false;
+        }
+        else {
+            for (size_t i = 0; i < na.size(); i++) {
+                int count = 0;
+                for (size_t k = 0; k < faces_a.size(); k++) {
+                    if (corner(faces_a[k], na[i]) >= 0) count++;
+                }
+                if (count == 1) return false;
+            }
+        }
+
+        std::vector<int> remap(faces_a.size(), -1);
+        for (size_t i = 0; i < faces_a.size(); i++) {
+            int f = faces_a[i];
+            if (std::find(shared.begin(), shared.end(), f) != shared.end()) continue;
+            int ca = corner(f, a);
+            for (size_t k = 0; k < wedge_map.size() && remap[i] < 0; k++) {
+                if (same_wedge(wedge_map[k].first, ca)) remap[i] = wedge_map[k].second;
+            }
+            if (remap[i] < 0) return false;
+            // Грань не должна выродиться или перевернуться
+            Vec3f before = face_normal(f);
+            Vec3f after = face_normal(f, a, positions[b]);
+            if (after.norm() <= 1e-12f || before * after <= 0.2f * before.norm() * after.norm()) return false;
+        }
+
+        for (size_t i = 0; i < faces_a.size(); i++) {
+            int f = faces_a[i];
+            if (remap[i] < 0) {
+                alive[f] = 0;
+                live_faces--;
+                continue;
+            }
+            int ca = corner(f, a);
+            tri[ca] = b;
+            tuv[ca] = tuv[remap[i]];
+            tnorm[ca] = tnorm[remap[i]];
+            vfaces[b].push_back(f);
+        }
+        removed[a] = 1;
+        std::vector<int>().swap(vfaces[a]);
+        std::vector<int> faces_b;
+        live_faces_of(b, faces_b);
+        vfaces[b].swap(faces_b);
+        quadrics[b] += quadrics[a];
+        stamps[b]++;
+        push_edges(b);
+        return true;
+    }
+};
+
+}
+
+LodChain::~LodChain() {
+    clear();
+}
+
+void LodChain::clear() {
+    for (size_t i = 1; i < levels.size(); i++) {
+        delete levels[i].model;
+    }
+    levels.clear();
+}
+
+void LodChain::build(Model& base, float ratio, int min_faces) {
+    TRACE_SCOPE("LodChain::build");
+    clear();
+    LodLevel level0;
+    level0.model = &base;
+    level0.error = 0.f;
+    levels.push_back(level0);
+
+    // Ограничивающая сфера по AABB
+    Vec3f bmin(0, 0, 0), bmax(0, 0, 0);
+    for (int i = 0; i < base.nverts(); i++) {
+        Vec3f p = base.vert(i);
+        for (int k = 0; k < 3; k++) {
+            bmin[k] = i == 0 ? p[k] : std::min(bmin[k], p[k]);
+            bmax[k] = i == 0 ? p[k] : std::max(bmax[k], p[k]);
+        }
+    }
+    center = (bmin + bmax) * 0.5f;
+    radius = (bmax - bmin).norm() * 0.5f;
+
+    // Уровни снимаются по ходу одного процесса упрощения
+    Simplifier simplifier(base);
+    int faces = simplifier.faces();
+    while (true) {
+        int target = static_cast<int>(faces * ratio);
+        if (target < min_faces) break;
+        bool more = simplifier.reduce(target);
+        // Уровень, который почти не уменьшился, не нужен
+        if (simplifier.faces() > faces * 0.9f) break;
+        faces = simplifier.faces();
+        LodLevel level;
+        level.model = simplifier.snapshot(base);
+        level.error = simplifier.error();
+        levels.push_back(level);
+        if (!more) break;
+    }
+}
+
+float LodChain::pixels_per_unit(const Camera& camera, const Matrix& viewport) const {
+    Matrix mvp = viewport * camera.get_projection_matrix() * camera.get_view_matrix();
+    Matrix view = camera.get_view_matrix();
+    Vec3f p = center;
+    if (camera.is_perspective()) {
+        Vec3f d = center - camera.get_eye();
+        float dist = d.norm();
+        // Камера внутри сферы: ошибка не ограничена, нужен полный уровень
+        if (dist <= radius) return std::numeric_limits<float>::max();
+        p = camera.get_eye() + d * ((dist - radius) / dist);
+    }
+    float step = std::max(radius, 1e-6f);
+    Vec3f up(view[1][0], view[1][1], view[1][2]);
+    Vec4f s0 = mvp * embed<4>(p, 1.0f);
+    Vec4f s1 = mvp * embed<4>(p + up * step, 1.0f);
+    if (s0.w <= 0.f || s1.w <= 0.f) return std::numeric_limits<float>::max();
+    float dx = s1.x / s1.w - s0.x / s0.w;
+    float dy = s1.y / s1.w - s0.y / s0.w;
+    return std::sqrt(dx * dx + dy * dy) / step;
+}
+
+int LodChain::select(const Camera& camera, const Matrix& viewport, float pixel_error) const {
+    float scale = pixels_per_unit(camera, viewport);
+    int best = 0;
+    for (int i = 1; i < nlevels(); i++) {
+        if (levels[i].error * scale <= pixel_error) best = i;
+    }
+    return best;
+}
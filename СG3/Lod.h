@@ -0,0 +1,47 @@
+﻿#ifndef LOD_H
+#define LOD_H
+
+#include <vector>
+#include "geometry.h"
+#include "model.h"
+#include "Camera.h"
+
+struct LodLevel {
+    Model* model;
+    float error; // оценка геометрической ошибки (единицы модели)
+};
+
+// Цепочка уровней детализации: упрощение по квадрикам ошибки (QEM)
+// схлопыванием ребер в существующую вершину. Швы UV и нормалей
+// сохраняются: вершина схлопывается, только если каждому ее набору атрибутов
+// соответствует набор атрибутов целевой вершины на общем ребре
+class LodChain {
+public:
+    LodChain() : radius(0.f) {}
+    ~LodChain();
+
+    // Уровень 0 — сама модель (не принадлежит цепочке), каждый следующий
+    // примерно в 1/ratio раз меньше по числу граней, пока их больше min_faces
+    void build(Model& base, float ratio = 0.5f, int min_faces = 64);
+
+    int nlevels() const { return static_cast<int>(levels.size()); }
+    const LodLevel& level(int i) const { return levels[i]; }
+
+    // Пикселей экрана на единицу модели в ближайшей к камере точке ограничивающей сферы
+    float pixels_per_unit(const Camera& camera, const Matrix& viewport) const;
+
+    // Самый грубый уровень, ошибка которого на экране не больше pixel_error пикселей
+    int select(const Camera& camera, const Matrix& viewport, float pixel_error = 1.f) const;
+
+private:
+    std::vector<LodLevel> levels;
+    Vec3f center;
+    float radius;
+
+    void clear();
+
+    LodChain(const LodChain&);
+    LodChain& operator=(const LodChain&);
+};
+
+#endif
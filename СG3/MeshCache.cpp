@@ -0,0 +1,493 @@
+﻿#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <new>
+#include <sys/stat.h>
+#include "MeshCache.h"
+#include "Trace.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace {
+    // Размер файла и время изменения в наносекундах от 1970 года
+    bool file_stamp(const char* path, uint64_t& size, int64_t& mtime_ns) {
+#ifdef _WIN32
+        WIN32_FILE_ATTRIBUTE_DATA data;
+        if (!GetFileAttributesExA(path, GetFileExInfoStandard, &data)) return false;
+        size = (static_cast<uint64_t>(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+        // FILETIME — сотни наносекунд от 1601 года
+        uint64_t ticks = (static_cast<uint64_t>(data.ftLastWriteTime.dwHighDateTime) << 32) |
+                         data.ftLastWriteTime.dwLowDateTime;
+        mtime_ns = (static_cast<int64_t>(ticks) - 116444736000000000LL) * 100;
+#else
+        struct stat st;
+        if (stat(path, &st) != 0) return false;
+        size = static_cast<uint64_t>(st.st_size);
+#ifdef __APPLE__
+        mtime_ns = static_cast<int64_t>(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+        mtime_ns = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+#endif
+        return true;
+    }
+
+    bool seek(FILE* f, uint64_t offset) {
+#ifdef _WIN32
+        return _fseeki64(f, static_cast<__int64>(offset), SEEK_SET) == 0;
+#else
+        return fseeko(f, static_cast<off_t>(offset), SEEK_SET) == 0;
+#endif
+    }
+
+    uint64_t align_up(uint64_t value) {
+        return (value + MESH_CACHE_ALIGN - 1) / MESH_CACHE_ALIGN * MESH_CACHE_ALIGN;
+    }
+
+    // Последовательная запись в свой раздел файла через буфер: разделы
+    // заполняются вперемешку (v, vn, vt и f в OBJ чередуются)
+    class SectionWriter {
+    public:
+        SectionWriter(FILE* file, uint64_t offset) : file_(file), offset_(offset), ok_(true) {
+            buffer_.reserve(BUFFER_BYTES);
+        }
+
+        void write(const void* data, size_t bytes) {
+            const char* p = static_cast<const char*>(data);
+            buffer_.insert(buffer_.end(), p, p + bytes);
+            if (buffer_.size() >= BUFFER_BYTES) flush();
+        }
+
+        bool flush() {
+            if (buffer_.empty()) return ok_;
+            ok_ = ok_ && seek(file_, offset_) && fwrite(&buffer_[0], 1, buffer_.size(), file_) == buffer_.size();
+            offset_ += buffer_.size();
+            buffer_.clear();
+            return ok_;
+        }
+
+    private:
+        static const size_t BUFFER_BYTES = 1 << 20;
+        FILE* file_;
+        uint64_t offset_;
+        std::vector<char> buffer_;
+        bool ok_;
+    };
+
+    const char* skip_spaces(const char* p) {
+        while (*p == ' ' || *p == '\t') p++;
+        return p;
+    }
+
+    // Индекс OBJ в индекс массива: с 1, отрицательные — от конца уже прочитанного; -1 — нет
+    int64_t resolve_index(long index, uint64_t count) {
+        if (index > 0) return index - 1;
+        if (index < 0) return static_cast<int64_t>(count) + index;
+        return -1;
+    }
+
+    struct Corner {
+        long v, vt, vn;
+    };
+
+    // Вершины грани "v", "v/vt", "v//vn", "v/vt/vn"
+    void parse_face(const char* p, std::vector<Corner>& corners) {
+        corners.clear();
+        for (;;) {
+            p = skip_spaces(p);
+            char* end;
+            Corner c = { strtol(p, &end, 10), 0, 0 };
+            if (end == p) break;
+            p = end;
+            if (*p == '/') {
+                p++;
+                if (*p != '/') {
+                    c.vt = strtol(p, &end, 10);
+                    p = end;
+                }
+                if (*p == '/') {
+                    c.vn = strtol(p + 1, &end, 10);
+                    p = end;
+                }
+            }
+            corners.push_back(c);
+            while (*p && *p != ' ' && *p != '\t') p++;
+        }
+    }
+
+    bool parse_floats(const char* p, float* out, int n) {
+        for (int i = 0; i < n; i++) {
+            char* end;
+            out[i] = strtof(p, &end);
+            if (end == p) return false;
+            p = end;
+        }
+        return true;
+    }
+}
+
+PagedFile::PagedFile()
+    : size_(0), window_bytes_(0), max_windows_(0), last_slot_(0), clock_(0), resident_(0), peak_resident_(0),
+      maps_(0) {
+#ifdef _WIN32
+    file_ = INVALID_HANDLE_VALUE;
+    mapping_ = NULL;
+#else
+    fd_ = -1;
+#endif
+}
+
+PagedFile::~PagedFile() {
+    close();
+}
+
+bool PagedFile::open(const char* path, size_t memory_limit, size_t window_bytes) {
+    close();
+    uint64_t size;
+    int64_t mtime_ns;
+    if (!file_stamp(path, size, mtime_ns) || size == 0) return false;
+
+    // Окна кратны 64 КБ (гранулярность отображения в Windows), в лимит входят хотя бы два
+    const size_t granularity = 64 << 10;
+    window_bytes = std::min(window_bytes, memory_limit / 2);
+    window_bytes_ = std::max(granularity, window_bytes / granularity * granularity);
+    max_windows_ = std::max<size_t>(2, memory_limit / (window_bytes_ + WINDOW_OVERLAP));
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return false;
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!mapping) {
+        CloseHandle(file);
+        return false;
+    }
+    file_ = file;
+    mapping_ = mapping;
+#else
+    fd_ = ::open(path, O_RDONLY);
+    if (fd_ < 0) return false;
+#endif
+    path_ = path;
+    size_ = size;
+    windows_.reserve(max_windows_);
+    return true;
+}
+
+void PagedFile::close() {
+    for (size_t i = 0; i < windows_.size(); i++) {
+        unmap_window(windows_[i]);
+    }
+    windows_.clear();
+    lookup_.clear();
+    resident_ = 0;
+#ifdef _WIN32
+    if (mapping_) CloseHandle(static_cast<HANDLE>(mapping_));
+    if (file_ != INVALID_HANDLE_VALUE) CloseHandle(static_cast<HANDLE>(file_));
+    mapping_ = NULL;
+    file_ = INVALID_HANDLE_VALUE;
+#else
+    if (fd_ >= 0) ::close(fd_);
+    fd_ = -1;
+#endif
+    size_ = 0;
+}
+
+const char* PagedFile::map_window(uint64_t index, size_t& bytes) {
+    uint64_t offset = index * window_bytes_;
+    bytes = static_cast<size_t>(std::min<uint64_t>(size_ - offset, window_bytes_ + WINDOW_OVERLAP));
+#ifdef _WIN32
+    void* data = MapViewOfFile(static_cast<HANDLE>(mapping_), FILE_MAP_READ, static_cast<DWORD>(offset >> 32),
+                               static_cast<DWORD>(offset & 0xffffffffu), bytes);
+    if (!data) throw std::bad_alloc();
+#else
+    void* data = mmap(NULL, bytes, PROT_READ, MAP_SHARED, fd_, static_cast<off_t>(offset));
+    if (data == MAP_FAILED) throw std::bad_alloc();
+    // Окно читается подряд (треугольники) или почти подряд (вершины соседних граней)
+    madvise(data, bytes, MADV_WILLNEED);
+#endif
+    maps_++;
+    return static_cast<const char*>(data);
+}
+
+void PagedFile::unmap_window(const Window& w) {
+#ifdef _WIN32
+    UnmapViewOfFile(w.data);
+#else
+    munmap(const_cast<char*>(w.data), w.bytes);
+#endif
+}
+
+const PagedFile::Window& PagedFile::window(uint64_t index) {
+    clock_++;
+    if (last_slot_ < windows_.size() && windows_[last_slot_].index == index) {
+        windows_[last_slot_].last_use = clock_;
+        return windows_[last_slot_];
+    }
+    std::unordered_map<uint64_t, size_t>::iterator it = lookup_.find(index);
+    if (it != lookup_.end()) {
+        last_slot_ = it->second;
+        windows_[last_slot_].last_use = clock_;
+        return windows_[last_slot_];
+    }
+
+    // Промах: свободный слот или вытеснение давно не использованного окна
+    size_t slot = windows_.size();
+    if (windows_.size() >= max_windows_) {
+        slot = 0;
+        for (size_t i = 1; i < windows_.size(); i++) {
+            if (windows_[i].last_use < windows_[slot].last_use) slot = i;
+        }
+        unmap_window(windows_[slot]);
+        resident_ -= windows_[slot].bytes;
+        lookup_.erase(windows_[slot].index);
+    }
+    else {
+        windows_.push_back(Window());
+    }
+    Window& w = windows_[slot];
+    w.index = index;
+    w.data = map_window(index, w.bytes);
+    w.last_use = clock_;
+    resident_ += w.bytes;
+    peak_resident_ = std::max(peak_resident_, resident_);
+    lookup_[index] = slot;
+    last_slot_ = slot;
+    return w;
+}
+
+const char* PagedFile::fetch(uint64_t offset, size_t bytes) {
+    if (offset + bytes > size_) return NULL;
+    uint64_t index = offset / window_bytes_;
+    return window(index).data + (offset - index * window_bytes_);
+}
+
+size_t PagedFile::contiguous(uint64_t offset) {
+    if (offset >= size_) return 0;
+    uint64_t index = offset / window_bytes_;
+    const Window& w = window(index);
+    return w.bytes - static_cast<size_t>(offset - index * window_bytes_);
+}
+
+bool MeshCache::convert(const char* obj_path, const char* cache_path, MeshCacheInfo* info) {
+    TRACE_SCOPE("MeshCache::convert");
+    std::ifstream in(obj_path, std::ios::binary);
+    if (!in) {
+        std::cerr << "Failed to open file: " << obj_path << std::endl;
+        return false;
+    }
+
+    // Проход 1: число элементов и границы для квантования
+    MeshCacheHeader header = MeshCacheHeader();
+    memcpy(header.magic, "CG3MESH", 8);
+    header.version = MESH_CACHE_VERSION;
+    if (!file_stamp(obj_path, header.source_size, header.source_mtime_ns)) return false;
+
+    const float inf = std::numeric_limits<float>::max();
+    float lo[3] = { inf, inf, inf }, hi[3] = { -inf, -inf, -inf };
+    float uv_lo[2] = { inf, inf }, uv_hi[2] = { -inf, -inf };
+    uint64_t reserved_triangles = 0;
+    std::string line;
+    std::vector<Corner> corners;
+    while (std::getline(in, line)) {
+        const char* p = line.c_str();
+        float f[3];
+        if (!strncmp(p, "v ", 2)) {
+            if (!parse_floats(p + 2, f, 3)) f[0] = f[1] = f[2] = 0.f;
+            for (int k = 0; k < 3; k++) {
+                lo[k] = std::min(lo[k], f[k]);
+                hi[k] = std::max(hi[k], f[k]);
+            }
+            header.nverts++;
+        }
+        else if (!strncmp(p, "vn ", 3)) {
+            header.nnormals++;
+        }
+        else if (!strncmp(p, "vt ", 3)) {
+            if (!parse_floats(p + 3, f, 2)) f[0] = f[1] = 0.f;
+            for (int k = 0; k < 2; k++) {
+                uv_lo[k] = std::min(uv_lo[k], f[k]);
+                uv_hi[k] = std::max(uv_hi[k], f[k]);
+            }
+            header.nuvs++;
+        }
+        else if (!strncmp(p, "f ", 2)) {
+            parse_face(p + 2, corners);
+            if (corners.size() >= 3) reserved_triangles += corners.size() - 2;
+        }
+    }
+    if (header.nverts > static_cast<uint64_t>(std::numeric_limits<int32_t>::max())) {
+        std::cerr << "ERROR: too many vertices for a mesh cache: " << header.nverts << std::endl;
+        return false;
+    }
+    for (int k = 0; k < 3; k++) {
+        if (header.nverts) header.position_range.set(k, lo[k], hi[k]);
+    }
+    for (int k = 0; k < 2; k++) {
+        if (header.nuvs) header.uv_range.set(k, uv_lo[k], uv_hi[k]);
+    }
+    header.positions_offset = align_up(sizeof(MeshCacheHeader));
+    header.normals_offset = align_up(header.positions_offset + header.nverts * sizeof(QuantizedPosition));
+    header.uvs_offset = align_up(header.normals_offset + header.nnormals * sizeof(uint32_t));
+    header.triangles_offset = align_up(header.uvs_offset + header.nuvs * sizeof(uint32_t));
+
+    FILE* out = fopen(cache_path, "wb");
+    if (!out) {
+        std::cerr << "ERROR: cannot write " << cache_path << std::endl;
+        return false;
+    }
+
+    // Проход 2: атрибуты и треугольники пишутся в свои разделы по мере чтения
+    in.clear();
+    in.seekg(0);
+    SectionWriter positions(out, header.positions_offset);
+    SectionWriter normals(out, header.normals_offset);
+    SectionWriter uvs(out, header.uvs_offset);
+    SectionWriter triangles(out, header.triangles_offset);
+    uint64_t nverts = 0, nnormals = 0, nuvs = 0;
+    int dropped = 0;
+    while (std::getline(in, line)) {
+        const char* p = line.c_str();
+        float f[3];
+        if (!strncmp(p, "v ", 2)) {
+            if (!parse_floats(p + 2, f, 3)) f[0] = f[1] = f[2] = 0.f;
+            QuantizedPosition q;
+            q.x = header.position_range.encode(0, f[0]);
+            q.y = header.position_range.encode(1, f[1]);
+            q.z = header.position_range.encode(2, f[2]);
+            q.w = 0;
+            positions.write(&q, sizeof(q));
+            nverts++;
+        }
+        else if (!strncmp(p, "vn ", 3)) {
+            if (!parse_floats(p + 3, f, 3)) f[0] = f[1] = f[2] = 0.f;
+            uint32_t n = oct_encode(Vec3f(f[0], f[1], f[2]));
+            normals.write(&n, sizeof(n));
+            nnormals++;
+        }
+        else if (!strncmp(p, "vt ", 3)) {
+            if (!parse_floats(p + 3, f, 2)) f[0] = f[1] = 0.f;
+            uint32_t t = encode_uv(Vec2f(f[0], f[1]), header.uv_range);
+            uvs.write(&t, sizeof(t));
+            nuvs++;
+        }
+        else if (!strncmp(p, "f ", 2)) {
+            parse_face(p + 2, corners);
+            if (corners.size() < 3) continue;
+            // Как и Model, отбрасываем грани со ссылками на несуществующие вершины
+            bool valid = true;
+            for (size_t k = 0; k < corners.size(); k++) {
+                int64_t v = resolve_index(corners[k].v, nverts);
+                valid = valid && v >= 0 && static_cast<uint64_t>(v) < header.nverts;
+            }
+            if (!valid) {
+                dropped++;
+                continue;
+            }
+            for (size_t k = 2; k < corners.size(); k++) {
+                const Corner* c[3] = { &corners[0], &corners[k - 1], &corners[k] };
+                CacheTriangle t;
+                for (int j = 0; j < 3; j++) {
+                    int64_t vt = resolve_index(c[j]->vt, nuvs);
+                    int64_t vn = resolve_index(c[j]->vn, nnormals);
+                    t.v[j] = static_cast<int32_t>(resolve_index(c[j]->v, nverts));
+                    t.uv[j] = vt >= 0 && static_cast<uint64_t>(vt) < header.nuvs ? static_cast<int32_t>(vt) : -1;
+                    t.n[j] = vn >= 0 && static_cast<uint64_t>(vn) < header.nnormals ? static_cast<int32_t>(vn) : -1;
+                }
+                triangles.write(&t, sizeof(t));
+                header.ntriangles++;
+            }
+        }
+    }
+
+    bool ok = positions.flush() && normals.flush() && uvs.flush() && triangles.flush();
+    ok = ok && seek(out, 0) && fwrite(&header, sizeof(header), 1, out) == 1;
+    ok = fclose(out) == 0 && ok;
+    if (!ok) {
+        std::cerr << "ERROR: cannot write " << cache_path << std::endl;
+        remove(cache_path);
+        return false;
+    }
+    if (info) {
+        info->nverts = header.nverts;
+        info->ntriangles = header.ntriangles;
+        info->file_bytes = header.triangles_offset + header.ntriangles * sizeof(CacheTriangle);
+        info->dropped_faces = dropped;
+    }
+    return true;
+}
+
+bool MeshCache::up_to_date(const char* obj_path, const char* cache_path) {
+    uint64_t size;
+    int64_t mtime_ns;
+    if (!file_stamp(obj_path, size, mtime_ns)) return false;
+    FILE* f = fopen(cache_path, "rb");
+    if (!f) return false;
+    MeshCacheHeader header;
+    bool ok = fread(&header, sizeof(header), 1, f) == 1;
+    fclose(f);
+    return ok && !memcmp(header.magic, "CG3MESH", 8) && header.version == MESH_CACHE_VERSION &&
+           header.source_size == size && header.source_mtime_ns == mtime_ns;
+}
+
+bool MeshCache::open(const char* path, size_t memory_limit) {
+    if (!file_.open(path, memory_limit)) return false;
+    const char* data = file_.fetch(0, sizeof(MeshCacheHeader));
+    if (!data) {
+        file_.close();
+        return false;
+    }
+    memcpy(&header_, data, sizeof(header_));
+    uint64_t end = header_.triangles_offset + header_.ntriangles * sizeof(CacheTriangle);
+    if (memcmp(header_.magic, "CG3MESH", 8) || header_.version != MESH_CACHE_VERSION || end > file_.size()) {
+        file_.close();
+        return false;
+    }
+    return true;
+}
+
+bool MeshCache::position(int64_t i, Vec3f& p) {
+    if (i < 0 || static_cast<uint64_t>(i) >= header_.nverts) return false;
+    const char* data = file_.fetch(header_.positions_offset + i * sizeof(QuantizedPosition), sizeof(QuantizedPosition));
+    if (!data) return false;
+    p = decode_position(*reinterpret_cast<const QuantizedPosition*>(data), header_.position_range);
+    return true;
+}
+
+bool MeshCache::normal(int64_t i, Vec3f& n) {
+    if (i < 0 || static_cast<uint64_t>(i) >= header_.nnormals) return false;
+    const char* data = file_.fetch(header_.normals_offset + i * sizeof(uint32_t), sizeof(uint32_t));
+    if (!data) return false;
+    uint32_t packed;
+    memcpy(&packed, data, sizeof(packed));
+    n = oct_decode(packed);
+    return true;
+}
+
+bool MeshCache::uv(int64_t i, Vec2f& t) {
+    if (i < 0 || static_cast<uint64_t>(i) >= header_.nuvs) return false;
+    const char* data = file_.fetch(header_.uvs_offset + i * sizeof(uint32_t), sizeof(uint32_t));
+    if (!data) return false;
+    uint32_t packed;
+    memcpy(&packed, data, sizeof(packed));
+    t = decode_uv(packed, header_.uv_range);
+    return true;
+}
+
+const CacheTriangle* MeshCache::triangles(uint64_t first, uint64_t& count) {
+    uint64_t offset = header_.triangles_offset + first * sizeof(CacheTriangle);
+    size_t available = file_.contiguous(offset) / sizeof(CacheTriangle);
+    count = std::min<uint64_t>(count, available);
+    const char* data = count > 0 ? file_.fetch(offset, sizeof(CacheTriangle)) : NULL;
+    if (!data) count = 0;
+    return reinterpret_cast<const CacheTriangle*>(data);
+}
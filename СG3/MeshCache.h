@@ -0,0 +1,143 @@
+﻿#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "geometry.h"
+#include "Quantize.h"
+
+// Двоичный кэш сетки для потоковой отрисовки. Атрибуты хранятся в сжатом
+// виде (см. Quantize.h), треугольники — по 9 индексов (вершины, UV, нормали).
+// Разделы выровнены на MESH_CACHE_ALIGN, числа — в порядке байтов машины
+struct MeshCacheHeader {
+    char magic[8];             // "CG3MESH"
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t nverts;
+    uint64_t nnormals;
+    uint64_t nuvs;
+    uint64_t ntriangles;
+    uint64_t positions_offset; // QuantizedPosition[nverts]
+    uint64_t normals_offset;   // uint32_t[nnormals], октаэдрические
+    uint64_t uvs_offset;       // uint32_t[nuvs]
+    uint64_t triangles_offset; // CacheTriangle[ntriangles]
+    uint64_t source_size;      // размер и время изменения OBJ (нс), из которого собран кэш
+    int64_t source_mtime_ns;
+    QuantizeRange position_range;
+    QuantizeRange uv_range;
+};
+
+struct CacheTriangle {
+    int32_t v[3];
+    int32_t uv[3]; // -1 — нет
+    int32_t n[3];  // -1 — нет
+};
+
+const uint32_t MESH_CACHE_VERSION = 2;
+const uint64_t MESH_CACHE_ALIGN = 4096;
+
+struct MeshCacheInfo {
+    uint64_t nverts;
+    uint64_t ntriangles;
+    uint64_t file_bytes;
+    int dropped_faces; // грани со ссылками на несуществующие вершины
+
+    MeshCacheInfo() : nverts(0), ntriangles(0), file_bytes(0), dropped_faces(0) {}
+};
+
+// Файл, отображаемый в память окнами фиксированного размера. Окна живут в
+// LRU-кэше, сумма отображенных окон не превышает лимита: страницы за пределами
+// окон система может выгрузить, поэтому файл может быть больше памяти.
+// Не потокобезопасен
+class PagedFile {
+public:
+    PagedFile();
+    ~PagedFile();
+
+    bool open(const char* path, size_t memory_limit, size_t window_bytes = 1 << 20);
+    void close();
+
+    uint64_t size() const { return size_; }
+
+    // Указатель на bytes байт с offset (bytes <= WINDOW_OVERLAP): запись,
+    // начавшаяся в окне, целиком видна через него. NULL — за концом файла
+    const char* fetch(uint64_t offset, size_t bytes);
+    // Сколько байт с offset доступно подряд через окно, где лежит offset
+    size_t contiguous(uint64_t offset);
+
+    size_t resident_bytes() const { return resident_; }
+    size_t peak_resident_bytes() const { return peak_resident_; }
+    uint64_t window_maps() const { return maps_; }
+
+    // Окна перекрываются на столько байт, чтобы записи не разрывались границей
+    static const size_t WINDOW_OVERLAP = 64;
+
+private:
+    struct Window {
+        uint64_t index;    // номер окна: начало файла index * window_bytes_
+        const char* data;  // начало отображения
+        size_t bytes;
+        uint64_t last_use;
+    };
+
+    std::string path_;
+    uint64_t size_;
+    size_t window_bytes_;
+    size_t max_windows_;
+    std::vector<Window> windows_;
+    std::unordered_map<uint64_t, size_t> lookup_; // номер окна -> слот windows_
+    size_t last_slot_;
+    uint64_t clock_;
+    size_t resident_;
+    size_t peak_resident_;
+    uint64_t maps_;
+#ifdef _WIN32
+    void* file_;
+    void* mapping_;
+#else
+    int fd_;
+#endif
+
+    const Window& window(uint64_t index);
+    const char* map_window(uint64_t index, size_t& bytes);
+    void unmap_window(const Window& w);
+
+    PagedFile(const PagedFile&);
+    PagedFile& operator=(const PagedFile&);
+};
+
+// Чтение кэша сетки через PagedFile
+class MeshCache {
+public:
+    // OBJ -> кэш за два потоковых прохода: первый считает элементы и границы,
+    // второй пишет сжатые атрибуты и треугольники (многоугольники — веером).
+    // Память не зависит от размера OBJ. Отрицательные (относительные) индексы поддерживаются
+    static bool convert(const char* obj_path, const char* cache_path, MeshCacheInfo* info = NULL);
+    // Кэш есть, его версия текущая и он собран из этого OBJ (размер и время изменения
+    // с точностью файловой системы, до наносекунд: правка в ту же секунду тоже видна)
+    static bool up_to_date(const char* obj_path, const char* cache_path);
+
+    bool open(const char* path, size_t memory_limit);
+    void close() { file_.close(); }
+
+    const MeshCacheHeader& header() const { return header_; }
+
+    // Атрибут i; false — индекс вне раздела или запись за концом файла (кэш поврежден)
+    bool position(int64_t i, Vec3f& p);
+    bool normal(int64_t i, Vec3f& n);
+    bool uv(int64_t i, Vec2f& t);
+    // Треугольники с first подряд в памяти; count уменьшается до конца окна.
+    // NULL (и count = 0) — треугольник за концом файла
+    const CacheTriangle* triangles(uint64_t first, uint64_t& count);
+
+    const PagedFile& file() const { return file_; }
+
+private:
+    PagedFile file_;
+    MeshCacheHeader header_;
+};
+
+#endif
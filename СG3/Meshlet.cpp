@@ -0,0 +1,138 @@
+﻿#include <algorithm>
+#include <cmath>
+#include "Meshlet.h"
+#include "Trace.h"
+
+namespace {
+    // Заполняет границы и конус нормалей готового кластера; pos — позиции его вершин
+    void finish_meshlet(const MeshletMesh& mesh, const Vec3f* pos, Meshlet& m) {
+
+        Vec3f bmin = pos[0];
+        Vec3f bmax = pos[0];
+        for (int i = 1; i < m.vertex_count; i++) {
+            for (int k = 0; k < 3; k++) {
+                bmin[k] = std::min(bmin[k], pos[i][k]);
+                bmax[k] = std::max(bmax[k], pos[i][k]);
+            }
+        }
+        m.center = (bmin + bmax) * 0.5f;
+        m.radius = 0.f;
+        for (int i = 0; i < m.vertex_count; i++) {
+            Vec3f d = pos[i] - m.center;
+            m.radius = std::max(m.radius, d.norm());
+        }
+
+        std::vector<Vec3f> normals;
+        Vec3f axis(0, 0, 0);
+        for (int t = 0; t < m.triangle_count; t++) {
+            const unsigned char* tri = &mesh.triangles[(m.triangle_offset + t) * 3];
+            Vec3f n = cross(pos[tri[1]] - pos[tri[0]], pos[tri[2]] - pos[tri[0]]);
+            if (n.norm() <= 0.f) continue;
+            n.normalize();
+            normals.push_back(n);
+            axis = axis + n;
+        }
+        m.cone_axis = Vec3f(0, 0, 1);
+        m.cone_cos = -1.f;
+        if (normals.empty() || axis.norm() <= 1e-6f) return;
+        axis.normalize();
+        float min_cos = 1.f;
+        for (size_t i = 0; i < normals.size(); i++) {
+            min_cos = std::min(min_cos, normals[i] * axis);
+        }
+        m.cone_axis = axis;
+        m.cone_cos = min_cos;
+    }
+}
+
+void MeshletMesh::build(Model& model, int max_vertices, int max_triangles) {
+    TRACE_SCOPE("MeshletMesh::build");
+    meshlets.clear();
+    vertices.clear();
+    corners.clear();
+    triangles.clear();
+    faces.clear();
+
+    // Локальный индекс вершины кластера с данной позицией, -1 — еще не добавлена.
+    // Вершины с той же позицией, но другими UV или нормалью ищутся перебором кластера
+    std::vector<int> local(model.nverts(), -1);
+    std::vector<int> local_uv;
+    std::vector<int> local_normal;
+    // Позиции вершин текущего кластера нужны только для его границ и конуса:
+    // в сетке они не хранятся, вершинный этап читает их из модели
+    std::vector<Vec3f> positions;
+    local_uv.reserve(max_vertices);
+    local_normal.reserve(max_vertices);
+    positions.reserve(max_vertices);
+
+    Meshlet current = Meshlet();
+    current.vertex_offset = 0;
+    current.triangle_offset = 0;
+
+    int corner_uv[3];
+    int corner_normal[3];
+    int found[3];
+    auto find_local = [&](int v, int uv, int n) {
+        int first = local[v];
+        if (first < 0 || n < 0) return -1;
+        for (int i = first; i < current.vertex_count; i++) {
+            if (vertices[current.vertex_offset + i] == v && local_uv[i] == uv && local_normal[i] == n) return i;
+        }
+        return -1;
+    };
+
+    for (int f = 0; f < model.nfaces(); f++) {
+        std::vector<int> face = model.face(f);
+        if (face.size() < 3) continue;
+
+        int added = 0;
+        for (int k = 0; k < 3; k++) {
+            corner_uv[k] = model.uv_index(f, k);
+            corner_normal[k] = model.normal_index(f, k);
+            found[k] = find_local(face[k], corner_uv[k], corner_normal[k]);
+            if (found[k] < 0) added++;
+        }
+        // Порядок граней сохраняется, поэтому результат совпадает с обходом по граням
+        if (current.vertex_count + added > max_vertices || current.triangle_count + 1 > max_triangles) {
+            finish_meshlet(*this, &positions[0], current);
+            meshlets.push_back(current);
+            for (int i = 0; i < current.vertex_count; i++) {
+                local[vertices[current.vertex_offset + i]] = -1;
+            }
+            local_uv.clear();
+            local_normal.clear();
+            positions.clear();
+            current = Meshlet();
+            current.vertex_offset = static_cast<int>(vertices.size());
+            current.triangle_offset = static_cast<int>(faces.size());
+            found[0] = found[1] = found[2] = -1;
+        }
+
+        for (int k = 0; k < 3; k++) {
+            int v = face[k];
+            // Повтор вершины внутри грани (вырожденная грань) ищется заново
+            int index = found[k] >= 0 ? found[k] : find_local(v, corner_uv[k], corner_normal[k]);
+            if (index < 0) {
+                index = current.vertex_count++;
+                if (local[v] < 0) local[v] = index;
+                vertices.push_back(v);
+                corners.push_back(f * 3 + k);
+                positions.push_back(model.vert(v));
+                local_uv.push_back(corner_uv[k]);
+                local_normal.push_back(corner_normal[k]);
+            }
+            triangles.push_back(static_cast<unsigned char>(index));
+        }
+        faces.push_back(f);
+        current.triangle_count++;
+    }
+    if (current.triangle_count > 0) {
+        finish_meshlet(*this, &positions[0], current);
+        meshlets.push_back(current);
+    }
+}
+
+size_t MeshletMesh::memory_bytes() const {
+    return meshlets.capacity() * sizeof(Meshlet) + vertices.capacity() * sizeof(int) +
+           corners.capacity() * sizeof(int) + triangles.capacity() + faces.capacity() * sizeof(int);
+}
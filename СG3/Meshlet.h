@@ -0,0 +1,47 @@
+﻿#ifndef MESHLET_H
+#define MESHLET_H
+
+#include <vector>
+#include "geometry.h"
+#include "model.h"
+
+// Кластер треугольников с локальным индексным буфером. Вершины кластера лежат
+// подряд, поэтому трансформация и отсечение кластера укладываются в L1
+struct Meshlet {
+    int vertex_offset;   // начало в MeshletMesh::vertices / corners
+    int vertex_count;
+    int triangle_offset; // начало в MeshletMesh::faces (и *3 в triangles)
+    int triangle_count;
+
+    // Ограничивающая сфера (координаты модели)
+    Vec3f center;
+    float radius;
+
+    // Конус нормалей: все нормали граней в пределах угла acos(cone_cos) от оси.
+    // cone_cos <= 0 — конус шире полусферы, по нему кластер не отсекается
+    Vec3f cone_axis;
+    float cone_cos;
+};
+
+class MeshletMesh {
+public:
+    static const int MAX_VERTICES = 64;
+    static const int MAX_TRIANGLES = 124;
+
+    std::vector<Meshlet> meshlets;
+    std::vector<int> vertices;             // глобальные индексы вершин модели
+    std::vector<int> corners;              // угол грани (face * 3 + k), по которому вершина шейдится
+    std::vector<unsigned char> triangles;  // по 3 локальных индекса на треугольник
+    std::vector<int> faces;                // исходная грань модели для каждого треугольника
+
+    // Группирует грани по порядку следования в кластеры не больше
+    // max_vertices вершин и max_triangles треугольников. Вершина кластера —
+    // сочетание индексов позиции, UV и нормали, поэтому ее выходы вершинного
+    // шейдера общие для всех граней; угол без нормали (берется нормаль грани) не делится
+    void build(Model& model, int max_vertices = MAX_VERTICES, int max_triangles = MAX_TRIANGLES);
+
+    int nmeshlets() const { return static_cast<int>(meshlets.size()); }
+    size_t memory_bytes() const;
+};
+
+#endif
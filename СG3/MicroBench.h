@@ -0,0 +1,145 @@
+﻿#ifndef MICROBENCH_H
+#define MICROBENCH_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "Json.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Минимальный header-only аналог Google Benchmark:
+//
+//     void bm_cross(microbench::State& state) {
+//         while (state.keep_running()) { ... microbench::do_not_optimize(result); }
+//     }
+//     MICROBENCH(bm_cross);
+//
+// Число итераций подбирается так, чтобы замер шел не меньше min_time,
+// из нескольких повторов берется лучший
+namespace microbench {
+
+class State {
+public:
+    explicit State(uint64_t iterations) : remaining_(iterations), iterations_(iterations) {}
+
+    bool keep_running() {
+        if (remaining_ == 0) return false;
+        --remaining_;
+        return true;
+    }
+
+    uint64_t iterations() const { return iterations_; }
+
+private:
+    uint64_t remaining_;
+    uint64_t iterations_;
+};
+
+typedef void (*Function)(State&);
+
+struct Benchmark {
+    const char* name;
+    Function function;
+};
+
+inline std::vector<Benchmark>& registry() {
+    static std::vector<Benchmark> benchmarks;
+    return benchmarks;
+}
+
+struct Registrar {
+    Registrar(const char* name, Function function) {
+        Benchmark b = { name, function };
+        registry().push_back(b);
+    }
+};
+
+// Не дает компилятору выбросить вычисление value
+template <class T>
+inline void do_not_optimize(const T& value) {
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static const void* volatile sink;
+    sink = &value;
+    _ReadWriteBarrier();
+#endif
+}
+
+struct Result {
+    const char* name;
+    uint64_t iterations;
+    double ns_per_op;
+};
+
+inline double run_once(Function function, uint64_t iterations) {
+    State state(iterations);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    function(state);
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+inline Result measure(const Benchmark& b, double min_time_ms, int repetitions) {
+    // Калибровка: растим число итераций, пока прогон не станет заметным
+    uint64_t iterations = 1;
+    double ns = run_once(b.function, iterations);
+    while (ns < min_time_ms * 1e5 && iterations < (1ull << 40)) {
+        iterations *= 10;
+        ns = run_once(b.function, iterations);
+    }
+    if (ns < min_time_ms * 1e6) {
+        iterations = static_cast<uint64_t>(iterations * (min_time_ms * 1e6 / std::max(ns, 1.0))) + 1;
+    }
+    Result r = { b.name, iterations, 0.0 };
+    for (int i = 0; i < repetitions; i++) {
+        double per_op = run_once(b.function, iterations) / iterations;
+        r.ns_per_op = i == 0 ? per_op : std::min(r.ns_per_op, per_op);
+    }
+    return r;
+}
+
+// Запускает зарегистрированные замеры, в имени которых есть filter.
+// Таблица — в stdout, json_path (если не пуст) — JSON для отслеживания во времени
+inline int run_all(const std::string& filter, const std::string& json_path,
+                   double min_time_ms = 100.0, int repetitions = 3) {
+    std::vector<Benchmark> benchmarks = registry();
+    std::vector<Result> results;
+    std::cout << std::left << std::setw(40) << "Benchmark" << std::right << std::setw(14) << "ns/op"
+              << std::setw(16) << "Iterations" << std::endl;
+    for (size_t i = 0; i < benchmarks.size(); i++) {
+        if (!filter.empty() && std::string(benchmarks[i].name).find(filter) == std::string::npos) continue;
+        Result r = measure(benchmarks[i], min_time_ms, repetitions);
+        results.push_back(r);
+        std::cout << std::left << std::setw(40) << r.name << std::right << std::setw(14) << std::fixed
+                  << std::setprecision(3) << r.ns_per_op << std::setw(16) << r.iterations << std::endl;
+    }
+    if (!json_path.empty()) {
+        std::ofstream out(json_path.c_str());
+        if (!out) {
+            std::cerr << "ERROR: cannot write " << json_path << std::endl;
+            return -1;
+        }
+        out << std::fixed << std::setprecision(3) << "{\"benchmarks\": [\n";
+        for (size_t i = 0; i < results.size(); i++) {
+            out << "  {\"name\": \"" << json_escape(results[i].name) << "\", \"iterations\": " << results[i].iterations
+                << ", \"ns_per_op\": " << results[i].ns_per_op << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+        }
+        out << "]}\n";
+    }
+    return 0;
+}
+
+}
+
+#define MICROBENCH(function) static microbench::Registrar microbench_registrar_##function(#function, function)
+
+#endif
@@ -0,0 +1,125 @@
+﻿#include <chrono>
+#include <iostream>
+#include "Arena.h"
+#include "OutputQueue.h"
+#include "ImageWriter.h"
+#include "Trace.h"
+
+namespace {
+    double elapsed_ms(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+}
+
+OutputQueue::OutputQueue(size_t capacity, VideoStream* video)
+    : capacity_(capacity > 0 ? capacity : 1), video_(video), head_(0), queued_(0), in_flight_(0), stopping_(false),
+      written_(0), failed_(0), write_ms_(0.0), stall_ms_(0.0) {
+    ring_.resize(capacity_);
+    pool_.reserve(capacity_);
+    worker_ = std::thread(&OutputQueue::run, this);
+}
+
+OutputQueue::~OutputQueue() {
+    finish();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    job_ready_.notify_all();
+    worker_.join();
+    for (size_t i = 0; i < pool_.size(); i++) {
+        delete pool_[i];
+    }
+}
+
+void OutputQueue::submit(TGAImage& image, const std::string& path, bool flip) {
+    TRACE_SCOPE("output submit");
+    TGAImage* buffer = NULL;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (in_flight_ >= capacity_) {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            slot_free_.wait(lock, [this] { return in_flight_ < capacity_; });
+            stall_ms_ += elapsed_ms(start);
+        }
+        in_flight_++;
+        // Буфер из пула подходит, только если совпадает формат кадра
+        while (!pool_.empty() && !buffer) {
+            buffer = pool_.back();
+            pool_.pop_back();
+            if (buffer->get_width() != image.get_width() || buffer->get_height() != image.get_height() ||
+                buffer->get_bytespp() != image.get_bytespp()) {
+                delete buffer;
+                buffer = NULL;
+            }
+        }
+    }
+    if (!buffer) {
+        buffer = new TGAImage(image.get_width(), image.get_height(), image.get_bytespp());
+    }
+    buffer->swap(image);
+
+    {
+        // В кольце не больше in_flight_ <= capacity_ заданий, свободный слот есть всегда
+        std::lock_guard<std::mutex> lock(mutex_);
+        Job& job = ring_[(head_ + queued_) % capacity_];
+        job.image = buffer;
+        job.path.assign(path);
+        job.flip = flip;
+        queued_++;
+    }
+    job_ready_.notify_one();
+}
+
+bool OutputQueue::finish() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    slot_free_.wait(lock, [this] { return in_flight_ == 0; });
+    return failed_ == 0;
+}
+
+void OutputQueue::run() {
+    trace::set_thread_name("output writer");
+    // Кодирование и запись файлов не входят в бюджет кадра
+    memstats::ignore_current_thread();
+    Job job;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            job_ready_.wait(lock, [this] { return stopping_ || queued_ > 0; });
+            if (queued_ == 0) return;
+            Job& slot = ring_[head_];
+            job.image = slot.image;
+            job.path.swap(slot.path);
+            job.flip = slot.flip;
+            head_ = (head_ + 1) % capacity_;
+            queued_--;
+        }
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        bool ok;
+        {
+            TRACE_SCOPE("write frame");
+            if (video_) {
+                // Поток читает строки в нужном порядке сам, переворот не нужен
+                ok = video_->write_frame(*job.image, job.flip);
+            }
+            else {
+                if (job.flip) job.image->flip_vertically();
+                ok = write_image(*job.image, job.path.c_str());
+            }
+        }
+        if (!ok) {
+            std::cerr << "ERROR: cannot write " << (video_ ? "video frame" : job.path) << std::endl;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            write_ms_ += elapsed_ms(start);
+            if (ok) written_++;
+            else failed_++;
+            pool_.push_back(job.image);
+            in_flight_--;
+        }
+        slot_free_.notify_all();
+    }
+}
@@ -0,0 +1,67 @@
+﻿#ifndef OUTPUT_QUEUE_H
+#define OUTPUT_QUEUE_H
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "tgaimage.h"
+#include "VideoStream.h"
+
+// Запись кадров в фоновом потоке. submit() забирает пиксели кадра обменом
+// буферов (без копирования) и отдает взамен свободный буфер того же размера,
+// поток записи переворачивает кадр, кодирует (формат по расширению)
+// и пишет его на диск. С потоком video кадры идут в него, а не в файлы.
+// Очередь ограничена: при capacity кадрах в полете submit() ждет,
+// поэтому память постоянна, а время кадра — max(отрисовка, запись)
+class OutputQueue {
+public:
+    explicit OutputQueue(size_t capacity = 2, VideoStream* video = NULL);
+    ~OutputQueue();
+
+    // После вызова image содержит буфер с неопределенным содержимым
+    void submit(TGAImage& image, const std::string& path, bool flip = true);
+
+    // Дожидается записи всех кадров; false — хотя бы один файл не записан
+    bool finish();
+
+    int written() const { return written_; }
+    int failed() const { return failed_; }
+    // Суммарное время записи и ожидания свободного места в очереди, мс
+    double write_ms() const { return write_ms_; }
+    double stall_ms() const { return stall_ms_; }
+
+private:
+    struct Job {
+        TGAImage* image;
+        std::string path;
+        bool flip;
+    };
+
+    size_t capacity_;
+    VideoStream* video_;
+    std::mutex mutex_;
+    std::condition_variable job_ready_;
+    std::condition_variable slot_free_;
+    // Кольцо из capacity_ заданий: строки путей в слотах сохраняют память
+    // между кадрами, так что submit() после разогрева не обращается к куче
+    std::vector<Job> ring_;
+    size_t head_;
+    size_t queued_;
+    std::vector<TGAImage*> pool_;
+    size_t in_flight_;
+    bool stopping_;
+    int written_;
+    int failed_;
+    double write_ms_;
+    double stall_ms_;
+    std::thread worker_;
+
+    void run();
+
+    OutputQueue(const OutputQueue&);
+    OutputQueue& operator=(const OutputQueue&);
+};
+
+#endif
@@ -0,0 +1,165 @@
+﻿#ifndef PBR_SHADER_H
+#define PBR_SHADER_H
+
+#include "geometry.h"
+#include "tgaimage.h"
+#include "model.h"
+#include "ishader.h"
+#include "Arena.h"
+#include "Lights.h"
+#include "BRDFLut.h"
+
+// Физически корректный шейдер metallic/roughness (Cook-Torrance).
+// G и интеграл окружения берутся из таблиц BRDFLut, D считается аналитически; pow() во фрагменте не вызывается
+struct PBRShader : public IShader, public LightList {
+    Model* model;
+    Matrix ModelView;
+    Matrix Projection;
+    Vec3f light_dir;
+    Vec3f light_color;   // линейная яркость основного направленного источника
+    Vec3f ambient_color; // равномерное освещение окружения
+
+    // Material properties
+    Vec3f albedo;
+    float metallic;
+    float roughness;
+
+    const BRDFLut* lut;
+
+    // Varying variables для интерполяции
+    mat<3, 3, float> varying_nrm; // Нормали в пространстве камеры
+    mat<3, 3, float> varying_pos; // Позиции в пространстве камеры
+
+    PBRShader()
+        : light_color(3.0f, 3.0f, 3.0f), ambient_color(0.3f, 0.3f, 0.3f),
+          albedo(0.8f, 0.8f, 0.8f), metallic(0.0f), roughness(0.5f), lut(&BRDFLut::instance()) {
+    }
+
+    virtual Vec4f vertex(int iface, int nthvert) {
+        Vec3f vertex = model->vert(iface, nthvert);
+        Vec3f normal = model->normal(iface, nthvert);
+
+        Vec4f normal_camera = ModelView * embed<4>(normal, 0.0f);
+        varying_nrm.set_col(nthvert, Vec3f(normal_camera[0], normal_camera[1], normal_camera[2]).normalize());
+
+        Vec4f vertex_camera = ModelView * embed<4>(vertex, 1.0f);
+        varying_pos.set_col(nthvert, Vec3f(vertex_camera[0], vertex_camera[1], vertex_camera[2]));
+
+        return Projection * vertex_camera;
+    }
+
+    // Кэш вершин: нормаль и позиция в пространстве камеры
+    virtual int varying_size() const { return 6; }
+
+    virtual Vec4f vertex_varying(int iface, int nthvert, float* out) {
+        Vec4f normal_camera = ModelView * embed<4>(model->normal(iface, nthvert), 0.0f);
+        Vec3f n_cam = Vec3f(normal_camera[0], normal_camera[1], normal_camera[2]).normalize();
+        Vec4f vertex_camera = ModelView * embed<4>(model->vert(iface, nthvert), 1.0f);
+        for (int k = 0; k < 3; k++) {
+            out[k] = n_cam[k];
+            out[3 + k] = vertex_camera[k];
+        }
+        return Projection * vertex_camera;
+    }
+
+    virtual void load_varyings(int /*iface*/, const float* const* varyings) {
+        for (int i = 0; i < 3; i++) {
+            varying_nrm.set_col(i, Vec3f(varyings[i][0], varyings[i][1], varyings[i][2]));
+            varying_pos.set_col(i, Vec3f(varyings[i][3], varyings[i][4], varyings[i][5]));
+        }
+    }
+
+    virtual bool fragment_linear(Vec3f bar, Vec4f& color) {
+        Vec3f n = (varying_nrm * bar).normalize();
+        Vec3f pos = varying_pos * bar;
+        // Направление взгляда в пространстве камеры (для перспективы — на камеру в начале координат)
+        Vec3f v = Projection[3][2] != 0.f ? (pos * -1.f).normalize() : Vec3f(0, 0, 1);
+        float ndotv = std::max(1e-4f, n * v);
+
+        Vec3f f0 = lerp(Vec3f(0.04f, 0.04f, 0.04f), albedo, metallic);
+        Vec3f diffuse_color = albedo * (1.0f - metallic);
+
+        // Основной направленный источник
+        Vec4f light_camera = ModelView * embed<4>(light_dir, 0.0f);
+        Vec3f l = Vec3f(light_camera[0], light_camera[1], light_camera[2]).normalize();
+        Vec3f lo = radiance(n, v, l, ndotv, f0, diffuse_color, light_color);
+
+        // Источники из списка (только попавшие в кластер фрагмента)
+        for (size_t i = 0; i < directional.size(); i++) {
+            const Light& light = lights_cam[directional[i]];
+            lo = lo + radiance(n, v, light.direction * -1.f, ndotv, f0, diffuse_color, light.color);
+        }
+        int count = 0;
+        const int* ids = local_lights(gl_FragCoord, count);
+        for (int i = 0; i < count; i++) {
+            const Light& light = lights_cam[ids[i]];
+            Vec3f to_light;
+            float attenuation = light_attenuation(light, pos, to_light);
+            if (attenuation > 0.f) {
+                lo = lo + radiance(n, v, to_light, ndotv, f0, diffuse_color, light.color * attenuation);
+            }
+        }
+
+        // Окружение по split-sum: диффузная часть + F0 * scale + bias
+        Vec2f env = lut->env(ndotv, roughness);
+        Vec3f ambient = mul(ambient_color, diffuse_color + f0 * env.x + Vec3f(env.y, env.y, env.y));
+
+        Vec3f rgb = lo + ambient;
+        color = Vec4f(rgb.x, rgb.y, rgb.z, 1.0f);
+        return false;
+    }
+
+    virtual IShader* clone() const {
+        return new PBRShader(*this);
+    }
+
+    virtual IShader* clone_in(FrameArena& arena) const {
+        return arena.create<PBRShader>(*this);
+    }
+
+    virtual bool fragment(Vec3f bar, TGAColor& color) {
+        Vec4f linear;
+        bool discard = fragment_linear(bar, linear);
+        color = quantize_color(linear);
+        return discard;
+    }
+
+    void set_material(const Vec3f& base_color, float metal, float rough) {
+        albedo = base_color;
+        metallic = metal;
+        roughness = rough;
+    }
+
+private:
+    static Vec3f mul(const Vec3f& a, const Vec3f& b) {
+        return Vec3f(a.x * b.x, a.y * b.y, a.z * b.z);
+    }
+
+    static Vec3f lerp(const Vec3f& a, const Vec3f& b, float t) {
+        return a + (b - a) * t;
+    }
+
+    // Вклад одного источника: (kd * albedo / pi + D * G * F / (4 n.l n.v)) * E * n.l
+    Vec3f radiance(const Vec3f& n, const Vec3f& v, const Vec3f& l, float ndotv,
+                   const Vec3f& f0, const Vec3f& diffuse_color, const Vec3f& light) const {
+        float ndotl = n * l;
+        if (ndotl <= 0.f) return Vec3f(0, 0, 0);
+        Vec3f h = (l + v).normalize();
+        float ndoth = std::max(0.f, n * h);
+        float vdoth = std::max(0.f, v * h);
+
+        // Schlick: (1 - cos)^5 умножениями вместо pow
+        float m = 1.f - vdoth;
+        float m2 = m * m;
+        float fresnel = m2 * m2 * m;
+        Vec3f f = f0 + (Vec3f(1.f, 1.f, 1.f) - f0) * fresnel;
+
+        float d = lut->ggx(ndoth, roughness);
+        float g = lut->smith(ndotl, roughness) * lut->smith(ndotv, roughness);
+        Vec3f specular = f * (d * g / (4.f * ndotl * ndotv));
+        Vec3f kd = mul(Vec3f(1.f, 1.f, 1.f) - f, diffuse_color) * 0.31830988f;
+        return mul(kd + specular, light) * ndotl;
+    }
+};
+
+#endif
@@ -0,0 +1,57 @@
+﻿#include <iomanip>
+#include "PipelineStats.h"
+
+void PipelineStats::reset() {
+    triangles_submitted = 0;
+    triangles_culled = 0;
+    triangles_clipped = 0;
+    meshlets_culled = 0;
+    pixels_tested = 0;
+    depth_passed = 0;
+    depth_failed = 0;
+    fragments_shaded = 0;
+    fragments_discarded = 0;
+    bin_ns = 0;
+    vertex_ns = 0;
+    raster_ns = 0;
+}
+
+PipelineStats& PipelineStats::operator+=(const PipelineStats& other) {
+    triangles_submitted += other.triangles_submitted;
+    triangles_culled += other.triangles_culled;
+    triangles_clipped += other.triangles_clipped;
+    meshlets_culled += other.meshlets_culled;
+    pixels_tested += other.pixels_tested;
+    depth_passed += other.depth_passed;
+    depth_failed += other.depth_failed;
+    fragments_shaded += other.fragments_shaded;
+    fragments_discarded += other.fragments_discarded;
+    bin_ns += other.bin_ns;
+    vertex_ns += other.vertex_ns;
+    raster_ns += other.raster_ns;
+    return *this;
+}
+
+void PipelineStats::print(std::ostream& out) const {
+    std::ios::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+    uint64_t covered = depth_passed + depth_failed;
+    out << "Pipeline statistics:" << std::endl;
+    out << "  triangles submitted:  " << triangles_submitted << std::endl;
+    out << "  triangles culled:     " << triangles_culled << " (meshlets culled: " << meshlets_culled << ")" << std::endl;
+    out << "  triangles clipped:    " << triangles_clipped << std::endl;
+    out << "  pixels tested:        " << pixels_tested;
+    if (pixels_tested > 0) {
+        out << " (" << std::fixed << std::setprecision(1) << 100.0 * covered / pixels_tested << "% covered)";
+    }
+    out << std::endl;
+    out << "  depth test pass/fail: " << depth_passed << " / " << depth_failed << std::endl;
+    out << "  fragments shaded:     " << fragments_shaded << std::endl;
+    out << "  fragments discarded:  " << fragments_discarded << std::endl;
+    out << std::fixed << std::setprecision(3);
+    out << "  bin:    " << bin_ns / 1e6 << " ms" << std::endl;
+    out << "  vertex: " << vertex_ns / 1e6 << " ms" << std::endl;
+    out << "  raster: " << raster_ns / 1e6 << " ms" << std::endl;
+    out.flags(flags);
+    out.precision(precision);
+}
@@ -0,0 +1,41 @@
+﻿#ifndef PIPELINE_STATS_H
+#define PIPELINE_STATS_H
+
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+// Счетчики конвейера. Каждый поток копит свою копию (без атомиков),
+// после отрисовки копии складываются. Время стадий — сумма по потокам
+struct PipelineStats {
+    // Треугольники
+    uint64_t triangles_submitted;
+    uint64_t triangles_culled;    // кластер отсечен, вырожден, вне кадра, за камерой или за clip_plane
+    uint64_t triangles_clipped;   // пересекают плоскость камеры и режутся
+    uint64_t meshlets_culled;
+
+    // Пиксели
+    uint64_t pixels_tested;       // пиксели bbox, проверенные на попадание в треугольник
+    uint64_t depth_passed;
+    uint64_t depth_failed;        // включая отброшенные clip_plane
+    uint64_t fragments_shaded;
+    uint64_t fragments_discarded;
+
+    // Время стадий, нс
+    uint64_t bin_ns;
+    uint64_t vertex_ns;
+    uint64_t raster_ns;
+
+    PipelineStats() { reset(); }
+
+    void reset();
+    PipelineStats& operator+=(const PipelineStats& other);
+    void print(std::ostream& out) const;
+
+    static uint64_t now_ns() {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+};
+
+#endif
@@ -0,0 +1,143 @@
+﻿#include <algorithm>
+#include <cstring>
+#include "Progressive.h"
+#include "Trace.h"
+
+namespace {
+    // Размножает отсчеты решетки step по блокам step x step.
+    // Строка решетки расходится вправо, остальные строки блока — ее копии
+    void fill_blocks(unsigned char* data, int width, int height, size_t bpp, int step) {
+        const size_t row_bytes = width * bpp;
+        for (int y = 0; y < height; y++) {
+            unsigned char* row = data + y * row_bytes;
+            if (y % step) {
+                memcpy(row, data + (y - y % step) * row_bytes, row_bytes);
+                continue;
+            }
+            for (int x = 0; x < width; x += step) {
+                const unsigned char* src = row + x * bpp;
+                for (int k = 1; k < step && x + k < width; k++) {
+                    memcpy(row + (x + k) * bpp, src, bpp);
+                }
+            }
+        }
+    }
+}
+
+ProgressiveRenderer::ProgressiveRenderer(int initial_step) : initial_step_(1), step_(0) {
+    while (initial_step_ * 2 <= initial_step) initial_step_ *= 2;
+}
+
+ProgressiveRenderer::~ProgressiveRenderer() {
+    for (size_t i = 0; i < lattices_.size(); i++) {
+        delete lattices_[i];
+    }
+}
+
+int ProgressiveRenderer::passes() const {
+    int n = 1;
+    for (int s = initial_step_; s > 1; s /= 2) n++;
+    return n;
+}
+
+void ProgressiveRenderer::begin(Framebuffer& fb) {
+    fb.clear();
+    step_ = 0;
+}
+
+bool ProgressiveRenderer::refine(const MeshletMesh& mesh, const Camera& camera, IShader& shader, Framebuffer& fb,
+                                 const RenderOptions& options) {
+    if (step_ == 1) return false;
+    TRACE_SCOPE("progressive pass");
+    // Полупрозрачные фрагменты копятся в списках всего кадра, решетки их не переносят
+    if (fb.transparency() || initial_step_ == 1) {
+        draw_meshlets(mesh, camera, shader, fb, options);
+        step_ = 1;
+        return true;
+    }
+    if (step_ == 0) {
+        render_lattice(mesh, camera, shader, fb, options, initial_step_, 0, 0);
+        step_ = initial_step_;
+        return true;
+    }
+    // Решетка step готова, из решетки step / 2 не хватает трех сдвинутых подрешеток
+    int half = step_ / 2;
+    render_lattice(mesh, camera, shader, fb, options, step_, half, 0);
+    render_lattice(mesh, camera, shader, fb, options, step_, 0, half);
+    render_lattice(mesh, camera, shader, fb, options, step_, half, half);
+    step_ = half;
+    return true;
+}
+
+void ProgressiveRenderer::render_lattice(const MeshletMesh& mesh, const Camera& camera, IShader& shader,
+                                         Framebuffer& fb, const RenderOptions& options, int stride, int ox, int oy) {
+    const int width = (fb.get_width() - ox + stride - 1) / stride;
+    const int height = (fb.get_height() - oy + stride - 1) / stride;
+    if (width <= 0 || height <= 0) return;
+
+    size_t level = 0;
+    while ((2 << level) < stride) level++;
+    if (lattices_.size() <= level) lattices_.resize(level + 1, NULL);
+    Framebuffer*& lattice = lattices_[level];
+    if (!lattice) {
+        lattice = new Framebuffer(width, height, static_cast<TGAImage::Format>(fb.color().get_bytespp()),
+                                   fb.depth_format());
+    }
+    else {
+        lattice->resize(width, height);
+        if (lattice->depth_format() != fb.depth_format()) lattice->set_depth_format(fb.depth_format());
+    }
+    lattice->set_depth_range(fb.depth_bias(), fb.depth_bias() + 1.f / fb.depth_scale());
+    lattice->enable_hdr(fb.hdr_enabled());
+    lattice->set_blend_mode(fb.blend_mode());
+    lattice->clear();
+
+    // Пиксель (i, j) подрешетки — пиксель (ox + i * stride, oy + j * stride) кадра.
+    // Вьюпорт остается вьюпортом кадра: растеризатор проверяет покрытие и отдает
+    // шейдеру gl_FragCoord в точках кадра, поэтому узел решетки получает ровно тот
+    // же результат, что и при полной отрисовке
+    lattice->set_viewport(fb.viewport());
+    lattice->set_lattice(stride, ox, oy, fb.get_width(), fb.get_height());
+    draw_meshlets(mesh, camera, shader, *lattice, options);
+
+    // Перенос цвета, глубины и HDR в полный кадр
+    const int fb_width = fb.get_width();
+    const size_t bpp = fb.color().get_bytespp();
+    const size_t depth_bpp = fb.depth_bytes_per_pixel();
+    const unsigned char* src_color = lattice->color().buffer();
+    unsigned char* dst_color = fb.color().buffer();
+    const unsigned char* src_depth = static_cast<const unsigned char*>(lattice->depth_data());
+    unsigned char* dst_depth = static_cast<unsigned char*>(fb.depth_data());
+    for (int j = 0; j < height; j++) {
+        for (int i = 0; i < width; i++) {
+            size_t src = static_cast<size_t>(j) * width + i;
+            size_t dst = static_cast<size_t>(oy + j * stride) * fb_width + ox + i * stride;
+            memcpy(dst_color + dst * bpp, src_color + src * bpp, bpp);
+            memcpy(dst_depth + dst * depth_bpp, src_depth + src * depth_bpp, depth_bpp);
+        }
+    }
+    if (fb.hdr_enabled()) {
+        for (int c = 0; c < 4; c++) {
+            const float* src_plane = lattice->hdr_plane(c);
+            float* dst_plane = fb.hdr_plane(c);
+            for (int j = 0; j < height; j++) {
+                for (int i = 0; i < width; i++) {
+                    dst_plane[static_cast<size_t>(oy + j * stride) * fb_width + ox + i * stride] =
+                        src_plane[static_cast<size_t>(j) * width + i];
+                }
+            }
+        }
+    }
+}
+
+void ProgressiveRenderer::fill_preview(Framebuffer& fb) const {
+    if (step_ <= 1) return;
+    TRACE_SCOPE("progressive preview");
+    fill_blocks(fb.color().buffer(), fb.get_width(), fb.get_height(), fb.color().get_bytespp(), step_);
+    if (fb.hdr_enabled()) {
+        for (int c = 0; c < 4; c++) {
+            fill_blocks(reinterpret_cast<unsigned char*>(fb.hdr_plane(c)), fb.get_width(), fb.get_height(),
+                        sizeof(float), step_);
+        }
+    }
+}
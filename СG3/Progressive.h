@@ -0,0 +1,57 @@
+﻿#ifndef PROGRESSIVE_H
+#define PROGRESSIVE_H
+
+#include <vector>
+#include "geometry.h"
+#include "ishader.h"
+#include "Camera.h"
+#include "Framebuffer.h"
+#include "Meshlet.h"
+#include "Renderer.h"
+
+// Прогрессивная отрисовка от грубого к точному. Кадр раскладывается на
+// вложенные решетки пикселей: первый проход рисует каждый step-й пиксель по
+// обеим осям, каждый следующий вдвое уменьшает шаг и дорисовывает только три
+// новые подрешетки. Подрешетка рисуется в маленький кадр со сдвинутым и
+// сжатым viewport'ом, поэтому ее отсчеты совпадают с пикселями полного кадра.
+// Каждый пиксель растеризуется и шейдится один раз: после всех проходов
+// работа почти как у обычной отрисовки, а первый проход дешевле в step^2 раз
+class ProgressiveRenderer {
+public:
+    // initial_step — шаг первой решетки, степень двойки
+    explicit ProgressiveRenderer(int initial_step = 4);
+    ~ProgressiveRenderer();
+
+    // Начинает новый кадр: fb очищается, refine() начнет с самой грубой решетки
+    void begin(Framebuffer& fb);
+
+    // Следующий проход; false — кадр уже полный. С буфером прозрачности
+    // решетки не используются: весь кадр рисуется за один проход
+    bool refine(const MeshletMesh& mesh, const Camera& camera, IShader& shader, Framebuffer& fb,
+                const RenderOptions& options);
+
+    // Шаг готовой решетки: 0 — еще ничего не нарисовано, 1 — кадр полный
+    int step() const { return step_; }
+    bool done() const { return step_ == 1; }
+    int passes() const;
+
+    // Заполняет недорисованные пиксели цвета и HDR ближайшим готовым отсчетом
+    // (блоки step x step). Следующий refine() перепишет их настоящими значениями
+    void fill_preview(Framebuffer& fb) const;
+
+private:
+    int initial_step_;
+    int step_;
+    // Кадры подрешеток по log2 шага: у подрешеток одного шага размер почти
+    // одинаков, так что от прохода к проходу и от кадра к кадру буферы не перевыделяются
+    std::vector<Framebuffer*> lattices_;
+
+    // Рисует пиксели (ox + i * stride, oy + j * stride) и переносит их в fb
+    void render_lattice(const MeshletMesh& mesh, const Camera& camera, IShader& shader, Framebuffer& fb,
+                        const RenderOptions& options, int stride, int ox, int oy);
+
+    ProgressiveRenderer(const ProgressiveRenderer&);
+    ProgressiveRenderer& operator=(const ProgressiveRenderer&);
+};
+
+#endif
@@ -0,0 +1,143 @@
+﻿#ifndef QUANTIZE_H
+#define QUANTIZE_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include "geometry.h"
+
+#if defined(_M_X64) || defined(_M_AMD64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define QUANTIZE_USE_SSE 1
+#endif
+
+// Сжатые атрибуты вершин: позиция — 3 x uint16 относительно AABB модели
+// (четвертое слово — выравнивание, чтобы вершина читалась одной 64-битной
+// загрузкой), нормаль — октаэдрическая развертка 2 x snorm16, UV — 2 x uint16
+// относительно границ текстурных координат. 8 + 4 + 4 байта вместо 12 + 12 + 8
+struct QuantizedPosition {
+    uint16_t x, y, z, w;
+};
+
+// Аффинное преобразование кода в значение: value = offset + q * scale по осям
+struct QuantizeRange {
+    float offset[4];
+    float scale[4];
+
+    QuantizeRange() {
+        std::fill(offset, offset + 4, 0.f);
+        std::fill(scale, scale + 4, 0.f);
+    }
+
+    // Диапазон [lo, hi] делится на 65535 шагов; вырожденная ось — всегда lo
+    void set(int axis, float lo, float hi) {
+        offset[axis] = lo;
+        scale[axis] = hi > lo ? (hi - lo) / 65535.f : 0.f;
+    }
+
+    uint16_t encode(int axis, float value) const {
+        if (scale[axis] <= 0.f) return 0;
+        float q = (value - offset[axis]) / scale[axis] + 0.5f;
+        return static_cast<uint16_t>(std::min(65535.f, std::max(0.f, q)));
+    }
+};
+
+inline Vec3f decode_position(const QuantizedPosition& q, const QuantizeRange& range) {
+#ifdef QUANTIZE_USE_SSE
+    __m128i packed = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(&q));
+    __m128 code = _mm_cvtepi32_ps(_mm_unpacklo_epi16(packed, _mm_setzero_si128()));
+    __m128 value = _mm_add_ps(_mm_loadu_ps(range.offset), _mm_mul_ps(code, _mm_loadu_ps(range.scale)));
+    float out[4];
+    _mm_storeu_ps(out, value);
+    return Vec3f(out[0], out[1], out[2]);
+#else
+    return Vec3f(range.offset[0] + q.x * range.scale[0],
+                 range.offset[1] + q.y * range.scale[1],
+                 range.offset[2] + q.z * range.scale[2]);
+#endif
+}
+
+inline uint32_t encode_uv(const Vec2f& uv, const QuantizeRange& range) {
+    return static_cast<uint32_t>(range.encode(0, uv.x)) | static_cast<uint32_t>(range.encode(1, uv.y)) << 16;
+}
+
+inline Vec2f decode_uv(uint32_t packed, const QuantizeRange& range) {
+#ifdef QUANTIZE_USE_SSE
+    __m128i code16 = _mm_cvtsi32_si128(static_cast<int>(packed));
+    __m128 code = _mm_cvtepi32_ps(_mm_unpacklo_epi16(code16, _mm_setzero_si128()));
+    __m128 value = _mm_add_ps(_mm_loadu_ps(range.offset), _mm_mul_ps(code, _mm_loadu_ps(range.scale)));
+    float out[4];
+    _mm_storeu_ps(out, value);
+    return Vec2f(out[0], out[1]);
+#else
+    return Vec2f(range.offset[0] + (packed & 0xffff) * range.scale[0],
+                 range.offset[1] + (packed >> 16) * range.scale[1]);
+#endif
+}
+
+// Октаэдрическая нормаль: единичная сфера проецируется на октаэдр |x|+|y|+|z| = 1,
+// нижняя половина отворачивается на углы квадрата [-1, 1]^2
+inline Vec3f oct_decode(uint32_t packed) {
+#ifdef QUANTIZE_USE_SSE
+    // Расширение со знаком: (a, a) -> 32-битное a << 16 | a, сдвиг на 16 вправо
+    __m128i code16 = _mm_cvtsi32_si128(static_cast<int>(packed));
+    __m128i code = _mm_srai_epi32(_mm_unpacklo_epi16(code16, code16), 16);
+    __m128 f = _mm_mul_ps(_mm_cvtepi32_ps(code), _mm_set1_ps(1.f / 32767.f));      // u v 0 0
+    const __m128 sign = _mm_set1_ps(-0.f);
+    __m128 a = _mm_andnot_ps(sign, f);
+    __m128 z = _mm_sub_ps(_mm_set1_ps(1.f), _mm_add_ps(a, _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 2, 0, 1))));
+    __m128 t = _mm_max_ps(_mm_sub_ps(_mm_setzero_ps(), z), _mm_setzero_ps());
+    __m128 xy = _mm_sub_ps(f, _mm_or_ps(t, _mm_and_ps(f, sign)));                  // f - copysign(t, f)
+    __m128 n = _mm_shuffle_ps(xy, z, _MM_SHUFFLE(3, 0, 1, 0));                        // x y z z
+    n = _mm_and_ps(n, _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1)));
+    __m128 d = _mm_mul_ps(n, n);
+    d = _mm_add_ps(d, _mm_shuffle_ps(d, d, _MM_SHUFFLE(2, 3, 0, 1)));
+    d = _mm_add_ps(d, _mm_shuffle_ps(d, d, _MM_SHUFFLE(1, 0, 3, 2)));
+    n = _mm_div_ps(n, _mm_sqrt_ps(d));
+    float out[4];
+    _mm_storeu_ps(out, n);
+    return Vec3f(out[0], out[1], out[2]);
+#else
+    float u = static_cast<int16_t>(packed & 0xffff) / 32767.f;
+    float v = static_cast<int16_t>(packed >> 16) / 32767.f;
+    Vec3f n(u, v, 1.f - std::fabs(u) - std::fabs(v));
+    float t = std::max(-n.z, 0.f);
+    n.x += n.x >= 0.f ? -t : t;
+    n.y += n.y >= 0.f ? -t : t;
+    return n.normalize();
+#endif
+}
+
+// Кодирование с перебором четырех соседних кодов: ошибка после округления
+// до 16 бит меньше, чем у простого округления развертки
+inline uint32_t oct_encode(Vec3f n) {
+    float len = std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z);
+    if (len <= 0.f) return 0;
+    float u = n.x / len;
+    float v = n.y / len;
+    if (n.z < 0.f) {
+        float fu = (1.f - std::fabs(v)) * (u >= 0.f ? 1.f : -1.f);
+        float fv = (1.f - std::fabs(u)) * (v >= 0.f ? 1.f : -1.f);
+        u = fu;
+        v = fv;
+    }
+    Vec3f unit = n.normalize();
+    uint32_t best = 0;
+    float best_dot = -2.f;
+    for (int k = 0; k < 4; k++) {
+        float cu = (k & 1) ? std::ceil(u * 32767.f) : std::floor(u * 32767.f);
+        float cv = (k & 2) ? std::ceil(v * 32767.f) : std::floor(v * 32767.f);
+        int iu = static_cast<int>(std::min(32767.f, std::max(-32767.f, cu)));
+        int iv = static_cast<int>(std::min(32767.f, std::max(-32767.f, cv)));
+        uint32_t packed = static_cast<uint32_t>(static_cast<uint16_t>(iu)) |
+                          static_cast<uint32_t>(static_cast<uint16_t>(iv)) << 16;
+        float dot = oct_decode(packed) * unit;
+        if (dot > best_dot) {
+            best_dot = dot;
+            best = packed;
+        }
+    }
+    return best;
+}
+
+#endif
@@ -0,0 +1,226 @@
+﻿#include <algorithm>
+#include <thread>
+#include "Arena.h"
+#include "RelightCache.h"
+#include "Trace.h"
+#include "WorkerPool.h"
+
+namespace {
+    bool same_matrix(const Matrix& a, const Matrix& b) {
+        for (int i = 0; i < 4; i++) {
+            for (int j = 0; j < 4; j++) {
+                if (a[i][j] != b[i][j]) return false;
+            }
+        }
+        return true;
+    }
+
+    void store_depth(Framebuffer& fb, int idx, float depth) {
+        switch (fb.depth_format()) {
+        case DEPTH_UNORM24:
+            DepthUnorm24Traits::store(fb.depth_data(), idx,
+                                      DepthUnorm24Traits::encode(depth, fb.depth_scale(), fb.depth_bias()));
+            break;
+        case DEPTH_UNORM16:
+            DepthUnorm16Traits::store(fb.depth_data(), idx,
+                                      DepthUnorm16Traits::encode(depth, fb.depth_scale(), fb.depth_bias()));
+            break;
+        default:
+            static_cast<float*>(fb.depth_data())[idx] = depth;
+            break;
+        }
+    }
+
+    // Обертка, которая пропускает фрагменты во внутренний шейдер и запоминает,
+    // какая грань и в какой точке видна в пикселе. Полосы кадра у потоков
+    // не пересекаются, поэтому копии пишут в общий буфер без синхронизации
+    struct VisibilityShader : public IShader {
+        IShader* inner;
+        bool owns_inner;
+        RelightCache::Sample* samples;
+        int width;
+        int face;
+
+        VisibilityShader(IShader* shader, RelightCache::Sample* buffer, int w)
+            : inner(shader), owns_inner(false), samples(buffer), width(w), face(-1) {
+        }
+
+        ~VisibilityShader() {
+            if (owns_inner) delete inner;
+        }
+
+        virtual IShader* clone() const {
+            IShader* copy = inner->clone();
+            if (!copy) return NULL;
+            VisibilityShader* v = new VisibilityShader(copy, samples, width);
+            v->owns_inner = true;
+            return v;
+        }
+
+        virtual Vec4f vertex(int iface, int nthvert) {
+            face = iface;
+            return inner->vertex(iface, nthvert);
+        }
+
+        virtual int varying_size() const {
+            return inner->varying_size();
+        }
+
+        virtual Vec4f vertex_varying(int iface, int nthvert, float* out) {
+            return inner->vertex_varying(iface, nthvert, out);
+        }
+
+        virtual void load_varyings(int iface, const float* const* varyings) {
+            face = iface;
+            inner->load_varyings(iface, varyings);
+        }
+
+        void record(const Vec3f& bar) {
+            RelightCache::Sample& s = samples[static_cast<int>(gl_FragCoord.x) + static_cast<int>(gl_FragCoord.y) * width];
+            s.face = face;
+            s.bar = bar;
+            s.depth = gl_FragCoord.z;
+        }
+
+        virtual bool fragment(Vec3f bar, TGAColor& color) {
+            inner->gl_FragCoord = gl_FragCoord;
+            bool discard = inner->fragment(bar, color);
+            if (!discard) record(bar);
+            return discard;
+        }
+
+        virtual bool fragment_linear(Vec3f bar, Vec4f& color) {
+            inner->gl_FragCoord = gl_FragCoord;
+            bool discard = inner->fragment_linear(bar, color);
+            if (!discard) record(bar);
+            return discard;
+        }
+    };
+}
+
+RelightCache::RelightCache()
+    : valid_(false), model_(NULL), nfaces_(0), width_(0), height_(0), clip_plane_(0.f), cull_backfaces_(false) {
+}
+
+bool RelightCache::valid(Model* model, const Camera& camera, const Framebuffer& fb,
+                         const RenderOptions& options) const {
+    return valid_ && model == model_ && model->nfaces() == nfaces_ &&
+           fb.get_width() == width_ && fb.get_height() == height_ &&
+           options.clip_plane == clip_plane_ && options.cull_backfaces == cull_backfaces_ &&
+           same_matrix(camera.get_view_matrix(), view_) && same_matrix(camera.get_projection_matrix(), projection_);
+}
+
+void RelightCache::render(const MeshletMesh& mesh, Model* model, const Camera& camera, IShader& shader,
+                          Framebuffer& fb, const RenderOptions& options) {
+    // Полупрозрачные фрагменты не попадают в один слой видимости
+    if (fb.transparency()) {
+        valid_ = false;
+        draw_meshlets(mesh, camera, shader, fb, options);
+        return;
+    }
+
+    Sample background;
+    background.face = -1;
+    background.bar = Vec3f(0, 0, 0);
+    background.depth = 0.f;
+    samples_.assign(fb.pixel_count(), background);
+
+    VisibilityShader capture(&shader, samples_.data(), fb.get_width());
+    draw_meshlets(mesh, camera, capture, fb, options);
+
+    valid_ = true;
+    model_ = model;
+    nfaces_ = model->nfaces();
+    width_ = fb.get_width();
+    height_ = fb.get_height();
+    view_ = camera.get_view_matrix();
+    projection_ = camera.get_projection_matrix();
+    clip_plane_ = options.clip_plane;
+    cull_backfaces_ = options.cull_backfaces;
+}
+
+void RelightCache::reshade(IShader& shader, Framebuffer& fb, int threads, FrameArena* arena) const {
+    TRACE_SCOPE("reshade");
+    // Глубина восстанавливается из буфера видимости, кадр остается согласованным
+    fb.clear();
+    const bool hdr = fb.hdr_enabled();
+
+    if (threads <= 0) {
+        threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    }
+    threads = std::max(1, std::min(threads, height_));
+    ScratchArray<IShader*> shaders(arena, threads);
+    ScratchArray<unsigned char> in_arena(arena, threads);
+    shaders[0] = &shader;
+    int nshaders = 1;
+    for (; nshaders < threads; nshaders++) {
+        IShader* copy = arena ? shader.clone_in(arena->thread_arena(nshaders)) : NULL;
+        in_arena[nshaders] = copy != NULL;
+        if (!copy) copy = shader.clone();
+        if (!copy) break;
+        shaders[nshaders] = copy;
+    }
+    threads = nshaders;
+
+    // Строки независимы. vertex() зовется только при смене грани: соседние
+    // пиксели строки обычно принадлежат одной грани
+    const int width = width_;
+    const int height = height_;
+    const Sample* samples = samples_.data();
+    auto shade_rows = [&fb, samples, width, hdr](IShader* s, int y0, int y1) {
+        TGAImage& image = fb.color();
+        int current = -1;
+        TGAColor color;
+        Vec4f linear;
+        for (int y = y0; y < y1; y++) {
+            for (int x = 0; x < width; x++) {
+                const Sample& sample = samples[x + y * width];
+                if (sample.face < 0) continue;
+                store_depth(fb, x + y * width, sample.depth);
+                if (sample.face != current) {
+                    current = sample.face;
+                    for (int j = 0; j < 3; j++) {
+                        s->vertex(current, j);
+                    }
+                }
+                s->gl_FragCoord = Vec3f(static_cast<float>(x), static_cast<float>(y), sample.depth);
+                if (hdr) {
+                    if (!s->fragment_linear(sample.bar, linear)) fb.blend_hdr(x + y * width, linear);
+                }
+                else if (!s->fragment(sample.bar, color)) {
+                    image.set(x, y, color);
+                }
+            }
+        }
+    };
+
+    int rows_per_thread = (height + threads - 1) / threads;
+    auto shade_band = [&](int t) {
+        int y0 = std::min(height, t * rows_per_thread);
+        shade_rows(shaders[t], y0, std::min(height, y0 + rows_per_thread));
+    };
+    WorkerPool::instance().run(threads, shade_band);
+    for (int t = 1; t < threads; t++) {
+        if (in_arena[t]) FrameArena::destroy(shaders[t]);
+        else delete shaders[t];
+    }
+}
+
+bool RelightCache::draw(const MeshletMesh& mesh, Model* model, const Camera& camera, IShader& shader,
+                        Framebuffer& fb, const RenderOptions& options) {
+    if (!fb.transparency() && valid(model, camera, fb, options)) {
+        reshade(shader, fb, options.threads, options.arena);
+        return true;
+    }
+    render(mesh, model, camera, shader, fb, options);
+    return false;
+}
+
+size_t RelightCache::visible_pixels() const {
+    if (!valid_) return 0;
+    size_t count = 0;
+    for (size_t i = 0; i < samples_.size(); i++) {
+        if (samples_[i].face >= 0) count++;
+    }
+    return count;
+}
@@ -0,0 +1,60 @@
+﻿#ifndef RELIGHT_CACHE_H
+#define RELIGHT_CACHE_H
+
+#include <vector>
+#include "geometry.h"
+#include "model.h"
+#include "ishader.h"
+#include "Camera.h"
+#include "Framebuffer.h"
+#include "Meshlet.h"
+#include "Renderer.h"
+
+// Буфер видимости для перешейдинга: при полной отрисовке для каждого пикселя
+// запоминаются видимая грань, барицентрические координаты и глубина.
+// Пока камера, модель, размер кадра и отсечение те же, новый свет, материал
+// или даже другой шейдер применяются одним проходом по пикселям без
+// трансформации и растеризации геометрии. Только непрозрачная геометрия
+class RelightCache {
+public:
+    RelightCache();
+
+    // Буфер видимости снят для этой модели, камеры, кадра и настроек отсечения
+    bool valid(Model* model, const Camera& camera, const Framebuffer& fb, const RenderOptions& options) const;
+    void invalidate() { valid_ = false; }
+
+    // Полная отрисовка кластерами с записью буфера видимости
+    void render(const MeshletMesh& mesh, Model* model, const Camera& camera, IShader& shader, Framebuffer& fb,
+                const RenderOptions& options);
+
+    // Перешейдинг из буфера видимости: кадр очищается, цвет пишется заново,
+    // глубина восстанавливается из буфера. Шейдер должен быть настроен на ту же модель и камеру
+    void reshade(IShader& shader, Framebuffer& fb, int threads = 0, FrameArena* arena = NULL) const;
+
+    // reshade(), если кэш действителен, иначе render(); true — обошлось перешейдингом
+    bool draw(const MeshletMesh& mesh, Model* model, const Camera& camera, IShader& shader, Framebuffer& fb,
+              const RenderOptions& options);
+
+    size_t visible_pixels() const;
+
+    // Пиксель буфера видимости; face = -1 — фон
+    struct Sample {
+        int face;
+        Vec3f bar;
+        float depth;
+    };
+
+private:
+    std::vector<Sample> samples_;
+    bool valid_;
+    const Model* model_;
+    int nfaces_;
+    int width_;
+    int height_;
+    Matrix view_;
+    Matrix projection_;
+    float clip_plane_;
+    bool cull_backfaces_;
+};
+
+#endif
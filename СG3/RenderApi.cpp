@@ -0,0 +1,289 @@
+﻿#include <cstring>
+#include <limits>
+#include <memory>
+#include <new>
+#include <string>
+#include "RenderApi.h"
+#include "model.h"
+#include "Arena.h"
+#include "Camera.h"
+#include "Framebuffer.h"
+#include "Meshlet.h"
+#include "Renderer.h"
+#include "ShaderFactory.h"
+#include "BRDFLut.h"
+
+struct cg3_mesh {
+    std::unique_ptr<Model> model;
+    MeshletMesh meshlets;
+};
+
+struct cg3_renderer {
+    Framebuffer framebuffer;
+    Vec3f eye;
+    Vec3f center;
+    Vec3f up;
+    float fov;
+    float near_plane;
+    float far_plane;
+    Vec3f light_dir;
+    std::string shader;
+    RenderOptions options;
+    FrameArena arena; // шейдер и временные данные кадра, сброс в начале cg3_render
+
+    cg3_renderer(int width, int height)
+        : framebuffer(width, height), eye(1, 0, 1), center(0, 0, 0), up(0, 1, 0),
+          fov(0.f), near_plane(0.1f), far_plane(10.f), light_dir(Vec3f(1, 1, 1).normalize()), shader("simple") {
+        options.arena = &arena;
+    }
+};
+
+namespace {
+    struct ArenaDeleter {
+        void operator()(IShader* shader) const { FrameArena::destroy(shader); }
+    };
+
+    bool valid_vector(const float* v) {
+        return v && v[0] * v[0] + v[1] * v[1] + v[2] * v[2] > 0.f;
+    }
+
+    bool known_shader(const char* name) {
+        for (int i = 0; i < SHADER_COUNT; i++) {
+            if (!strcmp(name, SHADER_NAMES[i])) return true;
+        }
+        return false;
+    }
+
+    int pixel_size(int format) {
+        switch (format) {
+        case CG3_RGB8:
+        case CG3_BGR8:
+            return 3;
+        case CG3_RGBA8:
+        case CG3_BGRA8:
+            return 4;
+        default:
+            return 0;
+        }
+    }
+
+    // Кадр framebuffer'а (BGR, первая строка нижняя) в буфер вызывающего
+    void copy_color(cg3_renderer& r, unsigned char* pixels, size_t stride, int format) {
+        Framebuffer& fb = r.framebuffer;
+        const int width = fb.get_width();
+        const int height = fb.get_height();
+        const int bpp = pixel_size(format);
+        const bool swap_rb = format == CG3_RGB8 || format == CG3_RGBA8;
+        const float background = -std::numeric_limits<float>::max();
+        const float* depth = fb.depth();
+        const unsigned char* src = fb.color().buffer();
+        for (int y = 0; y < height; y++) {
+            int row = height - 1 - y;
+            const unsigned char* s = src + static_cast<size_t>(row) * width * 3;
+            const float* z = depth + static_cast<size_t>(row) * width;
+            unsigned char* d = pixels + stride * y;
+            for (int x = 0; x < width; x++, s += 3, d += bpp) {
+                d[0] = swap_rb ? s[2] : s[0];
+                d[1] = s[1];
+                d[2] = swap_rb ? s[0] : s[2];
+                if (bpp == 4) d[3] = z[x] > background ? 255 : 0;
+            }
+        }
+    }
+}
+
+const char* cg3_status_string(int status) {
+    switch (status) {
+    case CG3_OK: return "ok";
+    case CG3_INVALID_ARGUMENT: return "invalid argument";
+    case CG3_PARSE_ERROR: return "mesh parse error";
+    case CG3_UNKNOWN_SHADER: return "unknown shader";
+    case CG3_OUT_OF_MEMORY: return "out of memory";
+    default: return "internal error";
+    }
+}
+
+int cg3_mesh_load_obj(const char* data, size_t size, cg3_mesh** mesh) {
+    if (!mesh) return CG3_INVALID_ARGUMENT;
+    *mesh = NULL;
+    if (!data) return CG3_INVALID_ARGUMENT;
+    try {
+        std::unique_ptr<cg3_mesh> m(new cg3_mesh());
+        m->model.reset(new Model(data, size));
+        if (m->model->nfaces() == 0) return CG3_PARSE_ERROR;
+        m->meshlets.build(*m->model);
+        *mesh = m.release();
+        return CG3_OK;
+    }
+    catch (const std::bad_alloc&) {
+        return CG3_OUT_OF_MEMORY;
+    }
+    catch (...) {
+        // std::stoi на испорченных индексах граней
+        return CG3_PARSE_ERROR;
+    }
+}
+
+void cg3_mesh_destroy(cg3_mesh* mesh) {
+    delete mesh;
+}
+
+int cg3_mesh_face_count(const cg3_mesh* mesh) {
+    return mesh ? mesh->model->nfaces() : 0;
+}
+
+int cg3_mesh_quantize(cg3_mesh* mesh, float* position_error) {
+    if (!mesh) return CG3_INVALID_ARGUMENT;
+    try {
+        QuantizeStats stats;
+        mesh->model->quantize(&stats);
+        if (position_error) *position_error = stats.position_error;
+        return CG3_OK;
+    }
+    catch (const std::bad_alloc&) {
+        return CG3_OUT_OF_MEMORY;
+    }
+}
+
+int cg3_renderer_create(int width, int height, cg3_renderer** renderer) {
+    if (!renderer) return CG3_INVALID_ARGUMENT;
+    *renderer = NULL;
+    if (width <= 0 || height <= 0) return CG3_INVALID_ARGUMENT;
+    try {
+        *renderer = new cg3_renderer(width, height);
+        return CG3_OK;
+    }
+    catch (const std::bad_alloc&) {
+        return CG3_OUT_OF_MEMORY;
+    }
+    catch (...) {
+        return CG3_INTERNAL_ERROR;
+    }
+}
+
+void cg3_renderer_destroy(cg3_renderer* renderer) {
+    delete renderer;
+}
+
+int cg3_renderer_resize(cg3_renderer* renderer, int width, int height) {
+    if (!renderer || width <= 0 || height <= 0) return CG3_INVALID_ARGUMENT;
+    try {
+        renderer->framebuffer.resize(width, height);
+        return CG3_OK;
+    }
+    catch (const std::bad_alloc&) {
+        return CG3_OUT_OF_MEMORY;
+    }
+}
+
+int cg3_set_camera(cg3_renderer* renderer, const float eye[3], const float center[3], const float up[3]) {
+    if (!renderer || !eye || !center || !valid_vector(up)) return CG3_INVALID_ARGUMENT;
+    Vec3f e(eye[0], eye[1], eye[2]);
+    Vec3f c(center[0], center[1], center[2]);
+    if ((e - c).norm() <= 0.f) return CG3_INVALID_ARGUMENT;
+    renderer->eye = e;
+    renderer->center = c;
+    renderer->up = Vec3f(up[0], up[1], up[2]);
+    return CG3_OK;
+}
+
+int cg3_set_perspective(cg3_renderer* renderer, float fov_deg, float near_plane, float far_plane) {
+    if (!renderer || fov_deg < 0.f || fov_deg >= 180.f) return CG3_INVALID_ARGUMENT;
+    if (fov_deg > 0.f && !(near_plane > 0.f && far_plane > near_plane)) return CG3_INVALID_ARGUMENT;
+    renderer->fov = fov_deg;
+    renderer->near_plane = near_plane;
+    renderer->far_plane = far_plane;
+    return CG3_OK;
+}
+
+int cg3_set_light(cg3_renderer* renderer, const float direction[3]) {
+    if (!renderer || !valid_vector(direction)) return CG3_INVALID_ARGUMENT;
+    renderer->light_dir = Vec3f(direction[0], direction[1], direction[2]).normalize();
+    return CG3_OK;
+}
+
+int cg3_set_shader(cg3_renderer* renderer, const char* name) {
+    if (!renderer || !name) return CG3_INVALID_ARGUMENT;
+    if (!known_shader(name)) return CG3_UNKNOWN_SHADER;
+    try {
+        // Библиотека не пишет файлов: если таблицы PBR еще не построены, то только в памяти
+        if (!strcmp(name, "pbr")) {
+            BRDFLut::set_cache_path(NULL);
+            BRDFLut::instance();
+        }
+        renderer->shader = name;
+        return CG3_OK;
+    }
+    catch (const std::bad_alloc&) {
+        return CG3_OUT_OF_MEMORY;
+    }
+}
+
+int cg3_set_threads(cg3_renderer* renderer, int threads) {
+    if (!renderer || threads < 0) return CG3_INVALID_ARGUMENT;
+    renderer->options.threads = threads;
+    return CG3_OK;
+}
+
+int cg3_set_backface_culling(cg3_renderer* renderer, int enable) {
+    if (!renderer) return CG3_INVALID_ARGUMENT;
+    renderer->options.cull_backfaces = enable != 0;
+    return CG3_OK;
+}
+
+int cg3_render(cg3_renderer* renderer, const cg3_mesh* mesh, void* pixels, size_t stride, int format) {
+    if (!renderer || !mesh || !pixels) return CG3_INVALID_ARGUMENT;
+    const int bpp = pixel_size(format);
+    if (bpp == 0) return CG3_INVALID_ARGUMENT;
+    Framebuffer& fb = renderer->framebuffer;
+    const size_t row_bytes = static_cast<size_t>(fb.get_width()) * bpp;
+    if (stride == 0) stride = row_bytes;
+    if (stride < row_bytes) return CG3_INVALID_ARGUMENT;
+
+    try {
+        fb.clear();
+        Camera camera(renderer->eye, renderer->center, renderer->up);
+        if (renderer->fov > 0.f) {
+            camera.set_perspective(renderer->fov, float(fb.get_width()) / fb.get_height(),
+                                   renderer->near_plane, renderer->far_plane);
+        }
+        renderer->arena.reset();
+        std::unique_ptr<IShader, ArenaDeleter> shader(create_shader(renderer->shader.c_str(), mesh->model.get(),
+                                                                    camera, renderer->light_dir, &renderer->arena));
+        if (!shader) return CG3_UNKNOWN_SHADER;
+        draw_meshlets(mesh->meshlets, camera, *shader, fb, renderer->options);
+        copy_color(*renderer, static_cast<unsigned char*>(pixels), stride, format);
+        return CG3_OK;
+    }
+    catch (const std::bad_alloc&) {
+        return CG3_OUT_OF_MEMORY;
+    }
+    catch (...) {
+        return CG3_INTERNAL_ERROR;
+    }
+}
+
+int cg3_read_depth(const cg3_renderer* renderer, float* depth, size_t stride) {
+    if (!renderer || !depth) return CG3_INVALID_ARGUMENT;
+    const Framebuffer& fb = renderer->framebuffer;
+    const int width = fb.get_width();
+    const int height = fb.get_height();
+    if (stride == 0) stride = width;
+    if (stride < static_cast<size_t>(width)) return CG3_INVALID_ARGUMENT;
+    for (int y = 0; y < height; y++) {
+        size_t row = static_cast<size_t>(height - 1 - y) * width;
+        float* dst = depth + stride * y;
+        for (int x = 0; x < width; x++) {
+            dst[x] = fb.depth_at(row + x);
+        }
+    }
+    return CG3_OK;
+}
+
+int cg3_depth_at(const cg3_renderer* renderer, int x, int y, float* depth) {
+    if (!renderer || !depth) return CG3_INVALID_ARGUMENT;
+    const Framebuffer& fb = renderer->framebuffer;
+    if (x < 0 || y < 0 || x >= fb.get_width() || y >= fb.get_height()) return CG3_INVALID_ARGUMENT;
+    *depth = fb.depth_at(static_cast<size_t>(fb.get_height() - 1 - y) * fb.get_width() + x);
+    return CG3_OK;
+}
@@ -0,0 +1,146 @@
+﻿#ifndef RENDER_API_H
+#define RENDER_API_H
+
+#include <stddef.h>
+
+// Встраиваемый интерфейс рендера (C, с C++-обертками ниже): сетка загружается
+// из памяти, кадр пишется в буфер вызывающего. Без файлового ввода-вывода
+// и вывода в консоль. Функции возвращают CG3_OK или код ошибки, исключения
+// наружу не выходят. Рендерер нельзя вызывать из нескольких потоков сразу,
+// разные рендереры независимы; сетка после загрузки только читается
+// и может использоваться несколькими рендерерами одновременно. Исключение —
+// cg3_mesh_quantize(): она меняет сетку на месте
+
+#if defined(_WIN32) && defined(CG3_DLL)
+#ifdef CG3_BUILD_DLL
+#define CG3_API __declspec(dllexport)
+#else
+#define CG3_API __declspec(dllimport)
+#endif
+#else
+#define CG3_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct cg3_mesh cg3_mesh;
+typedef struct cg3_renderer cg3_renderer;
+
+typedef enum cg3_status {
+    CG3_OK = 0,
+    CG3_INVALID_ARGUMENT = -1,
+    CG3_PARSE_ERROR = -2,
+    CG3_UNKNOWN_SHADER = -3,
+    CG3_OUT_OF_MEMORY = -4,
+    CG3_INTERNAL_ERROR = -5
+} cg3_status;
+
+// Порядок байтов пикселя в буфере вызывающего. Альфа — покрытие:
+// 255 там, где есть геометрия, 0 на фоне
+typedef enum cg3_pixel_format {
+    CG3_RGB8 = 0,
+    CG3_RGBA8 = 1,
+    CG3_BGR8 = 2,
+    CG3_BGRA8 = 3
+} cg3_pixel_format;
+
+CG3_API const char* cg3_status_string(int status);
+
+// Сетка из текста OBJ (v, vt, vn, f). Кластеры для отрисовки строятся при загрузке
+CG3_API int cg3_mesh_load_obj(const char* data, size_t size, cg3_mesh** mesh);
+CG3_API void cg3_mesh_destroy(cg3_mesh* mesh);
+CG3_API int cg3_mesh_face_count(const cg3_mesh* mesh);
+// Сжатие атрибутов вершин до 16 бит (вдвое меньше памяти). position_error —
+// наибольшая ошибка позиции в единицах модели, можно NULL.
+// Переписывает атрибуты сетки на месте: вызывать до первого cg3_render() с ней,
+// пока никакой рендерер (ни в одном потоке) ее не рисует, — иначе гонка данных
+CG3_API int cg3_mesh_quantize(cg3_mesh* mesh, float* position_error);
+
+// По умолчанию: камера из (1, 0, 1) в начало координат, ортография,
+// свет из (1, 1, 1), шейдер "simple", потоков по числу ядер
+CG3_API int cg3_renderer_create(int width, int height, cg3_renderer** renderer);
+CG3_API void cg3_renderer_destroy(cg3_renderer* renderer);
+CG3_API int cg3_renderer_resize(cg3_renderer* renderer, int width, int height);
+
+CG3_API int cg3_set_camera(cg3_renderer* renderer, const float eye[3], const float center[3], const float up[3]);
+// fov_deg = 0 — ортографическая проекция
+CG3_API int cg3_set_perspective(cg3_renderer* renderer, float fov_deg, float near_plane, float far_plane);
+// Направление на источник света
+CG3_API int cg3_set_light(cg3_renderer* renderer, const float direction[3]);
+// "simple", "improved", "smooth" или "pbr"
+CG3_API int cg3_set_shader(cg3_renderer* renderer, const char* name);
+// 0 — по числу ядер
+CG3_API int cg3_set_threads(cg3_renderer* renderer, int threads);
+CG3_API int cg3_set_backface_culling(cg3_renderer* renderer, int enable);
+
+// Рисует сетку и копирует кадр в pixels: первая строка верхняя,
+// stride — байт на строку (0 — плотно упакованные строки)
+CG3_API int cg3_render(cg3_renderer* renderer, const cg3_mesh* mesh, void* pixels, size_t stride, int format);
+
+// Глубина последнего кадра: z/w, больше — ближе, фон — -FLT_MAX.
+// Строки сверху вниз, как в cg3_render; stride — float на строку (0 — width)
+CG3_API int cg3_read_depth(const cg3_renderer* renderer, float* depth, size_t stride);
+CG3_API int cg3_depth_at(const cg3_renderer* renderer, int x, int y, float* depth);
+
+#ifdef __cplusplus
+}
+
+namespace cg3 {
+    class Mesh {
+    public:
+        Mesh() : handle_(NULL) {}
+        ~Mesh() { cg3_mesh_destroy(handle_); }
+
+        int load_obj(const char* data, size_t size) {
+            cg3_mesh_destroy(handle_);
+            handle_ = NULL;
+            return cg3_mesh_load_obj(data, size, &handle_);
+        }
+
+        int face_count() const { return handle_ ? cg3_mesh_face_count(handle_) : 0; }
+        const cg3_mesh* handle() const { return handle_; }
+
+    private:
+        cg3_mesh* handle_;
+
+        Mesh(const Mesh&);
+        Mesh& operator=(const Mesh&);
+    };
+
+    class Renderer {
+    public:
+        Renderer(int width, int height) : handle_(NULL) { cg3_renderer_create(width, height, &handle_); }
+        ~Renderer() { cg3_renderer_destroy(handle_); }
+
+        bool valid() const { return handle_ != NULL; }
+
+        int resize(int width, int height) { return cg3_renderer_resize(handle_, width, height); }
+        int set_camera(const float eye[3], const float center[3], const float up[3]) {
+            return cg3_set_camera(handle_, eye, center, up);
+        }
+        int set_perspective(float fov_deg, float near_plane, float far_plane) {
+            return cg3_set_perspective(handle_, fov_deg, near_plane, far_plane);
+        }
+        int set_light(const float direction[3]) { return cg3_set_light(handle_, direction); }
+        int set_shader(const char* name) { return cg3_set_shader(handle_, name); }
+        int set_threads(int threads) { return cg3_set_threads(handle_, threads); }
+        int set_backface_culling(bool enable) { return cg3_set_backface_culling(handle_, enable ? 1 : 0); }
+
+        int render(const Mesh& mesh, void* pixels, size_t stride = 0, cg3_pixel_format format = CG3_RGBA8) {
+            return cg3_render(handle_, mesh.handle(), pixels, stride, format);
+        }
+        int read_depth(float* depth, size_t stride = 0) const { return cg3_read_depth(handle_, depth, stride); }
+        int depth_at(int x, int y, float* depth) const { return cg3_depth_at(handle_, x, y, depth); }
+
+    private:
+        cg3_renderer* handle_;
+
+        Renderer(const Renderer&);
+        Renderer& operator=(const Renderer&);
+    };
+}
+#endif
+
+#endif
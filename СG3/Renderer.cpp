@@ -0,0 +1,652 @@
+﻿#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include "Arena.h"
+#include "Renderer.h"
+#include "Transparency.h"
+#include "Trace.h"
+#include "WorkerPool.h"
+
+Vec3f barycentric(Vec2f A, Vec2f B, Vec2f C, Vec2f P) {
+    Vec3f s[2];
+    for (int i = 2; i--; ) {
+        s[i][0] = C[i] - A[i];
+        s[i][1] = B[i] - A[i];
+        s[i][2] = A[i] - P[i];
+    }
+    Vec3f u = cross(s[0], s[1]);
+    if (std::abs(u[2]) > 1e-2)
+        return Vec3f(1.f - (u.x + u.y) / u.z, u.y / u.z, u.x / u.z);
+    return Vec3f(-1, 1, 1);
+}
+
+namespace {
+
+// Вершина при отсечении: клип-координаты и барицентрические координаты
+// относительно исходного треугольника (по ним шейдер интерполирует varying)
+struct ClipVertex {
+    Vec4f clip;
+    Vec3f bar;
+};
+
+// Минимальное w, ближе к камере геометрия отсекается
+const float W_EPSILON = 1e-5f;
+
+// Первый узел подрешетки (x0 + i * step) не левее пикселя кадра lo
+int lattice_first(int lo, int x0, int step) {
+    int d = lo - x0;
+    return d >= 0 ? (d + step - 1) / step : -(-d / step);
+}
+
+// Последний узел подрешетки не правее пикселя кадра hi
+int lattice_last(int hi, int x0, int step) {
+    int d = hi - x0;
+    return d >= 0 ? d / step : -((-d + step - 1) / step);
+}
+
+// Отсекает многоугольник плоскостью w = W_EPSILON, возвращает число вершин
+int clip_near(const ClipVertex* in, int n, ClipVertex* out) {
+    int count = 0;
+    for (int i = 0; i < n; i++) {
+        const ClipVertex& a = in[i];
+        const ClipVertex& b = in[(i + 1) % n];
+        float da = a.clip.w - W_EPSILON;
+        float db = b.clip.w - W_EPSILON;
+        if (da >= 0) out[count++] = a;
+        if ((da >= 0) != (db >= 0)) {
+            float t = da / (da - db);
+            out[count].clip = a.clip + (b.clip - a.clip) * t;
+            out[count].bar = a.bar + (b.bar - a.bar) * t;
+            count++;
+        }
+    }
+    return count;
+}
+
+// Растеризация треугольника, целиком лежащего перед камерой (w > 0).
+// bar_map переводит барицентрические координаты подтреугольника в исходные
+// (NULL, если треугольник не отсекался). D — формат z-буфера,
+// STATS — считать ли пиксели (счетчики копятся в регистрах и пишутся в конце)
+template <class D, bool STATS>
+void rasterize(const ClipVertex* v, const mat<3, 3, float>* bar_map, IShader& shader, Framebuffer& fb,
+               float clip_plane, int ymin, int ymax, PipelineStats* stats) {
+    const Matrix& viewport_mat = fb.viewport();
+    TGAImage& image = fb.color();
+    void* zbuffer = fb.depth_data();
+    const float depth_scale = fb.depth_scale();
+    const float depth_bias = fb.depth_bias();
+
+    // Установка треугольника: экранные координаты, глубина z/w и 1/w вершин
+    mat<3, 2, float> pts2;
+    Vec3f depth;
+    Vec3f inv_w;
+    bool perspective = false;
+    for (int i = 0; i < 3; i++) {
+        Vec4f transformed = viewport_mat * v[i].clip;
+        pts2[i] = Vec2f(transformed[0] / transformed[3], transformed[1] / transformed[3]);
+        inv_w[i] = 1.f / v[i].clip.w;
+        depth[i] = v[i].clip.z * inv_w[i];
+        perspective = perspective || v[i].clip.w != 1.f;
+    }
+
+    Vec2f bboxmin(std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
+    Vec2f bboxmax(-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max());
+    Vec2f clamp(fb.frame_width() - 1, fb.frame_height() - 1);
+
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 2; j++) {
+            bboxmin[j] = std::max(0.f, std::min(bboxmin[j], pts2[i][j]));
+            bboxmax[j] = std::min(clamp[j], std::max(bboxmax[j], pts2[i][j]));
+        }
+    }
+    // Пиксели кадра в bbox -> пиксели буфера. У подрешетки берутся только ее узлы,
+    // покрытие проверяется в тех же точках кадра, что и при полной отрисовке.
+    // ymin, ymax — полоса строк буфера, которую обрабатывает текущий поток
+    const int step = fb.lattice_step();
+    const int x0 = fb.lattice_x0();
+    const int y0 = fb.lattice_y0();
+    const int imin = lattice_first(static_cast<int>(std::min(bboxmin.x, clamp.x + 1.f)), x0, step);
+    const int imax = lattice_last(static_cast<int>(std::floor(std::max(bboxmax.x, -1.f))), x0, step);
+    const int jmin = std::max(ymin, lattice_first(static_cast<int>(std::min(bboxmin.y, clamp.y + 1.f)), y0, step));
+    const int jmax = std::min(ymax - 1, lattice_last(static_cast<int>(std::floor(std::max(bboxmax.y, -1.f))), y0, step));
+
+    const bool hdr = fb.hdr_enabled();
+    TransparencyBuffer* oit = fb.transparency();
+    Vec2i L; // пиксель буфера
+    Vec2i P; // он же в кадре
+    TGAColor color;
+    Vec4f linear_color;
+    uint64_t tested = 0, passed = 0, failed = 0, shaded = 0, discarded = 0;
+    for (L.x = imin; L.x <= imax; L.x++) {
+        P.x = x0 + L.x * step;
+        for (L.y = jmin; L.y <= jmax; L.y++) {
+            P.y = y0 + L.y * step;
+            Vec3f bc_screen = barycentric(pts2[0], pts2[1], pts2[2], Vec2f(P.x, P.y));
+            if (STATS) tested++;
+
+            if (bc_screen.x < 0 || bc_screen.y < 0 || bc_screen.z < 0) continue;
+            
+            // z/w линейна в экранном пространстве
+            float frag_depth = 0;
+            for (int k = 0; k < 3; k++) {
+                frag_depth += bc_screen[k] * depth[k];
+            }
+
+            // bbox уже обрезан по размерам framebuffer'а
+            int idx = L.x + L.y * fb.get_width();
+
+            if (frag_depth > clip_plane) { 
+                if (STATS) failed++;
+                continue; 
+            }
+
+            typename D::type z = D::encode(frag_depth, depth_scale, depth_bias);
+            const bool visible = D::load(zbuffer, idx) < z;
+            if (STATS) {
+                if (visible) passed++;
+                else failed++;
+            }
+            if (visible) {
+                if (STATS) shaded++;
+                // Перспективно-корректные координаты: интерполируем bc/w,
+                // на пиксель одно деление
+                Vec3f bar = bc_screen;
+                if (perspective) {
+                    Vec3f bw(bc_screen.x * inv_w.x, bc_screen.y * inv_w.y, bc_screen.z * inv_w.z);
+                    float norm = 1.f / (bw.x + bw.y + bw.z);
+                    bar = bw * norm;
+                }
+                if (bar_map) {
+                    bar = (*bar_map) * bar;
+                }
+
+                shader.gl_FragCoord = Vec3f(static_cast<float>(P.x), static_cast<float>(P.y), frag_depth);
+                if (oit) {
+                    // Прозрачность известна только после шейдинга: полупрозрачные
+                    // фрагменты уходят в списки и не пишут глубину
+                    if (shader.fragment_linear(bar, linear_color)) {
+                        if (STATS) discarded++;
+                        continue;
+                    }
+                    if (linear_color.w < 1.f) {
+                        if (!oit->append(idx, linear_color, frag_depth)) {
+                            // Арена заполнена: в слой переполнения, он сведется вместе со списком
+                            oit->append_overflow(idx, linear_color, frag_depth);
+                        }
+                        continue;
+                    }
+                    D::store(zbuffer, idx, z);
+                    if (hdr) fb.blend_hdr(idx, linear_color);
+                    else image.set(L.x, L.y, quantize_color(linear_color));
+                    continue;
+                }
+                D::store(zbuffer, idx, z);
+                if (hdr) {
+                    // В HDR-режиме цвет остается линейным до resolve_hdr()
+                    if (!shader.fragment_linear(bar, linear_color)) {
+                        fb.blend_hdr(idx, linear_color);
+                    }
+                    else if (STATS) discarded++;
+                    continue;
+                }
+                bool discard = shader.fragment(bar, color);
+                if (!discard) {
+                    image.set(L.x, L.y, color);
+                }
+                else if (STATS) discarded++;
+            }
+        
+        }
+    }
+    if (STATS) {
+        stats->pixels_tested += tested;
+        stats->depth_passed += passed;
+        stats->depth_failed += failed;
+        stats->fragments_shaded += shaded;
+        stats->fragments_discarded += discarded;
+    }
+}
+
+template <class D>
+void rasterize(const ClipVertex* v, const mat<3, 3, float>* bar_map, IShader& shader, Framebuffer& fb,
+               float clip_plane, int ymin, int ymax, PipelineStats* stats) {
+    if (stats) rasterize<D, true>(v, bar_map, shader, fb, clip_plane, ymin, ymax, stats);
+    else rasterize<D, false>(v, bar_map, shader, fb, clip_plane, ymin, ymax, NULL);
+}
+
+void rasterize(const ClipVertex* v, const mat<3, 3, float>* bar_map, IShader& shader, Framebuffer& fb,
+               float clip_plane, int ymin, int ymax, PipelineStats* stats) {
+    switch (fb.depth_format()) {
+    case DEPTH_UNORM24:
+        rasterize<DepthUnorm24Traits>(v, bar_map, shader, fb, clip_plane, ymin, ymax, stats);
+        break;
+    case DEPTH_UNORM16:
+        rasterize<DepthUnorm16Traits>(v, bar_map, shader, fb, clip_plane, ymin, ymax, stats);
+        break;
+    default:
+        rasterize<DepthFloatTraits>(v, bar_map, shader, fb, clip_plane, ymin, ymax, stats);
+        break;
+    }
+}
+
+// Учет треугольника в счетчиках: отсечен целиком, режется плоскостью камеры
+// или идет в растеризацию. Повторяет проверки растеризатора, вызывается только со статистикой
+void count_triangle(const mat<4, 3, float>& clipc, const Framebuffer& fb, float clip_plane, PipelineStats& stats) {
+    stats.triangles_submitted++;
+    int behind = 0;
+    for (int i = 0; i < 3; i++) {
+        if (clipc[3][i] < W_EPSILON) behind++;
+    }
+    if (behind == 3) {
+        stats.triangles_culled++;
+        return;
+    }
+    if (behind > 0) {
+        stats.triangles_clipped++;
+        return;
+    }
+    Vec2f p[3];
+    float zmin = std::numeric_limits<float>::max();
+    for (int i = 0; i < 3; i++) {
+        Vec4f s = fb.viewport() * clipc.col(i);
+        p[i] = Vec2f(s[0] / s[3], s[1] / s[3]);
+        zmin = std::min(zmin, clipc[2][i] / clipc[3][i]);
+    }
+    float area2 = (p[2].x - p[0].x) * (p[1].y - p[0].y) - (p[2].y - p[0].y) * (p[1].x - p[0].x);
+    float xmin = std::min(p[0].x, std::min(p[1].x, p[2].x));
+    float xmax = std::max(p[0].x, std::max(p[1].x, p[2].x));
+    float ymin = std::min(p[0].y, std::min(p[1].y, p[2].y));
+    float ymax = std::max(p[0].y, std::max(p[1].y, p[2].y));
+    bool offscreen = xmax < 0.f || ymax < 0.f || xmin > fb.frame_width() - 1 || ymin > fb.frame_height() - 1;
+    if (std::abs(area2) <= 1e-2f || offscreen || zmin > clip_plane) {
+        stats.triangles_culled++;
+    }
+}
+
+}
+
+void triangle(mat<4, 3, float>& clipc, IShader& shader, Framebuffer& fb, float clip_plane, int ymin, int ymax,
+              PipelineStats* stats) {
+    ClipVertex v[3];
+    bool needs_clip = false;
+    for (int i = 0; i < 3; i++) {
+        v[i].clip = clipc.col(i);
+        v[i].bar = Vec3f(i == 0, i == 1, i == 2);
+        needs_clip = needs_clip || v[i].clip.w < W_EPSILON;
+    }
+    if (!needs_clip) {
+        rasterize(v, NULL, shader, fb, clip_plane, ymin, ymax, stats);
+        return;
+    }
+
+    // Треугольник пересекает плоскость камеры: отсекаем и режем веером
+    ClipVertex poly[4];
+    int n = clip_near(v, 3, poly);
+    for (int i = 1; i + 1 < n; i++) {
+        ClipVertex sub[3] = { poly[0], poly[i], poly[i + 1] };
+        mat<3, 3, float> bar_map;
+        for (int k = 0; k < 3; k++) {
+            bar_map.set_col(k, sub[k].bar);
+        }
+        rasterize(sub, &bar_map, shader, fb, clip_plane, ymin, ymax, stats);
+    }
+}
+
+
+void draw_model(Model& model, IShader& shader, Framebuffer& fb, float clip_plane, PipelineStats* stats) {
+    TRACE_SCOPE("draw_model");
+    for (int i = 0; i < model.nfaces(); i++) {
+        mat<4, 3, float> screen_coords;
+        uint64_t start = stats ? PipelineStats::now_ns() : 0;
+        for (int j = 0; j < 3; j++) {
+            screen_coords.set_col(j, shader.vertex(i, j));
+        }
+        if (stats) {
+            uint64_t vertex_end = PipelineStats::now_ns();
+            stats->vertex_ns += vertex_end - start;
+            count_triangle(screen_coords, fb, clip_plane, *stats);
+            triangle(screen_coords, shader, fb, clip_plane, 0, INT_MAX, stats);
+            stats->raster_ns += PipelineStats::now_ns() - vertex_end;
+            continue;
+        }
+        triangle(screen_coords, shader, fb, clip_plane);
+    }
+}
+
+namespace {
+
+// Строки кадра, которые может задеть кластер; visible = false — кластер отсечен
+struct MeshletBounds {
+    int ymin;
+    int ymax;
+    bool visible;
+};
+
+// Кластер целиком обращен от камеры: все нормали в конусе смотрят от зрителя
+bool backfacing(const Meshlet& m, const Camera& camera) {
+    if (m.cone_cos <= 0.f) return false;
+    Vec3f to_viewer;
+    float sin_a = 0.f;
+    float cos_a = 1.f;
+    if (camera.is_perspective()) {
+        // Для перспективы расширяем конус на угловой размер сферы кластера
+        to_viewer = camera.get_eye() - m.center;
+        float dist = to_viewer.norm();
+        if (dist <= m.radius) return false;
+        to_viewer = to_viewer / dist;
+        sin_a = m.radius / dist;
+        cos_a = std::sqrt(1.f - sin_a * sin_a);
+    }
+    else {
+        to_viewer = (camera.get_eye() - camera.get_center()).normalize();
+    }
+    float cos_t = m.cone_cos;
+    float sin_t = std::sqrt(std::max(0.f, 1.f - cos_t * cos_t));
+    // Граница: угол между осью и направлением на зрителя больше 90 + theta + alpha
+    float cos_sum = cos_t * cos_a - sin_t * sin_a;
+    if (cos_sum <= 0.f) return false;
+    float sin_sum = sin_t * cos_a + cos_t * sin_a;
+    return m.cone_axis * to_viewer < -sin_sum;
+}
+
+// Вершинная стадия кластера: каждая вершина шейдится один раз, клип-координаты,
+// экранные координаты (x, y, z/w; для w > 0) и varying ложатся в кэш кадра.
+// Возвращает строки буфера, которые задевает кластер
+MeshletBounds shade_meshlet(const MeshletMesh& mesh, const Meshlet& m, IShader& shader, const Camera& camera,
+                            const Framebuffer& fb, const RenderOptions& options, Vec4f* clip, Vec3f* screen,
+                            float* varyings, int varying_size) {
+    MeshletBounds b;
+    b.visible = false;
+    b.ymin = 0;
+    b.ymax = fb.get_height();
+    if (options.cull_backfaces && backfacing(m, camera)) return b;
+
+    for (int i = 0; i < m.vertex_count; i++) {
+        int v = m.vertex_offset + i;
+        int corner = mesh.corners[v];
+        clip[v] = shader.vertex_varying(corner / 3, corner % 3, varyings + static_cast<size_t>(v) * varying_size);
+    }
+
+    float xmin = std::numeric_limits<float>::max(), ymin = xmin, zmin = xmin;
+    float xmax = -xmin, ymax = -xmin;
+    bool crosses_camera = false;
+    for (int i = 0; i < m.vertex_count; i++) {
+        const Vec4f& c = clip[m.vertex_offset + i];
+        if (c.w < W_EPSILON) {
+            // Кластер пересекает плоскость камеры, его треугольники отсечет triangle()
+            crosses_camera = true;
+            continue;
+        }
+        Vec4f p = fb.viewport() * c;
+        Vec3f& sp = screen[m.vertex_offset + i];
+        sp = Vec3f(p.x / p.w, p.y / p.w, c.z / c.w);
+        xmin = std::min(xmin, sp.x); xmax = std::max(xmax, sp.x);
+        ymin = std::min(ymin, sp.y); ymax = std::max(ymax, sp.y);
+        zmin = std::min(zmin, sp.z);
+    }
+    if (crosses_camera) {
+        b.visible = true;
+        return b;
+    }
+    if (xmax < 0.f || ymax < 0.f || xmin > fb.frame_width() - 1 || ymin > fb.frame_height() - 1) return b;
+    if (zmin > options.clip_plane) return b;
+
+    b.visible = true;
+    const int row_max = static_cast<int>(std::ceil(std::min(ymax, static_cast<float>(fb.frame_height()))));
+    b.ymin = std::max(0, lattice_first(static_cast<int>(std::floor(ymin)), fb.lattice_y0(), fb.lattice_step()));
+    b.ymax = std::min(fb.get_height(), lattice_last(row_max, fb.lattice_y0(), fb.lattice_step()) + 1);
+    return b;
+}
+
+// Треугольник в списке полосы: номер в MeshletMesh::faces и начало вершин его кластера
+struct BinnedTriangle {
+    int triangle;
+    int vertex_base;
+};
+
+void gather_clip(const MeshletMesh& mesh, const Vec4f* clip, const BinnedTriangle& t, mat<4, 3, float>& clipc) {
+    const unsigned char* local = &mesh.triangles[t.triangle * 3];
+    for (int j = 0; j < 3; j++) {
+        clipc.set_col(j, clip[t.vertex_base + local[j]]);
+    }
+}
+
+// Полосы [band0, band1], которые задевает треугольник; false — пикселей у него не будет
+bool triangle_bands(const MeshletMesh& mesh, const Vec4f* clip, const Vec3f* screen, const BinnedTriangle& t,
+                    const Framebuffer& fb, float clip_plane, int band_height, int nbands, int& band0, int& band1) {
+    const unsigned char* local = &mesh.triangles[t.triangle * 3];
+    float ymin = std::numeric_limits<float>::max(), ymax = -ymin, xmin = ymin, xmax = -ymin, zmin = ymin;
+    for (int j = 0; j < 3; j++) {
+        int v = t.vertex_base + local[j];
+        if (clip[v].w < W_EPSILON) {
+            // Режется плоскостью камеры: границы узнает только triangle()
+            band0 = 0;
+            band1 = nbands - 1;
+            return true;
+        }
+        const Vec3f& p = screen[v];
+        xmin = std::min(xmin, p.x); xmax = std::max(xmax, p.x);
+        ymin = std::min(ymin, p.y); ymax = std::max(ymax, p.y);
+        zmin = std::min(zmin, p.z);
+    }
+    if (xmax < 0.f || ymax < 0.f || xmin > fb.frame_width() - 1 || ymin > fb.frame_height() - 1) return false;
+    if (zmin > clip_plane) return false;
+    // Строки кадра -> строки буфера (у подрешетки — ее узлы)
+    const int row_max = static_cast<int>(std::ceil(std::min(ymax, static_cast<float>(fb.frame_height()))));
+    const int row0 = std::max(0, lattice_first(static_cast<int>(std::floor(ymin)), fb.lattice_y0(), fb.lattice_step()));
+    const int row1 = std::min(fb.get_height() - 1, lattice_last(row_max, fb.lattice_y0(), fb.lattice_step()));
+    if (row0 > row1) return false;
+    band0 = row0 / band_height;
+    band1 = std::min(nbands - 1, row1 / band_height);
+    return band0 <= band1;
+}
+
+// Растеризация списка треугольников полосы [y0, y1) из кэша вершин
+template <bool STATS>
+void draw_band(const MeshletMesh& mesh, const BinnedTriangle* list, int count, const Vec4f* clip,
+               const float* varyings, int varying_size, IShader& shader, Framebuffer& fb, float clip_plane,
+               int y0, int y1, PipelineStats* stats) {
+    mat<4, 3, float> clipc;
+    const float* corner_varyings[3];
+    for (int i = 0; i < count; i++) {
+        const BinnedTriangle& t = list[i];
+        const unsigned char* local = &mesh.triangles[t.triangle * 3];
+        for (int j = 0; j < 3; j++) {
+            int v = t.vertex_base + local[j];
+            clipc.set_col(j, clip[v]);
+            corner_varyings[j] = varyings + static_cast<size_t>(v) * varying_size;
+        }
+        shader.load_varyings(mesh.faces[t.triangle], corner_varyings);
+        if (STATS) triangle(clipc, shader, fb, clip_plane, y0, y1, stats);
+        else triangle(clipc, shader, fb, clip_plane, y0, y1);
+    }
+}
+
+// Выполняет fn(thread_index) на threads потоках пула, нулевой — на текущем
+template <class F>
+void run_parallel(int threads, F fn) {
+    WorkerPool::instance().run(threads, fn);
+}
+
+}
+
+void draw_meshlets(const MeshletMesh& mesh, const Camera& camera, IShader& shader, Framebuffer& fb,
+                   const RenderOptions& options) {
+    int threads = options.threads > 0 ? options.threads : static_cast<int>(std::thread::hardware_concurrency());
+    threads = std::max(1, std::min(threads, fb.get_height()));
+
+    // У каждого потока своя копия шейдера: varying-переменные пишутся в vertex()
+    TRACE_SCOPE("draw_meshlets");
+    // Копии живут в под-аренах потоков, если арену передали и шейдер это умеет
+    FrameArena* arena = options.arena;
+    ScratchArray<IShader*> shaders(arena, threads);
+    ScratchArray<unsigned char> in_arena(arena, threads);
+    shaders[0] = &shader;
+    int nshaders = 1;
+    for (; nshaders < threads; nshaders++) {
+        IShader* copy = arena ? shader.clone_in(arena->thread_arena(nshaders)) : NULL;
+        in_arena[nshaders] = copy != NULL;
+        if (!copy) copy = shader.clone();
+        if (!copy) break;
+        shaders[nshaders] = copy;
+    }
+    threads = nshaders;
+
+    const int height = fb.get_height();
+    const int nmeshlets = mesh.nmeshlets();
+    const int varying_size = shader.varying_size();
+
+    // Счетчики потоков складываются после join; поток пишет свою ячейку один раз в конце
+    ScratchArray<PipelineStats> thread_stats(arena, options.stats ? threads : 0);
+
+    // 1. Вершинная стадия и отсечение по кластерам (параллельно по кластерам).
+    // Выходы вершин кэшируются на кадр: растеризация их только читает
+    ScratchArray<Vec4f> clip(arena, mesh.vertices.size());
+    ScratchArray<Vec3f> screen(arena, mesh.vertices.size());
+    ScratchArray<float> varyings(arena, mesh.vertices.size() * varying_size);
+    ScratchArray<MeshletBounds> bounds(arena, nmeshlets);
+    int per_thread = (nmeshlets + threads - 1) / threads;
+    run_parallel(threads, [&](int t) {
+        int begin = std::min(nmeshlets, t * per_thread);
+        int end = std::min(nmeshlets, begin + per_thread);
+        TRACE_SCOPE("vertex");
+        uint64_t start = options.stats ? PipelineStats::now_ns() : 0;
+        for (int i = begin; i < end; i++) {
+            bounds[i] = shade_meshlet(mesh, mesh.meshlets[i], *shaders[t], camera, fb, options, clip.data(),
+                                      screen.data(), varyings.data(), varying_size);
+        }
+        if (options.stats) {
+            PipelineStats local;
+            for (int i = begin; i < end; i++) {
+                if (bounds[i].visible) continue;
+                local.meshlets_culled++;
+                local.triangles_submitted += mesh.meshlets[i].triangle_count;
+                local.triangles_culled += mesh.meshlets[i].triangle_count;
+            }
+            local.vertex_ns = PipelineStats::now_ns() - start;
+            thread_stats[t] = local;
+        }
+    });
+
+    // 2. Раскладка треугольников по полосам кадра: подсчет, смещения, заполнение.
+    // Поток берет свои кластеры подряд, списки полосы идут по потокам, поэтому
+    // порядок треугольников в полосе — исходный порядок граней
+    int nbands = threads == 1 ? 1 : threads * 4;
+    int band_height = (height + nbands - 1) / nbands;
+    nbands = (height + band_height - 1) / band_height;
+    ScratchArray<int> counts(arena, static_cast<size_t>(threads) * nbands);
+    run_parallel(threads, [&](int t) {
+        int begin = std::min(nmeshlets, t * per_thread);
+        int end = std::min(nmeshlets, begin + per_thread);
+        TRACE_SCOPE("binning");
+        uint64_t start = options.stats ? PipelineStats::now_ns() : 0;
+        int* count = &counts[static_cast<size_t>(t) * nbands];
+        mat<4, 3, float> clipc;
+        for (int i = begin; i < end; i++) {
+            if (!bounds[i].visible) continue;
+            const Meshlet& m = mesh.meshlets[i];
+            for (int k = 0; k < m.triangle_count; k++) {
+                BinnedTriangle tri = { m.triangle_offset + k, m.vertex_offset };
+                if (options.stats) {
+                    gather_clip(mesh, clip.data(), tri, clipc);
+                    count_triangle(clipc, fb, options.clip_plane, thread_stats[t]);
+                }
+                int band0, band1;
+                if (!triangle_bands(mesh, clip.data(), screen.data(), tri, fb, options.clip_plane, band_height,
+                                    nbands, band0, band1)) {
+                    continue;
+                }
+                for (int band = band0; band <= band1; band++) {
+                    count[band]++;
+                }
+            }
+        }
+        if (options.stats) thread_stats[t].bin_ns += PipelineStats::now_ns() - start;
+    });
+    ScratchArray<int> offsets(arena, static_cast<size_t>(threads) * nbands);
+    ScratchArray<int> band_begin(arena, nbands + 1);
+    int total = 0;
+    for (int band = 0; band < nbands; band++) {
+        band_begin[band] = total;
+        for (int t = 0; t < threads; t++) {
+            offsets[static_cast<size_t>(t) * nbands + band] = total;
+            total += counts[static_cast<size_t>(t) * nbands + band];
+        }
+    }
+    band_begin[nbands] = total;
+    ScratchArray<BinnedTriangle> binned(arena, total);
+    run_parallel(threads, [&](int t) {
+        int begin = std::min(nmeshlets, t * per_thread);
+        int end = std::min(nmeshlets, begin + per_thread);
+        TRACE_SCOPE("binning");
+        uint64_t start = options.stats ? PipelineStats::now_ns() : 0;
+        int* fill = &offsets[static_cast<size_t>(t) * nbands];
+        for (int i = begin; i < end; i++) {
+            if (!bounds[i].visible) continue;
+            const Meshlet& m = mesh.meshlets[i];
+            for (int k = 0; k < m.triangle_count; k++) {
+                BinnedTriangle tri = { m.triangle_offset + k, m.vertex_offset };
+                int band0, band1;
+                if (!triangle_bands(mesh, clip.data(), screen.data(), tri, fb, options.clip_plane, band_height,
+                                    nbands, band0, band1)) {
+                    continue;
+                }
+                for (int band = band0; band <= band1; band++) {
+                    binned[fill[band]++] = tri;
+                }
+            }
+        }
+        if (options.stats) thread_stats[t].bin_ns += PipelineStats::now_ns() - start;
+    });
+
+    // 3. Растеризация полос из кэша вершин. Каждый пиксель принадлежит одной полосе,
+    // поэтому результат не зависит от числа потоков
+    std::atomic<int> next_band(0);
+    run_parallel(threads, [&](int t) {
+        IShader& s = *shaders[t];
+        PipelineStats local;
+        for (int band = next_band++; band < nbands; band = next_band++) {
+            int y0 = band * band_height;
+            int y1 = std::min(height, y0 + band_height);
+            const BinnedTriangle* list = binned.data() + band_begin[band];
+            int count = band_begin[band + 1] - band_begin[band];
+            TraceScope scope("rasterize band");
+            if (scope.active()) {
+                PipelineStats stats_band;
+                uint64_t start = PipelineStats::now_ns();
+                draw_band<true>(mesh, list, count, clip.data(), varyings.data(), varying_size, s, fb,
+                                options.clip_plane, y0, y1, &stats_band);
+                stats_band.raster_ns = PipelineStats::now_ns() - start;
+                std::ostringstream args;
+                args << "{\"y0\": " << y0 << ", \"y1\": " << y1 << ", \"triangles\": " << count
+                     << ", \"fragments\": " << stats_band.fragments_shaded << "}";
+                scope.set_args(args.str());
+                local += stats_band;
+            }
+            else if (options.stats) {
+                uint64_t start = PipelineStats::now_ns();
+                draw_band<true>(mesh, list, count, clip.data(), varyings.data(), varying_size, s, fb,
+                                options.clip_plane, y0, y1, &local);
+                local.raster_ns += PipelineStats::now_ns() - start;
+            }
+            else {
+                draw_band<false>(mesh, list, count, clip.data(), varyings.data(), varying_size, s, fb,
+                                 options.clip_plane, y0, y1, NULL);
+            }
+        }
+        if (options.stats) thread_stats[t] += local;
+    });
+
+    if (options.stats) {
+        for (int t = 0; t < threads; t++) {
+            *options.stats += thread_stats[t];
+        }
+    }
+    for (int t = 1; t < threads; t++) {
+        if (in_arena[t]) FrameArena::destroy(shaders[t]);
+        else delete shaders[t];
+    }
+}
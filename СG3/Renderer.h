@@ -0,0 +1,45 @@
+﻿#ifndef RENDERER_H
+#define RENDERER_H
+
+#include <climits>
+#include <limits>
+#include "geometry.h"
+#include "model.h"
+#include "ishader.h"
+#include "Camera.h"
+#include "Framebuffer.h"
+#include "Meshlet.h"
+#include "PipelineStats.h"
+
+Vec3f barycentric(Vec2f A, Vec2f B, Vec2f C, Vec2f P);
+
+// Растеризация треугольника в клип-координатах (столбцы clipc).
+// Фрагменты с глубиной больше clip_plane отбрасываются, [ymin, ymax) — полоса строк.
+// stats != NULL — пиксельные счетчики; без них растеризатор собирается без счетчиков
+void triangle(mat<4, 3, float>& clipc, IShader& shader, Framebuffer& fb, float clip_plane = 0.0f,
+              int ymin = 0, int ymax = INT_MAX, PipelineStats* stats = NULL);
+
+struct RenderOptions {
+    float clip_plane;    // фрагменты с глубиной больше отбрасываются
+    bool cull_backfaces; // отсекать кластеры, целиком обращенные от камеры
+    int threads;         // 0 — по числу ядер
+    PipelineStats* stats; // NULL — без статистики, иначе счетчики прибавляются сюда
+    FrameArena* arena;    // NULL — временные данные в куче, иначе в арене кадра (reset() — у вызывающего)
+
+    RenderOptions()
+        : clip_plane(std::numeric_limits<float>::max()), cull_backfaces(false), threads(0), stats(NULL),
+          arena(NULL) {
+    }
+};
+
+// Последовательный обход всех граней модели
+void draw_model(Model& model, IShader& shader, Framebuffer& fb, float clip_plane, PipelineStats* stats = NULL);
+
+// Отрисовка по кластерам: вершины кластера шейдятся один раз в кэш кадра
+// (IShader::vertex_varying), кластеры отсекаются, треугольники раскладываются
+// по полосам кадра, полосы растеризуются параллельно из кэша.
+// Для нескольких потоков шейдер должен поддерживать clone()
+void draw_meshlets(const MeshletMesh& mesh, const Camera& camera, IShader& shader, Framebuffer& fb,
+                   const RenderOptions& options = RenderOptions());
+
+#endif
@@ -0,0 +1,34 @@
+﻿#include <cstring>
+#include "ShaderFactory.h"
+#include "SimpleShader.h"
+#include "ImprovedShader.h"
+#include "SmoothShader.h"
+#include "PBRShader.h"
+
+const char* const SHADER_NAMES[] = { "simple", "improved", "smooth", "pbr" };
+const int SHADER_COUNT = sizeof(SHADER_NAMES) / sizeof(SHADER_NAMES[0]);
+
+namespace {
+    template <class S>
+    S* setup_shader(S* shader, Model* model, const Camera& camera, const Vec3f& light_dir) {
+        shader->model = model;
+        shader->ModelView = camera.get_view_matrix();
+        shader->Projection = camera.get_projection_matrix();
+        shader->light_dir = light_dir;
+        return shader;
+    }
+
+    template <class S>
+    S* make_shader(FrameArena* arena) {
+        return arena ? arena->create<S>() : new S();
+    }
+}
+
+IShader* create_shader(const char* name, Model* model, const Camera& camera, const Vec3f& light_dir,
+                       FrameArena* arena) {
+    if (!strcmp(name, "simple")) return setup_shader(make_shader<SimpleShader>(arena), model, camera, light_dir);
+    if (!strcmp(name, "improved")) return setup_shader(make_shader<ImprovedShader>(arena), model, camera, light_dir);
+    if (!strcmp(name, "smooth")) return setup_shader(make_shader<SmoothShader>(arena), model, camera, light_dir);
+    if (!strcmp(name, "pbr")) return setup_shader(make_shader<PBRShader>(arena), model, camera, light_dir);
+    return NULL;
+}
@@ -0,0 +1,18 @@
+﻿#ifndef SHADER_FACTORY_H
+#define SHADER_FACTORY_H
+
+#include "geometry.h"
+#include "model.h"
+#include "ishader.h"
+#include "Camera.h"
+
+// Имена шейдеров, которые понимает create_shader
+extern const char* const SHADER_NAMES[];
+extern const int SHADER_COUNT;
+
+// Шейдер по имени с матрицами камеры и направлением света; NULL — неизвестное имя.
+// С ареной шейдер создается в ней и освобождается FrameArena::destroy(), а не delete
+IShader* create_shader(const char* name, Model* model, const Camera& camera, const Vec3f& light_dir,
+                       FrameArena* arena = NULL);
+
+#endif
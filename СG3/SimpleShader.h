@@ -5,8 +5,10 @@
 #include "tgaimage.h"
 #include "model.h"
 #include "ishader.h"
+#include "Arena.h"
+#include "Lights.h"
 
-struct SimpleShader : public IShader {
+struct SimpleShader : public IShader, public LightList {
     Model* model;
     Matrix ModelView;
     Matrix Projection;
@@ -29,14 +31,8 @@ struct SimpleShader : public IShader {
 
 
         if (nthvert == 0) {
-            Vec3f v0 = model->vert(iface, 0);
-            Vec3f v1 = model->vert(iface, 1);
-            Vec3f v2 = model->vert(iface, 2);
-
-            Vec3f edge1 = v1 - v0;
-            Vec3f edge2 = v2 - v0;
-            Vec3f normal = cross(edge1, edge2).normalize();
-
+            //      
+            Vec3f normal = model->face_normal(iface);
 
             Vec4f normal_camera = ModelView * embed<4>(normal, 0.0f);
             Vec3f n_cam = Vec3f(normal_camera[0], normal_camera[1], normal_camera[2]).normalize();
@@ -54,7 +50,27 @@ struct SimpleShader : public IShader {
         return gl_Vertex;
     }
 
-    virtual bool fragment(Vec3f bar, TGAColor& color) {
+    //  :    ;     load_varyings()
+    virtual int varying_size() const { return 3; }
+
+    virtual Vec4f vertex_varying(int iface, int nthvert, float* out) {
+        Vec4f vertex_camera = ModelView * embed<4>(model->vert(iface, nthvert), 1.0f);
+        out[0] = vertex_camera[0];
+        out[1] = vertex_camera[1];
+        out[2] = vertex_camera[2];
+        return Projection * vertex_camera;
+    }
+
+    virtual void load_varyings(int iface, const float* const* varyings) {
+        Vec4f normal_camera = ModelView * embed<4>(model->face_normal(iface), 0.0f);
+        Vec3f n_cam = Vec3f(normal_camera[0], normal_camera[1], normal_camera[2]).normalize();
+        for (int i = 0; i < 3; i++) {
+            varying_nrm.set_col(i, n_cam);
+            varying_pos.set_col(i, Vec3f(varyings[i][0], varyings[i][1], varyings[i][2]));
+        }
+    }
+
+    virtual bool fragment_linear(Vec3f bar, Vec4f& color) {
         Vec3f n = varying_nrm.col(0).normalize();
         Vec4f light_camera = ModelView * embed<4>(light_dir, 0.0f);
         Vec3f l = Vec3f(light_camera[0], light_camera[1], light_camera[2]).normalize();
@@ -75,13 +91,31 @@ struct SimpleShader : public IShader {
 
         //  
         float intensity = ambient + diffuse + specular;
-        intensity = std::min(1.0f, std::max(0.0f, intensity));
+        color = Vec4f(intensity, intensity, intensity, 1.0f);
 
-        int col = static_cast<int>(255 * intensity);
-        color = TGAColor(col, col, col, 255);
+        //     (    )
+        if (!lights_cam.empty()) {
+            Vec3f extra = shade_lights(gl_FragCoord, pos_camera, n, view_dir, diffuse_k, specular_k, shininess);
+            color = Vec4f(intensity + extra.x, intensity + extra.y, intensity + extra.z, 1.0f);
+        }
 
         return false;
     }
+
+    virtual IShader* clone() const {
+        return new SimpleShader(*this);
+    }
+
+    virtual IShader* clone_in(FrameArena& arena) const {
+        return arena.create<SimpleShader>(*this);
+    }
+
+    virtual bool fragment(Vec3f bar, TGAColor& color) {
+        Vec4f linear;
+        bool discard = fragment_linear(bar, linear);
+        color = quantize_color(linear);
+        return discard;
+    }
 };
 
 #endif
\ No newline at end of file
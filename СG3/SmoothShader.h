@@ -5,8 +5,10 @@
 #include "tgaimage.h"
 #include "model.h"
 #include "ishader.h"
+#include "Arena.h"
+#include "Lights.h"
 
-struct SmoothShader : public IShader {
+struct SmoothShader : public IShader, public LightList {
     Model* model;
     Matrix ModelView;
     Matrix Projection;
@@ -32,20 +34,8 @@ struct SmoothShader : public IShader {
         Vec3f vertex = model->vert(iface, nthvert);
         world_coords.set_col(nthvert, vertex);
 
-        //     
-        Vec3f normal;
-        try {
-            normal = model->normal(iface, nthvert);
-        }
-        catch (...) {
-            //   ,   
-            Vec3f v0 = model->vert(iface, 0);
-            Vec3f v1 = model->vert(iface, 1);
-            Vec3f v2 = model->vert(iface, 2);
-            Vec3f edge1 = v1 - v0;
-            Vec3f edge2 = v2 - v0;
-            normal = cross(edge1, edge2).normalize();
-        }
+        //     (   )
+        Vec3f normal = model->normal(iface, nthvert);
 
         //     
         Vec4f normal_camera = ModelView * embed<4>(normal, 0.0f);
@@ -57,7 +47,28 @@ struct SmoothShader : public IShader {
         return gl_Vertex;
     }
 
-    virtual bool fragment(Vec3f bar, TGAColor& color) {
+    //  :       
+    virtual int varying_size() const { return 6; }
+
+    virtual Vec4f vertex_varying(int iface, int nthvert, float* out) {
+        Vec3f vertex = model->vert(iface, nthvert);
+        Vec4f normal_camera = ModelView * embed<4>(model->normal(iface, nthvert), 0.0f);
+        Vec3f n_cam = Vec3f(normal_camera[0], normal_camera[1], normal_camera[2]).normalize();
+        for (int k = 0; k < 3; k++) {
+            out[k] = vertex[k];
+            out[3 + k] = n_cam[k];
+        }
+        return Projection * ModelView * embed<4>(vertex, 1.0f);
+    }
+
+    virtual void load_varyings(int /*iface*/, const float* const* varyings) {
+        for (int i = 0; i < 3; i++) {
+            world_coords.set_col(i, Vec3f(varyings[i][0], varyings[i][1], varyings[i][2]));
+            varying_nrm.set_col(i, Vec3f(varyings[i][3], varyings[i][4], varyings[i][5]));
+        }
+    }
+
+    virtual bool fragment_linear(Vec3f bar, Vec4f& color) {
         //    
         Vec3f n;
         for (int i = 0; i < 3; i++) {
@@ -86,17 +97,38 @@ struct SmoothShader : public IShader {
         Vec3f reflect_dir = (n * (n * l * 2.0f) - l).normalize();
         float specular = specular_k * pow(std::max(0.0f, reflect_dir * view_dir), shiny_k);
 
-        //     
+        //   (   )
         float intensity = ambient + diffuse + specular;
-        intensity = std::min(1.0f, std::max(0.0f, intensity));
 
         //  
-        int col = static_cast<int>(255 * intensity);
-        color = TGAColor(col, col, col, 255);
+        color = Vec4f(intensity, intensity, intensity, 1.0f);
+
+        //     (    )
+        if (!lights_cam.empty()) {
+            Vec4f pos_camera = ModelView * embed<4>(world_pos, 1.0f);
+            Vec3f extra = shade_lights(gl_FragCoord, Vec3f(pos_camera.x, pos_camera.y, pos_camera.z), n, view_dir,
+                                       diffuse_k, specular_k, shiny_k);
+            color = Vec4f(intensity + extra.x, intensity + extra.y, intensity + extra.z, 1.0f);
+        }
 
         return false;
     }
 
+    virtual IShader* clone() const {
+        return new SmoothShader(*this);
+    }
+
+    virtual IShader* clone_in(FrameArena& arena) const {
+        return arena.create<SmoothShader>(*this);
+    }
+
+    virtual bool fragment(Vec3f bar, TGAColor& color) {
+        Vec4f linear;
+        bool discard = fragment_linear(bar, linear);
+        color = quantize_color(linear);
+        return discard;
+    }
+
     void set_material(float amb, float diff, float spec, float shine) {
         ambient_k = amb;
         diffuse_k = diff;
@@ -0,0 +1,143 @@
+﻿#include <algorithm>
+#include "StreamRenderer.h"
+#include "ShaderFactory.h"
+#include "PipelineStats.h"
+#include "Trace.h"
+
+namespace {
+    // Уникальные глобальные индексы части по возрастанию (-1 отбрасывается)
+    void unique_keys(std::vector<int>& keys) {
+        std::sort(keys.begin(), keys.end());
+        keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+        if (!keys.empty() && keys[0] < 0) keys.erase(keys.begin());
+    }
+
+    int local_index(const std::vector<int>& keys, int global) {
+        if (global < 0) return -1;
+        return static_cast<int>(std::lower_bound(keys.begin(), keys.end(), global) - keys.begin());
+    }
+
+    template <class T>
+    size_t vector_bytes(const std::vector<T>& v) {
+        return v.capacity() * sizeof(T);
+    }
+}
+
+StreamRenderer::StreamRenderer(size_t memory_limit)
+    : memory_limit_(memory_limit),
+      chunk_triangles_(std::max<size_t>(1024, memory_limit / 2 / BYTES_PER_TRIANGLE)) {
+}
+
+bool StreamRenderer::open(const char* cache_path) {
+    return cache_.open(cache_path, memory_limit_ / 2);
+}
+
+bool StreamRenderer::read_chunk(uint64_t first, size_t& count) {
+    const uint64_t total = cache_.header().ntriangles;
+    count = static_cast<size_t>(std::min<uint64_t>(chunk_triangles_, total - first));
+    triangles_.resize(count);
+    // Копия треугольников части: окно с ними может быть вытеснено, пока читаются вершины
+    size_t done = 0;
+    while (done < count) {
+        uint64_t n = count - done;
+        const CacheTriangle* run = cache_.triangles(first + done, n);
+        if (!run) return false;
+        std::copy(run, run + n, triangles_.begin() + done);
+        done += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+bool StreamRenderer::build_chunk() {
+    // Перенумерация в локальные индексы: сортировка ключей вместо хеш-таблицы,
+    // без выделения памяти на каждую вершину
+    vertex_keys_.clear();
+    normal_keys_.clear();
+    uv_keys_.clear();
+    for (size_t i = 0; i < triangles_.size(); i++) {
+        const CacheTriangle& t = triangles_[i];
+        vertex_keys_.insert(vertex_keys_.end(), t.v, t.v + 3);
+        normal_keys_.insert(normal_keys_.end(), t.n, t.n + 3);
+        uv_keys_.insert(uv_keys_.end(), t.uv, t.uv + 3);
+    }
+    unique_keys(vertex_keys_);
+    unique_keys(normal_keys_);
+    unique_keys(uv_keys_);
+
+    // Ключи по возрастанию: соседние вершины лежат в одном окне кэша
+    verts_.resize(vertex_keys_.size());
+    for (size_t i = 0; i < vertex_keys_.size(); i++) {
+        if (!cache_.position(vertex_keys_[i], verts_[i])) return false;
+    }
+    norms_.resize(normal_keys_.size());
+    for (size_t i = 0; i < normal_keys_.size(); i++) {
+        if (!cache_.normal(normal_keys_[i], norms_[i])) return false;
+    }
+    uvs_.resize(uv_keys_.size());
+    for (size_t i = 0; i < uv_keys_.size(); i++) {
+        if (!cache_.uv(uv_keys_[i], uvs_[i])) return false;
+    }
+
+    corners_.resize(triangles_.size() * 9);
+    for (size_t i = 0; i < triangles_.size(); i++) {
+        const CacheTriangle& t = triangles_[i];
+        int* c = &corners_[i * 9];
+        for (int j = 0; j < 3; j++) {
+            c[j] = local_index(vertex_keys_, t.v[j]);
+            c[3 + j] = local_index(uv_keys_, t.uv[j]);
+            c[6 + j] = local_index(normal_keys_, t.n[j]);
+        }
+    }
+    return true;
+}
+
+size_t StreamRenderer::chunk_bytes() const {
+    // Списки граней модели (вектор и блок в куче на каждую) оцениваются по числу треугольников
+    const size_t model_faces = triangles_.size() * (3 * sizeof(std::vector<int>) + 3 * 32 + sizeof(Vec3f));
+    return vector_bytes(triangles_) + vector_bytes(vertex_keys_) + vector_bytes(normal_keys_) +
+           vector_bytes(uv_keys_) + 2 * (vector_bytes(verts_) + vector_bytes(norms_) + vector_bytes(uvs_)) +
+           vector_bytes(corners_) + model_faces + vector_bytes(meshlets_.meshlets) +
+           vector_bytes(meshlets_.vertices) + vector_bytes(meshlets_.corners) +
+           vector_bytes(meshlets_.triangles) + vector_bytes(meshlets_.faces);
+}
+
+StreamResult StreamRenderer::render(const char* shader_name, const Camera& camera, const Vec3f& light_dir, Framebuffer& fb,
+                            const RenderOptions& options, StreamStats* stats) {
+    TRACE_SCOPE("stream render");
+    StreamStats local;
+    local.chunk_triangles = chunk_triangles_;
+    RenderOptions chunk_options = options;
+    chunk_options.arena = &arena_;
+
+    const uint64_t total = cache_.header().ntriangles;
+    for (uint64_t first = 0; first < total; ) {
+        uint64_t start = PipelineStats::now_ns();
+        {
+            TRACE_SCOPE("stream read");
+            size_t count = 0;
+            if (!read_chunk(first, count) || !build_chunk()) return STREAM_READ_ERROR;
+            first += count;
+        }
+        uint64_t read_end = PipelineStats::now_ns();
+        local.read_ms += (read_end - start) / 1e6;
+
+        {
+            TRACE_SCOPE("stream draw");
+            chunk_.assign(verts_, norms_, uvs_, corners_);
+            meshlets_.build(chunk_);
+            arena_.reset();
+            IShader* shader = create_shader(shader_name, &chunk_, camera, light_dir, &arena_);
+            if (!shader) return STREAM_UNKNOWN_SHADER;
+            draw_meshlets(meshlets_, camera, *shader, fb, chunk_options);
+            FrameArena::destroy(shader);
+        }
+        local.draw_ms += (PipelineStats::now_ns() - read_end) / 1e6;
+        local.triangles += triangles_.size();
+        local.chunks++;
+        local.peak_chunk_bytes = std::max(local.peak_chunk_bytes, chunk_bytes());
+    }
+    local.peak_mapped_bytes = cache_.file().peak_resident_bytes();
+    local.window_maps = cache_.file().window_maps();
+    if (stats) *stats = local;
+    return STREAM_OK;
+}
@@ -0,0 +1,87 @@
+﻿#ifndef STREAM_RENDERER_H
+#define STREAM_RENDERER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "geometry.h"
+#include "model.h"
+#include "Camera.h"
+#include "Framebuffer.h"
+#include "Meshlet.h"
+#include "Renderer.h"
+#include "MeshCache.h"
+#include "Arena.h"
+
+struct StreamStats {
+    uint64_t triangles;
+    int chunks;
+    size_t chunk_triangles;    // треугольников в части
+    size_t peak_mapped_bytes;  // наибольший объем отображенных окон кэша
+    size_t peak_chunk_bytes;   // наибольший рабочий набор части (оценка по размерам массивов)
+    uint64_t window_maps;      // сколько раз окна кэша отображались заново
+    double read_ms;            // чтение треугольников и вершин из кэша
+    double draw_ms;            // подготовка части и растеризация
+
+    StreamStats()
+        : triangles(0), chunks(0), chunk_triangles(0), peak_mapped_bytes(0), peak_chunk_bytes(0), window_maps(0),
+          read_ms(0.0), draw_ms(0.0) {
+    }
+};
+
+enum StreamResult {
+    STREAM_OK,
+    STREAM_UNKNOWN_SHADER,
+    STREAM_READ_ERROR // кэш короче заголовка или ссылается за свои разделы
+};
+
+// Отрисовка сетки, которая не помещается в память: треугольники идут из кэша
+// (MeshCache) частями фиксированного размера. Вершины части собираются в
+// небольшую модель с локальными индексами, к ней строятся кластеры, и часть
+// растеризуется обычным конвейером, после чего ее память переиспользуется.
+// Потолок memory_limit делится пополам между окнами кэша и рабочим набором части.
+// Вершины без нормалей освещаются нормалью грани (сглаживание требует всей сетки)
+class StreamRenderer {
+public:
+    explicit StreamRenderer(size_t memory_limit);
+
+    bool open(const char* cache_path);
+    const MeshCacheHeader& header() const { return cache_.header(); }
+
+    // Рисует все треугольники кэша. Шейдер создается по имени на каждую часть.
+    // При ошибке уже нарисованные части остаются в кадре
+    StreamResult render(const char* shader_name, const Camera& camera, const Vec3f& light_dir, Framebuffer& fb,
+                const RenderOptions& options, StreamStats* stats = NULL);
+
+    // Оценка памяти части на один треугольник: списки граней модели, локальные
+    // атрибуты, ключи перенумерации и кластеры
+    static const size_t BYTES_PER_TRIANGLE = 512;
+
+private:
+    size_t memory_limit_;
+    size_t chunk_triangles_;
+    MeshCache cache_;
+
+    // Рабочий набор части, переиспользуется между частями
+    std::vector<CacheTriangle> triangles_;
+    std::vector<int> vertex_keys_;
+    std::vector<int> normal_keys_;
+    std::vector<int> uv_keys_;
+    std::vector<Vec3f> verts_;
+    std::vector<Vec3f> norms_;
+    std::vector<Vec2f> uvs_;
+    std::vector<int> corners_;
+    Model chunk_;
+    MeshletMesh meshlets_;
+    FrameArena arena_;
+
+    // false — треугольник или вершина части не читается из кэша
+    bool read_chunk(uint64_t first, size_t& count);
+    bool build_chunk();
+    size_t chunk_bytes() const;
+
+    StreamRenderer(const StreamRenderer&);
+    StreamRenderer& operator=(const StreamRenderer&);
+};
+
+#endif
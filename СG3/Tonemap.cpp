@@ -0,0 +1,126 @@
+﻿#include <algorithm>
+#include <cmath>
+#include "Tonemap.h"
+#include "Trace.h"
+
+#if defined(_M_X64) || defined(_M_AMD64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define TONEMAP_USE_SSE 1
+#endif
+
+namespace {
+    // Таблица линейное [0, 1] -> 8-битное sRGB, 12 бит на входе достаточно для 8 бит на выходе
+    const int SRGB_LUT_SIZE = 4096;
+
+    struct SrgbLut {
+        unsigned char values[SRGB_LUT_SIZE];
+
+        SrgbLut() {
+            for (int i = 0; i < SRGB_LUT_SIZE; i++) {
+                float x = i / float(SRGB_LUT_SIZE - 1);
+                float s = x <= 0.0031308f ? 12.92f * x : 1.055f * std::pow(x, 1.f / 2.4f) - 0.055f;
+                values[i] = static_cast<unsigned char>(std::min(255.f, std::max(0.f, s * 255.f + 0.5f)));
+            }
+        }
+    };
+
+    const unsigned char* srgb_lut() {
+        static const SrgbLut lut;
+        return lut.values;
+    }
+
+    inline float tonemap(float x, ToneMapOperator op) {
+        switch (op) {
+        case TONEMAP_REINHARD:
+            return x / (1.f + x);
+        case TONEMAP_ACES:
+            return (x * (2.51f * x + 0.03f)) / (x * (2.43f * x + 0.59f) + 0.14f);
+        default:
+            return x;
+        }
+    }
+
+#ifdef TONEMAP_USE_SSE
+    inline __m128 tonemap4(__m128 x, ToneMapOperator op) {
+        switch (op) {
+        case TONEMAP_REINHARD:
+            return _mm_div_ps(x, _mm_add_ps(_mm_set1_ps(1.f), x));
+        case TONEMAP_ACES: {
+            __m128 num = _mm_mul_ps(x, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.51f), x), _mm_set1_ps(0.03f)));
+            __m128 den = _mm_add_ps(_mm_mul_ps(x, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.43f), x), _mm_set1_ps(0.59f))), _mm_set1_ps(0.14f));
+            return _mm_div_ps(num, den);
+        }
+        default:
+            return x;
+        }
+    }
+#endif
+}
+
+void resolve_hdr(Framebuffer& fb, float exposure, ToneMapOperator op) {
+    TRACE_SCOPE("resolve_hdr");
+    if (!fb.hdr_enabled()) return;
+
+    const unsigned char* lut = srgb_lut();
+    TGAImage& image = fb.color();
+    unsigned char* out = image.buffer();
+    int bpp = image.get_bytespp();
+    size_t npixels = fb.pixel_count();
+
+    const float* planes[3] = { fb.hdr_plane(0), fb.hdr_plane(1), fb.hdr_plane(2) };
+    const float* alpha = fb.hdr_plane(3);
+    const float scale = float(SRGB_LUT_SIZE - 1);
+
+    size_t i = 0;
+#ifdef TONEMAP_USE_SSE
+    // Плоскости выровнены, поэтому 4 пикселя канала обрабатываются одной инструкцией
+    const __m128 vexposure = _mm_set1_ps(exposure);
+    const __m128 vzero = _mm_setzero_ps();
+    const __m128 vone = _mm_set1_ps(1.f);
+    const __m128 vscale = _mm_set1_ps(scale);
+    for (; i + 4 <= npixels; i += 4) {
+        int idx[3][4];
+        for (int c = 0; c < 3; c++) {
+            __m128 x = _mm_mul_ps(_mm_load_ps(planes[c] + i), vexposure);
+            x = tonemap4(_mm_max_ps(x, vzero), op);
+            x = _mm_min_ps(_mm_max_ps(x, vzero), vone);
+            _mm_storeu_si128((__m128i*)idx[c], _mm_cvtps_epi32(_mm_mul_ps(x, vscale)));
+        }
+        for (int k = 0; k < 4; k++) {
+            unsigned char* p = out + (i + k) * bpp;
+            unsigned char r = lut[idx[0][k]];
+            unsigned char g = lut[idx[1][k]];
+            unsigned char b = lut[idx[2][k]];
+            if (bpp == TGAImage::GRAYSCALE) {
+                p[0] = static_cast<unsigned char>((r * 54 + g * 183 + b * 19) >> 8);
+                continue;
+            }
+            p[0] = b;
+            p[1] = g;
+            p[2] = r;
+            if (bpp == TGAImage::RGBA) {
+                p[3] = static_cast<unsigned char>(std::min(1.f, std::max(0.f, alpha[i + k])) * 255.f + 0.5f);
+            }
+        }
+    }
+#endif
+    for (; i < npixels; i++) {
+        unsigned char rgb[3];
+        for (int c = 0; c < 3; c++) {
+            float x = tonemap(std::max(0.f, planes[c][i] * exposure), op);
+            x = std::min(1.f, std::max(0.f, x));
+            rgb[c] = lut[static_cast<int>(x * scale + 0.5f)];
+        }
+        unsigned char* p = out + i * bpp;
+        if (bpp == TGAImage::GRAYSCALE) {
+            p[0] = static_cast<unsigned char>((rgb[0] * 54 + rgb[1] * 183 + rgb[2] * 19) >> 8);
+            continue;
+        }
+        p[0] = rgb[2];
+        p[1] = rgb[1];
+        p[2] = rgb[0];
+        if (bpp == TGAImage::RGBA) {
+            p[3] = static_cast<unsigned char>(std::min(1.f, std::max(0.f, alpha[i])) * 255.f + 0.5f);
+        }
+    }
+}
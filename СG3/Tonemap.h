@@ -0,0 +1,16 @@
+﻿#ifndef TONEMAP_H
+#define TONEMAP_H
+
+#include "Framebuffer.h"
+
+enum ToneMapOperator {
+    TONEMAP_CLAMP,    // простое ограничение [0, 1]
+    TONEMAP_REINHARD, // x / (1 + x)
+    TONEMAP_ACES      // аппроксимация ACES filmic (Narkowicz)
+};
+
+// Переводит линейный HDR-буфер framebuffer'а в его TGAImage:
+// экспозиция -> тональная компрессия -> кодирование sRGB -> 8 бит
+void resolve_hdr(Framebuffer& fb, float exposure = 1.f, ToneMapOperator op = TONEMAP_ACES);
+
+#endif
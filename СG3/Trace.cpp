@@ -0,0 +1,103 @@
+﻿#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <vector>
+#include "Trace.h"
+
+namespace trace {
+
+std::atomic<bool> active(false);
+
+namespace {
+
+struct Event {
+    const char* name;
+    double start_us;
+    double duration_us;
+    std::string args;
+};
+
+// Буфер пишет только его поток; читается в stop(), когда потоки отрисовки уже завершены
+struct ThreadBuffer {
+    int tid;
+    std::string name;
+    std::vector<Event> events;
+};
+
+std::mutex registry_mutex;
+std::vector<std::unique_ptr<ThreadBuffer> > registry;
+std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+ThreadBuffer& local_buffer() {
+    thread_local ThreadBuffer* buffer = NULL;
+    if (!buffer) {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        registry.push_back(std::unique_ptr<ThreadBuffer>(new ThreadBuffer()));
+        buffer = registry.back().get();
+        buffer->tid = static_cast<int>(registry.size());
+        std::ostringstream name;
+        name << "thread " << buffer->tid;
+        buffer->name = name.str();
+    }
+    return *buffer;
+}
+
+}
+
+void start() {
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    for (size_t i = 0; i < registry.size(); i++) {
+        registry[i]->events.clear();
+    }
+    epoch = std::chrono::steady_clock::now();
+    active.store(true);
+}
+
+bool stop(const char* path) {
+    active.store(false);
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    std::ofstream out(path);
+    if (!out) return false;
+    out << std::fixed << std::setprecision(3);
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    bool first = true;
+    for (size_t i = 0; i < registry.size(); i++) {
+        const ThreadBuffer& b = *registry[i];
+        if (b.events.empty()) continue;
+        out << (first ? "" : ",\n");
+        out << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << b.tid
+            << ", \"args\": {\"name\": \"" << b.name << "\"}}";
+        first = false;
+        for (size_t k = 0; k < b.events.size(); k++) {
+            const Event& e = b.events[k];
+            out << ",\n{\"name\": \"" << e.name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << b.tid
+                << ", \"ts\": " << e.start_us << ", \"dur\": " << e.duration_us;
+            if (!e.args.empty()) out << ", \"args\": " << e.args;
+            out << "}";
+        }
+    }
+    out << "\n]}\n";
+    return out.good();
+}
+
+void set_thread_name(const std::string& name) {
+    local_buffer().name = name;
+}
+
+double now_us() {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+void record(const char* name, double start_us, double duration_us, const std::string& args) {
+    Event e;
+    e.name = name;
+    e.start_us = start_us;
+    e.duration_us = duration_us;
+    e.args = args;
+    local_buffer().events.push_back(e);
+}
+
+}
@@ -0,0 +1,53 @@
+﻿#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <string>
+
+// Запись таймлайна в формате Chrome JSON trace (chrome://tracing, Perfetto).
+// Пока сессия не запущена, TRACE_SCOPE стоит одну relaxed-загрузку флага.
+// События копятся в буфере каждого потока и пишутся в файл в trace::stop()
+namespace trace {
+    extern std::atomic<bool> active;
+
+    inline bool enabled() { return active.load(std::memory_order_relaxed); }
+
+    void start();
+    // Останавливает сессию и пишет события всех потоков; false — ошибка записи
+    bool stop(const char* path);
+
+    // Имя потока на таймлайне (по умолчанию "thread N")
+    void set_thread_name(const std::string& name);
+
+    double now_us();
+    // args — JSON-объект или пустая строка
+    void record(const char* name, double start_us, double duration_us, const std::string& args);
+}
+
+class TraceScope {
+public:
+    explicit TraceScope(const char* name)
+        : name_(name), start_(trace::enabled() ? trace::now_us() : -1.0) {
+    }
+
+    ~TraceScope() {
+        if (start_ >= 0.0) trace::record(name_, start_, trace::now_us() - start_, args_);
+    }
+
+    bool active() const { return start_ >= 0.0; }
+    void set_args(const std::string& args) { args_ = args; }
+
+private:
+    const char* name_;
+    double start_;
+    std::string args_;
+
+    TraceScope(const TraceScope&);
+    TraceScope& operator=(const TraceScope&);
+};
+
+#define TRACE_CONCAT_IMPL(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_IMPL(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+
+#endif
@@ -0,0 +1,156 @@
+﻿#include <algorithm>
+#include <new>
+#include <thread>
+#include <vector>
+#include "Transparency.h"
+#include "Trace.h"
+#include "WorkerPool.h"
+
+TransparencyBuffer::TransparencyBuffer(int w, int h, size_t max_fragments)
+    : width(w), height(h), capacity_(max_fragments), used_(0), overflow_(0), overflow_layers_(NULL) {
+    // Вся память выделяется один раз: ни одного new на фрагмент
+    nodes_ = static_cast<Node*>(fbpool::acquire(capacity_ * sizeof(Node)));
+    heads_ = static_cast<int*>(fbpool::acquire((size_t)width * height * sizeof(int)));
+    clear();
+}
+
+TransparencyBuffer::~TransparencyBuffer() {
+    fbpool::release(nodes_, capacity_ * sizeof(Node));
+    fbpool::release(heads_, (size_t)width * height * sizeof(int));
+    if (overflow_layers_.load()) {
+        fbpool::release(overflow_layers_.load(), (size_t)width * height * sizeof(OverflowLayer));
+    }
+}
+
+void TransparencyBuffer::clear() {
+    std::fill(heads_, heads_ + (size_t)width * height, -1);
+    used_ = 0;
+    if (overflow_ > 0 && overflow_layers_.load()) {
+        OverflowLayer* layers = overflow_layers_.load();
+        std::fill(layers, layers + (size_t)width * height, OverflowLayer());
+    }
+    overflow_ = 0;
+}
+
+TransparencyBuffer::OverflowLayer* TransparencyBuffer::overflow_layers() {
+    OverflowLayer* layers = overflow_layers_.load(std::memory_order_acquire);
+    if (layers) return layers;
+    // Первое переполнение: буфер может одновременно выделить несколько потоков, остается один
+    const size_t bytes = (size_t)width * height * sizeof(OverflowLayer);
+    OverflowLayer* fresh = static_cast<OverflowLayer*>(fbpool::acquire(bytes));
+    if (!fresh) throw std::bad_alloc();
+    std::fill(fresh, fresh + (size_t)width * height, OverflowLayer());
+    if (overflow_layers_.compare_exchange_strong(layers, fresh, std::memory_order_acq_rel)) return fresh;
+    fbpool::release(fresh, bytes);
+    return layers;
+}
+
+void TransparencyBuffer::append_overflow(int idx, const Vec4f& c, float depth) {
+    OverflowLayer& layer = overflow_layers()[idx];
+    float a = std::min(1.f, std::max(0.f, c.w));
+    if (a <= 0.f) return;
+    // "Поверх" накопленного: фрагменты смешиваются в порядке поступления
+    layer.r = c.x * a + layer.r * (1.f - a);
+    layer.g = c.y * a + layer.g * (1.f - a);
+    layer.b = c.z * a + layer.b * (1.f - a);
+    layer.depth = layer.a > 0.f ? std::max(layer.depth, depth) : depth;
+    layer.a = a + layer.a * (1.f - a);
+}
+
+size_t TransparencyBuffer::fragments() const {
+    return std::min(used_.load(), capacity_);
+}
+
+void TransparencyBuffer::composite(Framebuffer& fb, int idx, const Vec4f& c) {
+    float a = std::min(1.f, std::max(0.f, c.w));
+    if (fb.hdr_enabled()) {
+        size_t stride = fb.plane_stride();
+        float* p = fb.hdr_plane(0) + idx;
+        p[0] = c.x * a + p[0] * (1.f - a);
+        p[stride] = c.y * a + p[stride] * (1.f - a);
+        p[2 * stride] = c.z * a + p[2 * stride] * (1.f - a);
+        p[3 * stride] = a + p[3 * stride] * (1.f - a);
+        return;
+    }
+    TGAImage& image = fb.color();
+    int bpp = image.get_bytespp();
+    unsigned char* p = image.buffer() + (size_t)idx * bpp;
+    float rgb[3] = { c.z, c.y, c.x }; // порядок байт в TGA: b, g, r
+    int channels = std::min(bpp, 3);
+    for (int k = 0; k < channels; k++) {
+        float v = std::min(1.f, std::max(0.f, rgb[k]));
+        p[k] = static_cast<unsigned char>(v * 255.f * a + p[k] * (1.f - a) + 0.5f);
+    }
+    if (bpp == TGAImage::RGBA) {
+        p[3] = static_cast<unsigned char>(255.f * a + p[3] * (1.f - a) + 0.5f);
+    }
+}
+
+void TransparencyBuffer::resolve_rows(Framebuffer& fb, int y0, int y1) {
+    TRACE_SCOPE("oit resolve rows");
+    const Node* layers[MAX_LAYERS];
+    const OverflowLayer* overflow = overflow_ > 0 ? overflow_layers_.load() : NULL;
+    Node overflow_node;
+    for (int y = y0; y < y1; y++) {
+        for (int x = 0; x < width; x++) {
+            int idx = x + y * width;
+            int count = 0;
+            bool has_overflow = overflow && overflow[idx].a > 0.f;
+            float opaque_depth = heads_[idx] >= 0 || has_overflow ? fb.depth_at(idx) : 0.f;
+            auto insert = [&](const Node* node) {
+                // Непрозрачная геометрия могла перекрыть фрагмент уже после его записи
+                if (node->depth < opaque_depth) return;
+                // Вставка с сортировкой по возрастанию глубины (от дальнего к ближнему);
+                // при переполнении отбрасывается самый дальний слой
+                if (count == MAX_LAYERS) {
+                    if (node->depth <= layers[0]->depth) return;
+                    for (int k = 1; k < count; k++) layers[k - 1] = layers[k];
+                    count--;
+                }
+                int k = count++;
+                while (k > 0 && layers[k - 1]->depth > node->depth) {
+                    layers[k] = layers[k - 1];
+                    k--;
+                }
+                layers[k] = node;
+            };
+            for (int n = heads_[idx]; n >= 0; n = nodes_[n].next) {
+                insert(&nodes_[n]);
+            }
+            if (has_overflow) {
+                // Слой переполнения сводится как один фрагмент (цвет без умножения на альфу)
+                const OverflowLayer& o = overflow[idx];
+                float inv = 1.f / o.a;
+                overflow_node.r = o.r * inv;
+                overflow_node.g = o.g * inv;
+                overflow_node.b = o.b * inv;
+                overflow_node.a = o.a;
+                overflow_node.depth = o.depth;
+                overflow_node.next = -1;
+                insert(&overflow_node);
+            }
+            for (int k = 0; k < count; k++) {
+                composite(fb, idx, Vec4f(layers[k]->r, layers[k]->g, layers[k]->b, layers[k]->a));
+            }
+        }
+    }
+}
+
+void TransparencyBuffer::resolve(Framebuffer& fb, int threads) {
+    if (threads <= 0) {
+        threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    }
+    threads = std::min(threads, height);
+    if (threads <= 1) {
+        resolve_rows(fb, 0, height);
+        return;
+    }
+    // Строки независимы: каждый поток пула сводит свою полосу кадра
+    int rows_per_thread = (height + threads - 1) / threads;
+    auto resolve_band = [this, &fb, rows_per_thread](int t) {
+        int y0 = t * rows_per_thread;
+        int y1 = std::min(height, y0 + rows_per_thread);
+        if (y0 < y1) resolve_rows(fb, y0, y1);
+    };
+    WorkerPool::instance().run(threads, resolve_band);
+}
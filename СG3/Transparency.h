@@ -0,0 +1,153 @@
+﻿#ifndef TRANSPARENCY_H
+#define TRANSPARENCY_H
+
+#include <atomic>
+#include <cstddef>
+#include "geometry.h"
+#include "ishader.h"
+#include "Arena.h"
+#include "Framebuffer.h"
+
+// Порядко-независимая прозрачность: полупрозрачные фрагменты складываются
+// в односвязные списки по пикселям, узлы берутся из заранее выделенной арены.
+// resolve() сортирует списки по глубине и смешивает их поверх непрозрачного кадра.
+// Фрагменты сверх арены смешиваются без сортировки в один слой пикселя
+// (append_overflow), который сводится вместе со списком
+class TransparencyBuffer {
+public:
+    // Больше слоев на пиксель при сведении не учитывается (остаются ближайшие)
+    static const int MAX_LAYERS = 32;
+
+    TransparencyBuffer(int width, int height, size_t max_fragments);
+    ~TransparencyBuffer();
+
+    void clear();
+
+    // Добавляет фрагмент в список пикселя idx; false — арена заполнена,
+    // фрагмент нужно передать в append_overflow()
+    bool append(int idx, const Vec4f& color, float depth) {
+        size_t node = used_.fetch_add(1, std::memory_order_relaxed);
+        if (node >= capacity_) {
+            overflow_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        Node& n = nodes_[node];
+        n.r = color.x;
+        n.g = color.y;
+        n.b = color.z;
+        n.a = color.w;
+        n.depth = depth;
+        n.next = heads_[idx];
+        heads_[idx] = static_cast<int>(node);
+        return true;
+    }
+
+    // Смешивает фрагмент в слой переполнения пикселя idx в порядке поступления.
+    // Слой попадает в resolve() как один фрагмент с глубиной ближайшего из
+    // смешанных, поэтому непрозрачная геометрия, нарисованная позже, его перекрывает.
+    // Буфер слоев выделяется при первом переполнении. Пиксель пишет один поток
+    void append_overflow(int idx, const Vec4f& color, float depth);
+
+    // Сортирует и смешивает списки в цвет framebuffer'а, threads = 0 — по числу ядер
+    void resolve(Framebuffer& fb, int threads = 0);
+
+    size_t capacity() const { return capacity_; }
+    size_t fragments() const;
+    size_t overflow() const { return overflow_.load(); }
+
+    // Смешивание "поверх" одного фрагмента с цветом пикселя (HDR или 8 бит)
+    static void composite(Framebuffer& fb, int idx, const Vec4f& c);
+
+private:
+    struct Node {
+        float r, g, b, a;
+        float depth;
+        int next;
+    };
+
+    // Слой переполнения: цвет с умноженной альфой, a = 0 — пусто
+    struct OverflowLayer {
+        float r, g, b, a;
+        float depth;
+    };
+
+    int width;
+    int height;
+    size_t capacity_;
+    Node* nodes_;
+    int* heads_;
+    std::atomic<size_t> used_;
+    std::atomic<size_t> overflow_;
+    std::atomic<OverflowLayer*> overflow_layers_;
+
+    OverflowLayer* overflow_layers();
+
+    void resolve_rows(Framebuffer& fb, int y0, int y1);
+
+    TransparencyBuffer(const TransparencyBuffer&);
+    TransparencyBuffer& operator=(const TransparencyBuffer&);
+};
+
+// Обертка над шейдером, делающая его полупрозрачным
+struct TranslucentShader : public IShader {
+    IShader* inner;
+    float opacity;
+    bool owns_inner;
+    bool inner_in_arena; // inner создан в кадровой арене: только деструктор
+
+    TranslucentShader(IShader* shader, float alpha)
+        : inner(shader), opacity(alpha), owns_inner(false), inner_in_arena(false) {}
+
+    ~TranslucentShader() {
+        if (owns_inner) delete inner;
+        else if (inner_in_arena) FrameArena::destroy(inner);
+    }
+
+    virtual IShader* clone() const {
+        IShader* copy = inner->clone();
+        if (!copy) return NULL;
+        TranslucentShader* t = new TranslucentShader(copy, opacity);
+        t->owns_inner = true;
+        return t;
+    }
+
+    virtual IShader* clone_in(FrameArena& arena) const {
+        IShader* copy = inner->clone_in(arena);
+        if (!copy) return NULL;
+        TranslucentShader* t = arena.create<TranslucentShader>(copy, opacity);
+        t->inner_in_arena = true;
+        return t;
+    }
+
+    virtual Vec4f vertex(int iface, int nthvert) {
+        return inner->vertex(iface, nthvert);
+    }
+
+    virtual int varying_size() const {
+        return inner->varying_size();
+    }
+
+    virtual Vec4f vertex_varying(int iface, int nthvert, float* out) {
+        return inner->vertex_varying(iface, nthvert, out);
+    }
+
+    virtual void load_varyings(int iface, const float* const* varyings) {
+        inner->load_varyings(iface, varyings);
+    }
+
+    virtual bool fragment_linear(Vec3f bar, Vec4f& color) {
+        inner->gl_FragCoord = gl_FragCoord;
+        bool discard = inner->fragment_linear(bar, color);
+        color.w *= opacity;
+        return discard;
+    }
+
+    virtual bool fragment(Vec3f bar, TGAColor& color) {
+        Vec4f linear;
+        bool discard = fragment_linear(bar, linear);
+        color = quantize_color(linear);
+        return discard;
+    }
+};
+
+#endif
@@ -0,0 +1,253 @@
+﻿#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include "VideoStream.h"
+#include "Trace.h"
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+#if defined(_M_X64) || defined(_M_AMD64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define VIDEO_USE_SSE 1
+#endif
+
+namespace {
+    // BT.601, ограниченный диапазон, коэффициенты с масштабом 256
+    inline unsigned char luma(int r, int g, int b) {
+        return static_cast<unsigned char>(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+    }
+
+    inline unsigned char chroma_u(int r, int g, int b) {
+        return static_cast<unsigned char>(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+    }
+
+    inline unsigned char chroma_v(int r, int g, int b) {
+        return static_cast<unsigned char>(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+    }
+
+    // Пиксели [x0, width) пары строк, x0 четный
+    void convert_tail(const unsigned char* row0, const unsigned char* row1, int x0, int width,
+                      unsigned char* y0, unsigned char* y1, unsigned char* u, unsigned char* v) {
+        for (int x = x0; x < width; x += 2) {
+            int x1 = std::min(x + 1, width - 1);
+            int r = 0, g = 0, b = 0;
+            const unsigned char* px[4] = {row0 + x * 3, row0 + x1 * 3, row1 + x * 3, row1 + x1 * 3};
+            for (int k = 0; k < 4; k++) {
+                b += px[k][0];
+                g += px[k][1];
+                r += px[k][2];
+            }
+            y0[x] = luma(px[0][2], px[0][1], px[0][0]);
+            y1[x] = luma(px[2][2], px[2][1], px[2][0]);
+            if (x + 1 < width) {
+                y0[x + 1] = luma(px[1][2], px[1][1], px[1][0]);
+                y1[x + 1] = luma(px[3][2], px[3][1], px[3][0]);
+            }
+            r = (r + 2) >> 2;
+            g = (g + 2) >> 2;
+            b = (b + 2) >> 2;
+            u[x / 2] = chroma_u(r, g, b);
+            v[x / 2] = chroma_v(r, g, b);
+        }
+    }
+
+#ifdef VIDEO_USE_SSE
+    // 16 пикселей BGR (48 байт) в три плоскости по 16 байт только средствами
+    // SSE2: четыре раунда чередующих распаковок разводят каналы
+    inline void deinterleave_bgr(const unsigned char* p, __m128i& b, __m128i& g, __m128i& r) {
+        __m128i t00 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i t01 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16));
+        __m128i t02 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 32));
+
+        __m128i t10 = _mm_unpacklo_epi8(t00, _mm_unpackhi_epi64(t01, t01));
+        __m128i t11 = _mm_unpacklo_epi8(_mm_unpackhi_epi64(t00, t00), t02);
+        __m128i t12 = _mm_unpacklo_epi8(t01, _mm_unpackhi_epi64(t02, t02));
+
+        __m128i t20 = _mm_unpacklo_epi8(t10, _mm_unpackhi_epi64(t11, t11));
+        __m128i t21 = _mm_unpacklo_epi8(_mm_unpackhi_epi64(t10, t10), t12);
+        __m128i t22 = _mm_unpacklo_epi8(t11, _mm_unpackhi_epi64(t12, t12));
+
+        __m128i t30 = _mm_unpacklo_epi8(t20, _mm_unpackhi_epi64(t21, t21));
+        __m128i t31 = _mm_unpacklo_epi8(_mm_unpackhi_epi64(t20, t20), t22);
+        __m128i t32 = _mm_unpacklo_epi8(t21, _mm_unpackhi_epi64(t22, t22));
+
+        b = _mm_unpacklo_epi8(t30, _mm_unpackhi_epi64(t31, t31));
+        g = _mm_unpacklo_epi8(_mm_unpackhi_epi64(t30, t30), t32);
+        r = _mm_unpacklo_epi8(t31, _mm_unpackhi_epi64(t32, t32));
+    }
+
+    // Яркость 8 пикселей в 16-битных ячейках (сумма до 56228 — без знака помещается)
+    inline __m128i luma8(__m128i r, __m128i g, __m128i b) {
+        __m128i sum = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(66)),
+                                                  _mm_mullo_epi16(g, _mm_set1_epi16(129))),
+                                    _mm_add_epi16(_mm_mullo_epi16(b, _mm_set1_epi16(25)), _mm_set1_epi16(128)));
+        return _mm_add_epi16(_mm_srli_epi16(sum, 8), _mm_set1_epi16(16));
+    }
+
+    inline __m128i luma16(__m128i r, __m128i g, __m128i b) {
+        const __m128i zero = _mm_setzero_si128();
+        __m128i lo = luma8(_mm_unpacklo_epi8(r, zero), _mm_unpacklo_epi8(g, zero), _mm_unpacklo_epi8(b, zero));
+        __m128i hi = luma8(_mm_unpackhi_epi8(r, zero), _mm_unpackhi_epi8(g, zero), _mm_unpackhi_epi8(b, zero));
+        return _mm_packus_epi16(lo, hi);
+    }
+
+    // Сумма канала по квадратам 2x2: 16 пикселей двух строк -> 8 сумм
+    inline __m128i sum2x2(__m128i row0, __m128i row1) {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i ones = _mm_set1_epi16(1);
+        __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(row0, zero), _mm_unpacklo_epi8(row1, zero));
+        __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(row0, zero), _mm_unpackhi_epi8(row1, zero));
+        return _mm_packs_epi32(_mm_madd_epi16(lo, ones), _mm_madd_epi16(hi, ones));
+    }
+
+    // Цветность по средним значениям 8 квадратов, коэффициенты со знаком
+    inline __m128i chroma8(__m128i r, __m128i g, __m128i b, short cr, short cg, short cb) {
+        __m128i sum = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(r, _mm_set1_epi16(cr)),
+                                                  _mm_mullo_epi16(g, _mm_set1_epi16(cg))),
+                                    _mm_add_epi16(_mm_mullo_epi16(b, _mm_set1_epi16(cb)), _mm_set1_epi16(128)));
+        return _mm_add_epi16(_mm_srai_epi16(sum, 8), _mm_set1_epi16(128));
+    }
+#endif
+}
+
+void bgr_to_yuv420(const unsigned char* const* rows, int width, int height,
+                   unsigned char* y_plane, unsigned char* u_plane, unsigned char* v_plane) {
+    const int cw = (width + 1) / 2;
+    for (int y = 0; y < height; y += 2) {
+        const unsigned char* row0 = rows[y];
+        const unsigned char* row1 = rows[std::min(y + 1, height - 1)];
+        unsigned char* y0 = y_plane + static_cast<size_t>(y) * width;
+        // Для нечетной высоты вторая строка пишется поверх первой
+        unsigned char* y1 = y + 1 < height ? y0 + width : y0;
+        unsigned char* u = u_plane + static_cast<size_t>(y / 2) * cw;
+        unsigned char* v = v_plane + static_cast<size_t>(y / 2) * cw;
+        int x = 0;
+#ifdef VIDEO_USE_SSE
+        for (; x + 16 <= width; x += 16) {
+            __m128i b0, g0, r0, b1, g1, r1;
+            deinterleave_bgr(row0 + x * 3, b0, g0, r0);
+            deinterleave_bgr(row1 + x * 3, b1, g1, r1);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(y1 + x), luma16(r1, g1, b1));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(y0 + x), luma16(r0, g0, b0));
+
+            const __m128i two = _mm_set1_epi16(2);
+            __m128i r = _mm_srli_epi16(_mm_add_epi16(sum2x2(r0, r1), two), 2);
+            __m128i g = _mm_srli_epi16(_mm_add_epi16(sum2x2(g0, g1), two), 2);
+            __m128i b = _mm_srli_epi16(_mm_add_epi16(sum2x2(b0, b1), two), 2);
+            __m128i cu = chroma8(r, g, b, -38, -74, 112);
+            __m128i cv = chroma8(r, g, b, 112, -94, -18);
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(u + x / 2), _mm_packus_epi16(cu, cu));
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(v + x / 2), _mm_packus_epi16(cv, cv));
+        }
+#endif
+        convert_tail(row0, row1, x, width, y0, y1, u, v);
+    }
+}
+
+VideoFormat video_format(const std::string& path) {
+    size_t dot = path.find_last_of('.');
+    if (dot == std::string::npos) return VIDEO_Y4M;
+    std::string ext = path.substr(dot + 1);
+    if (ext == "rgb" || ext == "raw" || ext == "bgr") return VIDEO_RAW;
+    return VIDEO_Y4M;
+}
+
+VideoStream::VideoStream()
+    : file_(NULL), owns_file_(false), format_(VIDEO_Y4M), fps_(25),
+      width_(0), height_(0), bytespp_(0), frames_(0) {
+}
+
+VideoStream::~VideoStream() {
+    close();
+}
+
+bool VideoStream::open(const char* path, VideoFormat format, int fps) {
+    close();
+    format_ = format;
+    fps_ = std::max(1, fps);
+    width_ = height_ = bytespp_ = 0;
+    frames_ = 0;
+    if (!strcmp(path, "-")) {
+#ifdef _WIN32
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        file_ = stdout;
+        owns_file_ = false;
+    }
+    else {
+        // fopen подходит и для именованного канала: открытие ждет читателя
+        file_ = fopen(path, "wb");
+        owns_file_ = true;
+        if (!file_) {
+            std::cerr << "can't open file " << path << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+bool VideoStream::write_frame(TGAImage& image, bool bottom_up) {
+    if (!file_) return false;
+    TRACE_SCOPE("video frame");
+    int width = image.get_width();
+    int height = image.get_height();
+    int bpp = image.get_bytespp();
+    if (frames_ == 0) {
+        width_ = width;
+        height_ = height;
+        bytespp_ = bpp;
+        if (format_ == VIDEO_Y4M) {
+            if (bpp != TGAImage::RGB) {
+                std::cerr << "ERROR: Y4M output needs an RGB frame" << std::endl;
+                return false;
+            }
+            fprintf(file_, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg XYSCSS=420JPEG XCOLORRANGE=LIMITED\n",
+                    width, height, fps_);
+        }
+    }
+    else if (width != width_ || height != height_ || bpp != bytespp_) {
+        std::cerr << "ERROR: video frame size changed" << std::endl;
+        return false;
+    }
+
+    const unsigned char* data = image.buffer();
+    const size_t stride = static_cast<size_t>(width) * bpp;
+    std::vector<const unsigned char*> rows(height);
+    for (int y = 0; y < height; y++) {
+        rows[y] = data + stride * (bottom_up ? height - 1 - y : y);
+    }
+
+    if (format_ == VIDEO_RAW) {
+        if (!bottom_up) {
+            if (fwrite(data, stride * height, 1, file_) != 1) return false;
+        }
+        else {
+            for (int y = 0; y < height; y++) {
+                if (fwrite(rows[y], stride, 1, file_) != 1) return false;
+            }
+        }
+    }
+    else {
+        size_t luma_size = static_cast<size_t>(width) * height;
+        size_t chroma_size = static_cast<size_t>((width + 1) / 2) * ((height + 1) / 2);
+        planes_.resize(luma_size + 2 * chroma_size);
+        unsigned char* y_plane = planes_.data();
+        bgr_to_yuv420(rows.data(), width, height, y_plane, y_plane + luma_size, y_plane + luma_size + chroma_size);
+        if (fputs("FRAME\n", file_) < 0 || fwrite(planes_.data(), planes_.size(), 1, file_) != 1) return false;
+    }
+    // Читатель на другом конце канала получает кадр сразу
+    fflush(file_);
+    frames_++;
+    return true;
+}
+
+bool VideoStream::close() {
+    if (!file_) return true;
+    bool ok = fflush(file_) == 0;
+    if (owns_file_) ok = fclose(file_) == 0 && ok;
+    file_ = NULL;
+    return ok;
+}
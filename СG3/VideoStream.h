@@ -0,0 +1,54 @@
+﻿#ifndef VIDEO_STREAM_H
+#define VIDEO_STREAM_H
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "tgaimage.h"
+
+enum VideoFormat {
+    VIDEO_Y4M,  // YUV4MPEG2, 4:2:0, BT.601 limited range
+    VIDEO_RAW   // пиксели кадра как есть: bgr24 (bgra, gray для других форматов)
+};
+
+// .y4m — Y4M, .rgb/.raw/.bgr — сырые кадры, остальное (и "-") — Y4M
+VideoFormat video_format(const std::string& path);
+
+// Поток кадров в stdout ("-"), FIFO или файл для внешнего кодера.
+// Кадры читаются прямо из buffer(): сырой поток пишется строками из буфера
+// кадра без копий, для Y4M в промежуточные плоскости идет только результат
+// преобразования. Заголовок пишется по размеру первого кадра
+class VideoStream {
+public:
+    VideoStream();
+    ~VideoStream();
+
+    bool open(const char* path, VideoFormat format, int fps = 25);
+    // bottom_up — строки в буфере снизу вверх (кадр не перевернут)
+    bool write_frame(TGAImage& image, bool bottom_up);
+    bool close();
+
+    int frames() const { return frames_; }
+
+private:
+    FILE* file_;
+    bool owns_file_;
+    VideoFormat format_;
+    int fps_;
+    int width_;
+    int height_;
+    int bytespp_;
+    int frames_;
+    std::vector<unsigned char> planes_;
+
+    VideoStream(const VideoStream&);
+    VideoStream& operator=(const VideoStream&);
+};
+
+// BGR (3 байта на пиксель) в плоскости Y (width x height) и U, V
+// ((width+1)/2 x (height+1)/2), цвет усредняется по квадрату 2x2.
+// rows[y] — начало строки y сверху
+void bgr_to_yuv420(const unsigned char* const* rows, int width, int height,
+                   unsigned char* y_plane, unsigned char* u_plane, unsigned char* v_plane);
+
+#endif
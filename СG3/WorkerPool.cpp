@@ -0,0 +1,105 @@
+﻿#include <sstream>
+#include "WorkerPool.h"
+#include "Trace.h"
+
+namespace {
+    void name_worker(int index) {
+        std::ostringstream name;
+        name << "render worker " << index;
+        trace::set_thread_name(name.str());
+    }
+}
+
+WorkerPool& WorkerPool::instance() {
+    static WorkerPool pool;
+    return pool;
+}
+
+WorkerPool::WorkerPool() : fn_(NULL), context_(NULL), threads_(0), pending_(0), generation_(0), stopping_(false) {
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    start_.notify_all();
+    for (size_t i = 0; i < workers_.size(); i++) {
+        workers_[i].join();
+    }
+}
+
+int WorkerPool::size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return static_cast<int>(workers_.size());
+}
+
+void WorkerPool::worker(int index) {
+    bool named = false;
+    unsigned seen = 0;
+    for (;;) {
+        void (*fn)(void*, int);
+        void* context;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            start_.wait(lock, [&]() { return stopping_ || generation_ != seen; });
+            if (stopping_) return;
+            seen = generation_;
+            if (index >= threads_) continue;
+            fn = fn_;
+            context = context_;
+        }
+        if (!named && trace::enabled()) {
+            name_worker(index);
+            named = true;
+        }
+        fn(context, index);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (--pending_ == 0) done_.notify_one();
+        }
+    }
+}
+
+void WorkerPool::run(int threads, void (*fn)(void*, int), void* context) {
+    if (threads <= 1) {
+        fn(context, 0);
+        return;
+    }
+    std::unique_lock<std::mutex> busy(run_mutex_, std::try_to_lock);
+    if (!busy.owns_lock()) {
+        run_detached(threads, fn, context);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        // Пул растет до наибольшего запрошенного числа потоков и не сжимается
+        while (static_cast<int>(workers_.size()) < threads - 1) {
+            int index = static_cast<int>(workers_.size()) + 1;
+            workers_.push_back(std::thread(&WorkerPool::worker, this, index));
+        }
+        fn_ = fn;
+        context_ = context;
+        threads_ = threads;
+        pending_ = threads - 1;
+        generation_++;
+    }
+    start_.notify_all();
+    fn(context, 0);
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [&]() { return pending_ == 0; });
+}
+
+void WorkerPool::run_detached(int threads, void (*fn)(void*, int), void* context) {
+    std::vector<std::thread> workers;
+    for (int t = 1; t < threads; t++) {
+        workers.push_back(std::thread([fn, context, t]() {
+            if (trace::enabled()) name_worker(t);
+            fn(context, t);
+        }));
+    }
+    fn(context, 0);
+    for (size_t t = 0; t < workers.size(); t++) {
+        workers[t].join();
+    }
+}
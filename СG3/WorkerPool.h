@@ -0,0 +1,58 @@
+﻿#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Постоянные рабочие потоки рендера: запуск потоков на каждый проход
+// растеризации стоит выделений памяти и системных вызовов в каждом кадре.
+// Задание получает номер потока 0..threads-1, нулевой выполняет вызывающий.
+// Если пул занят (вложенный или параллельный вызов из другого потока),
+// задание выполняется на временных потоках, как раньше
+class WorkerPool {
+public:
+    static WorkerPool& instance();
+
+    ~WorkerPool();
+
+    // Выполняет fn(thread_index) на threads потоках и ждет завершения всех
+    template <class F>
+    void run(int threads, F& fn) {
+        run(threads, &call<F>, &fn);
+    }
+
+    void run(int threads, void (*fn)(void*, int), void* context);
+
+    // Число запущенных потоков пула (без вызывающего)
+    int size() const;
+
+private:
+    WorkerPool();
+
+    template <class F>
+    static void call(void* fn, int t) {
+        (*static_cast<F*>(fn))(t);
+    }
+
+    void worker(int index);
+    void run_detached(int threads, void (*fn)(void*, int), void* context);
+
+    std::mutex run_mutex_;   // одно задание пула за раз
+    mutable std::mutex mutex_;
+    std::condition_variable start_;
+    std::condition_variable done_;
+    std::vector<std::thread> workers_;
+    void (*fn_)(void*, int);
+    void* context_;
+    int threads_;            // участники текущего задания
+    int pending_;            // рабочие, еще не закончившие задание
+    unsigned generation_;    // номер задания, рабочие ждут его смены
+    bool stopping_;
+
+    WorkerPool(const WorkerPool&);
+    WorkerPool& operator=(const WorkerPool&);
+};
+
+#endif
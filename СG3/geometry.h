@@ -1,6 +1,7 @@
 #ifndef __GEOMETRY_H__
 #define __GEOMETRY_H__
 
+#include <algorithm>
 #include <cmath>
 #include <vector>
 #include <iostream>
@@ -331,4 +332,30 @@ inline Matrix v42m(const Vec4f& v) {
     return m;
 }
 
+//   4x4 (-    ).
+//     
+inline Matrix inverse(const Matrix& m) {
+    Matrix a = m;
+    Matrix inv = Matrix::identity();
+    for (int c = 0; c < 4; c++) {
+        int pivot = c;
+        for (int r = c + 1; r < 4; r++) {
+            if (std::abs(a[r][c]) > std::abs(a[pivot][c])) pivot = r;
+        }
+        if (a[pivot][c] == 0.f) return Matrix();
+        std::swap(a[c], a[pivot]);
+        std::swap(inv[c], inv[pivot]);
+        float k = 1.f / a[c][c];
+        a[c] = a[c] * k;
+        inv[c] = inv[c] * k;
+        for (int r = 0; r < 4; r++) {
+            if (r == c || a[r][c] == 0.f) continue;
+            float f = a[r][c];
+            a[r] = a[r] - a[c] * f;
+            inv[r] = inv[r] - inv[c] * f;
+        }
+    }
+    return inv;
+}
+
 #endif
\ No newline at end of file
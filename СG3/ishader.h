@@ -1,14 +1,58 @@
-#ifndef __ISHADER_H__
+﻿#ifndef __ISHADER_H__
 #define __ISHADER_H__
 
+#include <algorithm>
 #include "tgaimage.h"
 #include "geometry.h"
 
+class FrameArena;
+
+// Ограничение линейного цвета [0, 1] и перевод в 8 бит
+inline TGAColor quantize_color(const Vec4f& c) {
+    int r = static_cast<int>(255 * std::min(1.0f, std::max(0.0f, c.x)));
+    int g = static_cast<int>(255 * std::min(1.0f, std::max(0.0f, c.y)));
+    int b = static_cast<int>(255 * std::min(1.0f, std::max(0.0f, c.z)));
+    int a = static_cast<int>(255 * std::min(1.0f, std::max(0.0f, c.w)));
+    return TGAColor(r, g, b, a);
+}
+
 class IShader {
 public:
+    // Координаты текущего фрагмента: x, y в пикселях и глубина, заполняет растеризатор
+    Vec3f gl_FragCoord;
+
     virtual ~IShader() {}
     virtual Vec4f vertex(int iface, int nthvert) = 0;
     virtual bool fragment(Vec3f bar, TGAColor& color) = 0;
+
+    // Вершинная стадия с кэшем (draw_meshlets): каждая вершина кластера шейдится
+    // один раз в vertex_varying(), ее выходы — varying_size() float в out. Перед
+    // растеризацией грани load_varyings() получает выходы трех ее вершин и
+    // считает то, что относится к грани целиком. Выходы вершины должны зависеть
+    // только от индексов ее позиции, UV и нормали. По умолчанию кэш пуст,
+    // а load_varyings() заново вызывает vertex() для трех вершин грани
+    virtual int varying_size() const { return 0; }
+    virtual Vec4f vertex_varying(int iface, int nthvert, float* /*out*/) { return vertex(iface, nthvert); }
+    virtual void load_varyings(int iface, const float* const* /*varyings*/) {
+        for (int j = 0; j < 3; j++) {
+            vertex(iface, j);
+        }
+    }
+
+    // Копия шейдера для другого потока растеризации; NULL — шейдер однопоточный
+    virtual IShader* clone() const { return NULL; }
+    // То же в памяти кадровой арены: копию разрушает FrameArena::destroy(), не delete.
+    // NULL — шейдер так не умеет, копия берется из clone()
+    virtual IShader* clone_in(FrameArena& /*arena*/) const { return NULL; }
+
+    // Линейный цвет фрагмента без ограничения и квантования (для HDR-буфера).
+    // По умолчанию выводится из 8-битного fragment()
+    virtual bool fragment_linear(Vec3f bar, Vec4f& color) {
+        TGAColor c;
+        bool discard = fragment(bar, c);
+        color = Vec4f(c.r / 255.f, c.g / 255.f, c.b / 255.f, c.a / 255.f);
+        return discard;
+    }
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -3,16 +3,69 @@
 #include <sstream>
 #include <vector>
 #include <string>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <thread>
 #include "model.h"
+#include "Trace.h"
 
-Model::Model(const char* filename) {
+namespace {
+    //  fn(begin, end)    [0, count)   
+    template <class F>
+    void parallel_ranges(int count, F fn) {
+        int threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+        threads = std::max(1, std::min(threads, count / 1024));
+        int chunk = (count + threads - 1) / threads;
+        std::vector<std::thread> workers;
+        for (int t = 1; t < threads; t++) {
+            int begin = std::min(count, t * chunk);
+            int end = std::min(count, begin + chunk);
+            workers.push_back(std::thread(fn, begin, end));
+        }
+        fn(0, std::min(count, chunk));
+        for (size_t t = 0; t < workers.size(); t++) {
+            workers[t].join();
+        }
+    }
+
+    //   ;    ( ,
+    // NaN    )     NaN
+    Vec3f triangle_normal(const Vec3f& v0, const Vec3f& v1, const Vec3f& v2) {
+        Vec3f n = cross(v1 - v0, v2 - v0);
+        float len = n.norm();
+        if (!(len > 0.f) || !std::isfinite(len)) return Vec3f(0, 0, 0);
+        return n.normalize();
+    }
+
+    bool is_zero(const Vec3f& n) {
+        return n.x == 0.f && n.y == 0.f && n.z == 0.f;
+    }
+}
+
+Model::Model() : quantized_(false) {
+}
+
+Model::Model(const char* filename) : quantized_(false) {
+    TRACE_SCOPE("Model::Model");
     std::ifstream in;
     in.open(filename, std::ifstream::in);
     if (in.fail()) {
         std::cerr << "Failed to open file: " << filename << std::endl;
         return;
     }
+    load(in);
+    std::cerr << "# v# " << verts_.size() << " f# " << faces_.size() 
+              << " vt# " << uv_.size() << " vn# " << norms_.size() << std::endl;
+}
+
+Model::Model(const char* data, size_t size) : quantized_(false) {
+    TRACE_SCOPE("Model::Model");
+    std::istringstream in(std::string(data, size));
+    load(in);
+}
 
+void Model::load(std::istream& in) {
     std::string line;
     while (!in.eof()) {
         std::getline(in, line);
@@ -84,15 +137,238 @@ Model::Model(const char* filename) {
         }
     }
 
-    std::cerr << "# v# " << verts_.size() << " f# " << faces_.size() 
-              << " vt# " << uv_.size() << " vn# " << norms_.size() << std::endl;
+    //       
+    size_t kept = 0;
+    for (size_t i = 0; i < faces_.size(); i++) {
+        bool valid = true;
+        for (size_t k = 0; k < faces_[i].size(); k++) {
+            valid = valid && faces_[i][k] >= 0 && faces_[i][k] < (int)verts_.size();
+        }
+        if (!valid) continue;
+        faces_[kept] = faces_[i];
+        faces_uv_[kept] = faces_uv_[i];
+        faces_norms_[kept] = faces_norms_[i];
+        kept++;
+    }
+    faces_.resize(kept);
+    faces_uv_.resize(kept);
+    faces_norms_.resize(kept);
+
+    //      ,       
+    compute_face_normals();
+    for (size_t i = 0; i < faces_norms_.size(); i++) {
+        if (std::find(faces_norms_[i].begin(), faces_norms_[i].end(), -1) != faces_norms_[i].end()) {
+            generate_normals();
+            break;
+        }
+    }
+}
+
+Model::Model(const Model& base, const std::vector<std::vector<int> >& faces,
+             const std::vector<std::vector<int> >& faces_uv, const std::vector<std::vector<int> >& faces_norms)
+    : verts_(base.verts_), norms_(base.norms_), uv_(base.uv_),
+      faces_(faces), faces_norms_(faces_norms), faces_uv_(faces_uv),
+      quantized_(base.quantized_), qverts_(base.qverts_), qnorms_(base.qnorms_), quv_(base.quv_),
+      position_range_(base.position_range_), uv_range_(base.uv_range_) {
+    compute_face_normals();
+}
+
+void Model::assign(const std::vector<Vec3f>& verts, const std::vector<Vec3f>& norms, const std::vector<Vec2f>& uvs,
+                   const std::vector<int>& corners) {
+    verts_ = verts;
+    norms_ = norms;
+    uv_ = uvs;
+    quantized_ = false;
+    qverts_.clear();
+    qnorms_.clear();
+    quv_.clear();
+
+    //       
+    const size_t ntriangles = corners.size() / 9;
+    faces_.resize(ntriangles);
+    faces_uv_.resize(ntriangles);
+    faces_norms_.resize(ntriangles);
+    for (size_t i = 0; i < ntriangles; i++) {
+        const int* c = &corners[i * 9];
+        faces_[i].assign(c, c + 3);
+        faces_uv_[i].assign(c + 3, c + 6);
+        faces_norms_[i].assign(c + 6, c + 9);
+    }
+    //      :  
+    //   ,      
+    compute_face_normals();
+}
+
+void Model::compute_face_normals() {
+    face_normals_.assign(faces_.size(), Vec3f(0, 0, 0));
+    parallel_ranges(nfaces(), [this](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            const std::vector<int>& f = faces_[i];
+            if (f.size() < 3) continue;
+            face_normals_[i] = triangle_normal(position(f[0]), position(f[1]), position(f[2]));
+        }
+    });
+}
+
+void Model::generate_normals(float crease_angle, bool replace) {
+    TRACE_SCOPE("Model::generate_normals");
+    if (quantized_) {
+        std::cerr << "generate_normals() needs float attributes, call it before quantize()" << std::endl;
+        return;
+    }
+    const int nf = nfaces();
+    const int nv = nverts();
+
+    //     (CSR)
+    std::vector<int> offsets(nv + 1, 0);
+    for (int i = 0; i < nf; i++) {
+        for (size_t k = 0; k < faces_[i].size(); k++) offsets[faces_[i][k] + 1]++;
+    }
+    for (int v = 0; v < nv; v++) offsets[v + 1] += offsets[v];
+    std::vector<int> incident(offsets[nv]);
+    std::vector<int> fill(offsets.begin(), offsets.end() - 1);
+    for (int i = 0; i < nf; i++) {
+        for (size_t k = 0; k < faces_[i].size(); k++) incident[fill[faces_[i][k]]++] = i;
+    }
+
+    //   :         
+    // ,     .   (
+    // )    ,         
+    const float cos_crease = std::cos(crease_angle * 3.14159265f / 180.f);
+    std::vector<std::vector<Vec3f> > corner_normals(nf);
+    parallel_ranges(nf, [&](int begin, int end) {
+        for (int i = begin; i < end; i++) {
+            const std::vector<int>& f = faces_[i];
+            corner_normals[i].assign(f.size(), Vec3f(0, 0, 0));
+            const bool degenerate = is_zero(face_normals_[i]);
+            for (size_t k = 0; k < f.size(); k++) {
+                if (!replace && k < faces_norms_[i].size() && faces_norms_[i][k] >= 0) continue;
+                int v = f[k];
+                Vec3f n(0, 0, 0);
+                for (int j = offsets[v]; j < offsets[v + 1]; j++) {
+                    int g = incident[j];
+                    if (is_zero(face_normals_[g])) continue;
+                    if (!degenerate && face_normals_[g] * face_normals_[i] < cos_crease) continue;
+                    const std::vector<int>& fg = faces_[g];
+                    size_t c = std::find(fg.begin(), fg.end(), v) - fg.begin();
+                    Vec3f e1 = verts_[fg[(c + 1) % fg.size()]] - verts_[v];
+                    Vec3f e2 = verts_[fg[(c + fg.size() - 1) % fg.size()]] - verts_[v];
+                    float cos_a = e1.normalize() * e2.normalize();
+                    n = n + face_normals_[g] * std::acos(std::max(-1.f, std::min(1.f, cos_a)));
+                }
+                corner_normals[i][k] = n.norm() > 0.f ? n.normalize() : face_normals_[i];
+            }
+        }
+    });
+
+    //        norms_  
+    std::vector<std::vector<int> > vertex_normals(nv);
+    for (int i = 0; i < nf; i++) {
+        const std::vector<int>& f = faces_[i];
+        faces_norms_[i].resize(f.size(), -1);
+        for (size_t k = 0; k < f.size(); k++) {
+            if (!replace && faces_norms_[i][k] >= 0) continue;
+            const Vec3f& n = corner_normals[i][k];
+            std::vector<int>& known = vertex_normals[f[k]];
+            int index = -1;
+            for (size_t j = 0; j < known.size() && index < 0; j++) {
+                const Vec3f& m = norms_[known[j]];
+                if (m.x == n.x && m.y == n.y && m.z == n.z) index = known[j];
+            }
+            if (index < 0) {
+                index = static_cast<int>(norms_.size());
+                norms_.push_back(n);
+                known.push_back(index);
+            }
+            faces_norms_[i][k] = index;
+        }
+    }
+}
+
+void Model::quantize(QuantizeStats* stats) {
+    TRACE_SCOPE("Model::quantize");
+    if (quantized_) return;
+    QuantizeStats report;
+    report.bytes_before = attribute_bytes();
+
+    //    AABB:    1/65535    
+    Vec3f lo(0, 0, 0), hi(0, 0, 0);
+    for (size_t i = 0; i < verts_.size(); i++) {
+        for (int k = 0; k < 3; k++) {
+            lo[k] = i ? std::min(lo[k], verts_[i][k]) : verts_[i][k];
+            hi[k] = i ? std::max(hi[k], verts_[i][k]) : verts_[i][k];
+        }
+    }
+    //  :     float  
+    for (int k = 0; k < 3; k++) {
+        position_range_.set(k, lo[k], hi[k]);
+        float rounding = 2.f * std::numeric_limits<float>::epsilon() * std::max(std::fabs(lo[k]), std::fabs(hi[k]));
+        report.position_bound = std::max(report.position_bound, position_range_.scale[k] * 0.5f + rounding);
+    }
+    qverts_.resize(verts_.size());
+    for (size_t i = 0; i < verts_.size(); i++) {
+        QuantizedPosition& q = qverts_[i];
+        q.x = position_range_.encode(0, verts_[i].x);
+        q.y = position_range_.encode(1, verts_[i].y);
+        q.z = position_range_.encode(2, verts_[i].z);
+        q.w = 0;
+        Vec3f d = decode_position(q, position_range_) - verts_[i];
+        report.position_error = std::max(report.position_error,
+                                         std::max(std::fabs(d.x), std::max(std::fabs(d.y), std::fabs(d.z))));
+    }
+
+    //   atan2(|a x b|, a * b): acos     1
+    //  float       
+    float max_angle = 0.f;
+    qnorms_.resize(norms_.size());
+    for (size_t i = 0; i < norms_.size(); i++) {
+        qnorms_[i] = oct_encode(norms_[i]);
+        Vec3f n = norms_[i];
+        if (n.norm() <= 0.f) continue;
+        n.normalize();
+        Vec3f d = oct_decode(qnorms_[i]);
+        max_angle = std::max(max_angle, std::atan2(cross(d, n).norm(), d * n));
+    }
+    report.normal_error = max_angle * 180.f / 3.14159265f;
+
+    // UV    [0, 1] ( ),    
+    Vec2f uv_lo(0, 0), uv_hi(0, 0);
+    for (size_t i = 0; i < uv_.size(); i++) {
+        for (int k = 0; k < 2; k++) {
+            uv_lo[k] = i ? std::min(uv_lo[k], uv_[i][k]) : uv_[i][k];
+            uv_hi[k] = i ? std::max(uv_hi[k], uv_[i][k]) : uv_[i][k];
+        }
+    }
+    uv_range_.set(0, uv_lo.x, uv_hi.x);
+    uv_range_.set(1, uv_lo.y, uv_hi.y);
+    quv_.resize(uv_.size());
+    for (size_t i = 0; i < uv_.size(); i++) {
+        quv_[i] = encode_uv(uv_[i], uv_range_);
+        Vec2f d = decode_uv(quv_[i], uv_range_) - uv_[i];
+        report.uv_error = std::max(report.uv_error, std::max(std::fabs(d.x), std::fabs(d.y)));
+    }
+
+    std::vector<Vec3f>().swap(verts_);
+    std::vector<Vec3f>().swap(norms_);
+    std::vector<Vec2f>().swap(uv_);
+    quantized_ = true;
+    report.bytes_after = attribute_bytes();
+    if (stats) *stats = report;
+}
+
+size_t Model::attribute_bytes() const {
+    if (quantized_) {
+        return qverts_.size() * sizeof(QuantizedPosition) + qnorms_.size() * sizeof(uint32_t) +
+               quv_.size() * sizeof(uint32_t);
+    }
+    return verts_.size() * sizeof(Vec3f) + norms_.size() * sizeof(Vec3f) + uv_.size() * sizeof(Vec2f);
 }
 
 Model::~Model() {
 }
 
 int Model::nverts() {
-    return (int)verts_.size();
+    return (int)(quantized_ ? qverts_.size() : verts_.size());
 }
 
 int Model::nfaces() {
@@ -100,11 +376,11 @@ int Model::nfaces() {
 }
 
 Vec3f Model::vert(int i) {
-    if (i < 0 || i >= verts_.size()) {
+    if (i < 0 || i >= nverts()) {
         std::cerr << "vert index out of range: " << i << std::endl;
         return Vec3f(0, 0, 0);
     }
-    return verts_[i];
+    return position(i);
 }
 
 Vec3f Model::vert(int iface, int nthvert) {
@@ -116,36 +392,39 @@ Vec3f Model::vert(int iface, int nthvert) {
         std::cerr << "vertex index out of range in face: " << iface << ", " << nthvert << std::endl;
         return Vec3f(0, 0, 0);
     }
-    return verts_[faces_[iface][nthvert]];
+    return position(faces_[iface][nthvert]);
 }
 
 Vec3f Model::normal(int iface, int nthvert) {
     //           
-    if (norms_.empty() || faces_norms_.empty() || 
+    if (normal_count() == 0 || faces_norms_.empty() || 
         iface < 0 || iface >= faces_norms_.size() ||
         nthvert < 0 || nthvert >= faces_norms_[iface].size() ||
         faces_norms_[iface][nthvert] == -1) {
         
-        //    
-        Vec3f v0 = vert(iface, 0);
-        Vec3f v1 = vert(iface, 1);
-        Vec3f v2 = vert(iface, 2);
-        Vec3f n = cross((v2 - v0), (v1 - v0));
-        n.normalize();
-        return n;
+        //  ,   
+        return face_normal(iface);
     }
 
     int normal_index = faces_norms_[iface][nthvert];
-    if (normal_index < 0 || normal_index >= norms_.size()) {
+    if (normal_index < 0 || normal_index >= normal_count()) {
         std::cerr << "Normal index out of range: " << normal_index << std::endl;
         return Vec3f(0, 1, 0); //   
     }
 
-    return norms_[normal_index];
+    return quantized_ ? oct_decode(qnorms_[normal_index]) : norms_[normal_index];
+}
+
+Vec3f Model::face_normal(int iface) {
+    if (iface < 0 || iface >= face_normals_.size()) {
+        std::cerr << "face index out of range: " << iface << std::endl;
+        return Vec3f(0, 1, 0);
+    }
+    return face_normals_[iface];
 }
 
 Vec2f Model::uv(int iface, int nthvert) {
-    if (uv_.empty() || faces_uv_.empty() || 
+    if (uv_count() == 0 || faces_uv_.empty() || 
         iface < 0 || iface >= faces_uv_.size() ||
         nthvert < 0 || nthvert >= faces_uv_[iface].size() ||
         faces_uv_[iface][nthvert] == -1) {
@@ -153,12 +432,12 @@ Vec2f Model::uv(int iface, int nthvert) {
     }
 
     int uv_index = faces_uv_[iface][nthvert];
-    if (uv_index < 0 || uv_index >= uv_.size()) {
+    if (uv_index < 0 || uv_index >= uv_count()) {
         std::cerr << "UV index out of range: " << uv_index << std::endl;
         return Vec2f(0, 0);
     }
 
-    return uv_[uv_index];
+    return quantized_ ? decode_uv(quv_[uv_index], uv_range_) : uv_[uv_index];
 }
 
 std::vector<int> Model::face(int idx) {
@@ -167,4 +446,20 @@ std::vector<int> Model::face(int idx) {
         return std::vector<int>();
     }
     return faces_[idx];
+}
+
+int Model::uv_index(int iface, int nthvert) {
+    if (iface < 0 || iface >= faces_uv_.size() ||
+        nthvert < 0 || nthvert >= faces_uv_[iface].size()) {
+        return -1;
+    }
+    return faces_uv_[iface][nthvert];
+}
+
+int Model::normal_index(int iface, int nthvert) {
+    if (iface < 0 || iface >= faces_norms_.size() ||
+        nthvert < 0 || nthvert >= faces_norms_[iface].size()) {
+        return -1;
+    }
+    return faces_norms_[iface][nthvert];
 }
\ No newline at end of file
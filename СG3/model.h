@@ -1,8 +1,27 @@
 #ifndef __MODEL_H__
 #define __MODEL_H__
 
+#include <cstddef>
+#include <cstdint>
+#include <istream>
 #include <vector>
 #include "geometry.h"
+#include "Quantize.h"
+
+// Result of Model::quantize(): memory of the vertex attribute arrays and decode error
+struct QuantizeStats {
+    size_t bytes_before;  // float positions, normals and uvs
+    size_t bytes_after;   // 16-bit codes
+    float position_error; // max |decoded - original| over all coordinates, model units
+    float position_bound; // half a quantization step on the longest AABB axis
+    float normal_error;   // max angle between decoded and original normals, degrees
+    float uv_error;       // max |decoded - original| over all texture coordinates
+
+    QuantizeStats()
+        : bytes_before(0), bytes_after(0), position_error(0.f), position_bound(0.f), normal_error(0.f),
+          uv_error(0.f) {
+    }
+};
 
 class Model {
 private:
@@ -12,17 +31,64 @@ private:
     std::vector<std::vector<int> > faces_;
     std::vector<std::vector<int> > faces_norms_;
     std::vector<std::vector<int> > faces_uv_;
+    std::vector<Vec3f> face_normals_;
+
+    // Compact attributes after quantize(); the float arrays above are released
+    bool quantized_;
+    std::vector<QuantizedPosition> qverts_;
+    std::vector<uint32_t> qnorms_; // octahedral 2 x snorm16
+    std::vector<uint32_t> quv_;    // 2 x unorm16
+    QuantizeRange position_range_;
+    QuantizeRange uv_range_;
+
+    Vec3f position(int i) const {
+        return quantized_ ? decode_position(qverts_[i], position_range_) : verts_[i];
+    }
+    size_t normal_count() const { return quantized_ ? qnorms_.size() : norms_.size(); }
+    size_t uv_count() const { return quantized_ ? quv_.size() : uv_.size(); }
+
+    void compute_face_normals();
+    void load(std::istream& in);
 
 public:
+    // Empty model, filled by assign()
+    Model();
     Model(const char* filename);
+    // Parses OBJ text from memory (no file access, no console output)
+    Model(const char* data, size_t size);
+    // Model with the vertex/uv/normal arrays of base and a different face list (LOD levels)
+    Model(const Model& base, const std::vector<std::vector<int> >& faces,
+          const std::vector<std::vector<int> >& faces_uv, const std::vector<std::vector<int> >& faces_norms);
     ~Model();
+
+    // Replaces the contents with triangles: corners holds 9 ints per triangle
+    // (3 vertex, 3 uv, 3 normal indices into the given arrays, -1 = absent).
+    // Face lists keep their capacity, so a model reused for streamed chunks
+    // stops allocating once it has seen the largest chunk
+    void assign(const std::vector<Vec3f>& verts, const std::vector<Vec3f>& norms, const std::vector<Vec2f>& uvs,
+                const std::vector<int>& corners);
     int nverts();
     int nfaces();
     Vec3f vert(int i);
     Vec3f vert(int iface, int nthvert);
     Vec3f normal(int iface, int nthvert);
+    Vec3f face_normal(int iface);
     Vec2f uv(int iface, int nthvert);
     std::vector<int> face(int idx);
+    // Attribute indices of a face corner, -1 if absent
+    int uv_index(int iface, int nthvert);
+    int normal_index(int iface, int nthvert);
+
+    // Angle-weighted smooth vertex normals: faces whose normals differ by more than
+    // crease_angle degrees are not averaged. Fills corners without vn, or all corners if replace
+    void generate_normals(float crease_angle = 60.f, bool replace = false);
+
+    // Replaces positions, normals and uvs with 16-bit codes (half the memory and
+    // bandwidth); the accessors decode on the fly. One-way: call after generate_normals()
+    void quantize(QuantizeStats* stats = NULL);
+    bool quantized() const { return quantized_; }
+    // Memory of the position, normal and uv arrays in their current encoding
+    size_t attribute_bytes() const;
 };
 
 #endif
\ No newline at end of file
@@ -3,7 +3,9 @@
 #include <string.h>
 #include <time.h>
 #include <math.h>
+#include <algorithm>
 #include "tgaimage.h"
+#include "Trace.h"
 
 TGAImage::TGAImage() : data(NULL), width(0), height(0), bytespp(0) {
 }
@@ -146,6 +148,7 @@ bool TGAImage::load_rle_data(std::ifstream &in) {
 }
 
 bool TGAImage::write_tga_file(const char *filename, bool rle) {
+	TRACE_SCOPE("write_tga_file");
 	unsigned char developer_area_ref[4] = {0, 0, 0, 0};
 	unsigned char extension_area_ref[4] = {0, 0, 0, 0};
 	unsigned char footer[18] = {'T','R','U','E','V','I','S','I','O','N','-','X','F','I','L','E','.','\0'};
@@ -292,16 +295,13 @@ bool TGAImage::flip_horizontally() {
 bool TGAImage::flip_vertically() {
 	if (!data) return false;
 	unsigned long bytes_per_line = width*bytespp;
-	unsigned char *line = new unsigned char[bytes_per_line];
 	int half = height>>1;
+	// rows are swapped in place, no scratch line on the heap
 	for (int j=0; j<half; j++) {
-		unsigned long l1 = j*bytes_per_line;
-		unsigned long l2 = (height-1-j)*bytes_per_line;
-		memmove((void *)line,      (void *)(data+l1), bytes_per_line);
-		memmove((void *)(data+l1), (void *)(data+l2), bytes_per_line);
-		memmove((void *)(data+l2), (void *)line,      bytes_per_line);
+		unsigned char *l1 = data+j*bytes_per_line;
+		unsigned char *l2 = data+(height-1-j)*bytes_per_line;
+		std::swap_ranges(l1, l1+bytes_per_line, l2);
 	}
-	delete [] line;
 	return true;
 }
 
@@ -313,6 +313,13 @@ void TGAImage::clear() {
 	memset((void *)data, 0, width*height*bytespp);
 }
 
+void TGAImage::swap(TGAImage &img) {
+	std::swap(data, img.data);
+	std::swap(width, img.width);
+	std::swap(height, img.height);
+	std::swap(bytespp, img.bytespp);
+}
+
 bool TGAImage::scale(int w, int h) {
 	if (w<=0 || h<=0 || !data) return false;
 	unsigned char *tdata = new unsigned char[w*h*bytespp];
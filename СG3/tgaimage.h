@@ -91,6 +91,8 @@ public:
 	int get_bytespp();
 	unsigned char *buffer();
 	void clear();
+	// Exchanges pixel buffers without copying
+	void swap(TGAImage &img);
 };
 
 #endif //__IMAGE_H__
@@ -3,148 +3,650 @@
 #include "geometry.h"
 #include "ishader.h"
 #include "Camera.h"
-#include "ImprovedShader.h"
-#include "SimpleShader.h"
-#include "SmoothShader.h"
+#include "ShaderFactory.h"
+#include "Framebuffer.h"
+#include "Tonemap.h"
+#include "Lights.h"
+#include "Transparency.h"
+#include "Meshlet.h"
+#include "Renderer.h"
+#include "Lod.h"
+#include "Benchmark.h"
+#include "Golden.h"
+#include "MicroBench.h"
+#include "Trace.h"
+#include "OutputQueue.h"
+#include "VideoStream.h"
+#include "RelightCache.h"
+#include "Progressive.h"
+#include "BVH.h"
+#include "Arena.h"
+#include "MeshCache.h"
+#include "StreamRenderer.h"
+#include "ImageWriter.h"
 #include <limits>
 #include <algorithm>
 #include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 
-const int WIDTH = 800;
-const int HEIGHT = 800;
-
-Matrix viewport(int x, int y, int w, int h) {
-    Matrix m = Matrix::identity();
-    m[0][0] = w / 2.f;
-    m[1][1] = h / 2.f;
-    m[2][2] = 1.f;
-    m[0][3] = x + w / 2.f;
-    m[1][3] = y + h / 2.f;
-    return m;
+const int DEFAULT_WIDTH = 800;
+const int DEFAULT_HEIGHT = 800;
+
+void finish_trace(const char* path) {
+    if (path && !trace::stop(path)) {
+        std::cerr << "ERROR: cannot write trace " << path << std::endl;
+    }
 }
 
-Vec3f barycentric(Vec2f A, Vec2f B, Vec2f C, Vec2f P) {
-    Vec3f s[2];
-    for (int i = 2; i--; ) {
-        s[i][0] = C[i] - A[i];
-        s[i][1] = B[i] - A[i];
-        s[i][2] = A[i] - P[i];
-    }
-    Vec3f u = cross(s[0], s[1]);
-    if (std::abs(u[2]) > 1e-2)
-        return Vec3f(1.f - (u.x + u.y) / u.z, u.y / u.z, u.x / u.z);
-    return Vec3f(-1, 1, 1);
+// Имя файла кадра: шаблон номера в пути ("frame_%03d.tga") или номер перед расширением.
+// В шаблоне допускается ровно одно %d, %Nd или %0Nd (N до 32), другие '%' — ошибка (false).
+// Пишется в path, чтобы строка переиспользовала память от кадра к кадру
+bool frame_path(const char* pattern, int frame, std::string& path) {
+    char buf[64];
+    const char* token = strchr(pattern, '%');
+    if (token) {
+        const char* p = token + 1;
+        char pad = ' ';
+        if (*p == '0') {
+            pad = '0';
+            p++;
+        }
+        int width = 0;
+        while (*p >= '0' && *p <= '9' && width <= 32) {
+            width = width * 10 + (*p++ - '0');
+        }
+        if (*p != 'd' || width > 32 || strchr(p + 1, '%')) return false;
+        int digits = snprintf(buf, sizeof(buf), "%d", frame);
+        path.assign(pattern, token - pattern);
+        if (width > digits) path.append(width - digits, pad);
+        path.append(buf, digits);
+        path.append(p + 1);
+        return true;
+    }
+    path.assign(pattern);
+    size_t dot = path.find_last_of('.');
+    size_t slash = path.find_last_of("/\\");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) dot = path.size();
+    snprintf(buf, sizeof(buf), "_%04d", frame);
+    path.insert(dot, buf);
+    return true;
 }
 
-void triangle(mat<4, 3, float>& clipc, IShader& shader, TGAImage& image, float* zbuffer, float clip_plane = 0.0f) {
-    Matrix viewport_mat = viewport(0, 0, image.get_width(), image.get_height());
-    mat<3, 4, float> pts;
+int main(int argc, char** argv) {
+    const char* model_path = "obj/123456.obj";
+    const char* output_path = "output.tga";
+    int width = DEFAULT_WIDTH;
+    int height = DEFAULT_HEIGHT;
+    bool hdr = false;
+    float exposure = 1.f;
+    int nlights = 0;
+    const char* shader_name = "simple";
+    float opacity = 1.f;
+    long oit_budget = -1;
+    float fov = 0.f;
+    DepthFormat depth_format = DEPTH_FLOAT32;
+    RenderOptions options;
+    bool use_meshlets = true;
+    float lod_error = 0.f;
+    float crease_angle = -1.f;
+    bool model_given = false;
+    bool print_stats = false;
+    bool alloc_stats = false;
+    bool quantize = false;
+    bool stream = false;
+    size_t stream_memory = 256 << 20;
+    const char* cache_path = NULL;
+    const char* trace_path = NULL;
+    PipelineStats stats;
+    bool benchmark = false;
+    BenchmarkOptions bench;
+    bool golden = false;
+    bool microbenchmarks = false;
+    std::string microbench_filter;
+    std::string microbench_json;
+    GoldenOptions golden_options;
+    int frames = 1;
+    const char* video_path = NULL;
+    const char* video_format_name = NULL;
+    int fps = 25;
+    bool orbit_light = false;
+    int progressive_step = 0;
+    int pick_x = -1;
+    int pick_y = -1;
 
-    for (int i = 0; i < 3; i++) {
-        Vec4f vertex;
-        for (int j = 0; j < 4; j++) {
-            vertex[j] = clipc[j][i];
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--model") && i + 1 < argc) {
+            model_path = argv[++i];
+            model_given = true;
+        }
+        else if (!strcmp(argv[i], "--output") && i + 1 < argc) {
+            output_path = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--size") && i + 1 < argc) {
+            if (sscanf(argv[++i], "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0) {
+                std::cerr << "ERROR: bad --size, expected WxH" << std::endl;
+                return -1;
+            }
+        }
+        else if (!strcmp(argv[i], "--hdr")) {
+            hdr = true;
+        }
+        else if (!strcmp(argv[i], "--exposure") && i + 1 < argc) {
+            exposure = static_cast<float>(atof(argv[++i]));
+        }
+        else if (!strcmp(argv[i], "--lights") && i + 1 < argc) {
+            nlights = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--shader") && i + 1 < argc) {
+            shader_name = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--opacity") && i + 1 < argc) {
+            opacity = static_cast<float>(atof(argv[++i]));
+        }
+        else if (!strcmp(argv[i], "--oit-budget") && i + 1 < argc) {
+            oit_budget = atol(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--perspective") && i + 1 < argc) {
+            fov = static_cast<float>(atof(argv[++i]));
+        }
+        else if (!strcmp(argv[i], "--depth") && i + 1 < argc) {
+            const char* name = argv[++i];
+            if (!strcmp(name, "float")) depth_format = DEPTH_FLOAT32;
+            else if (!strcmp(name, "reversed")) depth_format = DEPTH_REVERSED_Z;
+            else if (!strcmp(name, "unorm24")) depth_format = DEPTH_UNORM24;
+            else if (!strcmp(name, "unorm16")) depth_format = DEPTH_UNORM16;
+            else {
+                std::cerr << "ERROR: unknown depth format " << name << std::endl;
+                return -1;
+            }
+        }
+        else if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+            options.threads = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--cull")) {
+            options.cull_backfaces = true;
+        }
+        else if (!strcmp(argv[i], "--trace") && i + 1 < argc) {
+            trace_path = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--quantize")) {
+            quantize = true;
+        }
+        else if (!strcmp(argv[i], "--stream")) {
+            stream = true;
+        }
+        else if (!strcmp(argv[i], "--stream-memory") && i + 1 < argc) {
+            stream = true;
+            stream_memory = static_cast<size_t>(std::max(1.0, atof(argv[++i])) * 1024 * 1024);
+        }
+        else if (!strcmp(argv[i], "--cache") && i + 1 < argc) {
+            cache_path = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--alloc-stats")) {
+            alloc_stats = true;
+        }
+        else if (!strcmp(argv[i], "--stats")) {
+            print_stats = true;
+        }
+        else if (!strcmp(argv[i], "--no-meshlets")) {
+            use_meshlets = false;
+        }
+        else if (!strcmp(argv[i], "--benchmark") && i + 1 < argc) {
+            benchmark = true;
+            bench.iterations = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--benchmark-json") && i + 1 < argc) {
+            bench.output_path = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--microbench")) {
+            microbenchmarks = true;
+            if (i + 1 < argc && strncmp(argv[i + 1], "--", 2)) microbench_filter = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--microbench-json") && i + 1 < argc) {
+            microbench_json = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--golden") && i + 1 < argc) {
+            golden = true;
+            golden_options.dir = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--golden-update")) {
+            golden_options.update = true;
+        }
+        else if (!strcmp(argv[i], "--golden-tolerance") && i + 1 < argc) {
+            golden_options.max_error = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--golden-psnr") && i + 1 < argc) {
+            golden_options.min_psnr = atof(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--crease") && i + 1 < argc) {
+            crease_angle = static_cast<float>(atof(argv[++i]));
+        }
+        else if (!strcmp(argv[i], "--frames") && i + 1 < argc) {
+            frames = std::max(1, atoi(argv[++i]));
+        }
+        else if (!strcmp(argv[i], "--video") && i + 1 < argc) {
+            video_path = argv[++i];
+        }
+        else if (!strcmp(argv[i], "--video-format") && i + 1 < argc) {
+            video_format_name = argv[++i];
+            if (strcmp(video_format_name, "y4m") && strcmp(video_format_name, "raw")) {
+                std::cerr << "ERROR: unknown video format " << video_format_name << std::endl;
+                return -1;
+            }
+        }
+        else if (!strcmp(argv[i], "--fps") && i + 1 < argc) {
+            fps = atoi(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "--orbit") && i + 1 < argc) {
+            const char* target = argv[++i];
+            if (!strcmp(target, "light")) orbit_light = true;
+            else if (strcmp(target, "camera")) {
+                std::cerr << "ERROR: --orbit expects camera or light" << std::endl;
+                return -1;
+            }
+        }
+        else if (!strcmp(argv[i], "--progressive") && i + 1 < argc) {
+            progressive_step = atoi(argv[++i]);
+            if (progressive_step < 2 || (progressive_step & (progressive_step - 1))) {
+                std::cerr << "ERROR: --progressive expects a power of two step, at least 2" << std::endl;
+                return -1;
+            }
+        }
+        else if (!strcmp(argv[i], "--pick") && i + 1 < argc) {
+            if (sscanf(argv[++i], "%d,%d", &pick_x, &pick_y) != 2 || pick_x < 0 || pick_y < 0) {
+                std::cerr << "ERROR: bad --pick, expected X,Y" << std::endl;
+                return -1;
+            }
+        }
+        else if (!strcmp(argv[i], "--lod") && i + 1 < argc) {
+            lod_error = static_cast<float>(atof(argv[++i]));
+        }
+        else {
+            std::cerr << "Usage: " << argv[0] << " [--model file.obj] [--output file.tga|png|qoi] [--size WxH]"
+                      << " [--hdr] [--exposure value] [--lights N] [--shader simple|improved|smooth|pbr]"
+                      << " [--opacity alpha] [--oit-budget fragments] [--perspective fov]"
+                      << " [--depth float|reversed|unorm24|unorm16] [--threads N] [--cull] [--no-meshlets] [--stats] [--alloc-stats] [--trace file.json]"
+                      << " [--lod pixel_error] [--crease degrees] [--quantize] [--stream] [--stream-memory MB] [--cache file.cg3cache] [--frames N] [--orbit camera|light] [--progressive step] [--pick X,Y]"
+                      << " [--video file.y4m|file.raw|-] [--video-format y4m|raw] [--fps N]"
+                      << " [--benchmark iterations] [--benchmark-json file.json]"
+                      << " [--golden dir] [--golden-update] [--golden-tolerance N] [--golden-psnr dB]"
+                      << " [--microbench [filter]] [--microbench-json file.json]" << std::endl;
+            return -1;
         }
-        Vec4f transformed = viewport_mat * vertex;
-        pts[i] = transformed;
     }
 
-    mat<3, 2, float> pts2;
-    for (int i = 0; i < 3; i++) {
-        Vec4f v = pts[i];
-        pts2[i] = Vec2f(v[0] / v[3], v[1] / v[3]);
+    // Путь вывода не передается в printf: шаблон номера кадра разбирается сам
+    std::string checked_path;
+    if (!frame_path(output_path, 0, checked_path)) {
+        std::cerr << "ERROR: bad --output pattern, expected one %d, %Nd or %0Nd" << std::endl;
+        return -1;
     }
 
-    Vec2f bboxmin(std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
-    Vec2f bboxmax(-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max());
-    Vec2f clamp(image.get_width() - 1, image.get_height() - 1);
+    // Кадры идут в stdout: сообщения уходят в stderr, чтобы не смешиваться с видео
+    if (video_path && !strcmp(video_path, "-")) {
+        std::cout.rdbuf(std::cerr.rdbuf());
+    }
 
-    for (int i = 0; i < 3; i++) {
-        for (int j = 0; j < 2; j++) {
-            bboxmin[j] = std::max(0.f, std::min(bboxmin[j], pts2[i][j]));
-            bboxmax[j] = std::min(clamp[j], std::max(bboxmax[j], pts2[i][j]));
-        }
+    if (trace_path) {
+        trace::start();
+        trace::set_thread_name("main");
+    }
+
+    if (microbenchmarks) {
+        return microbench::run_all(microbench_filter, microbench_json);
     }
 
-    Vec2i P;
-    TGAColor color;
-    for (P.x = bboxmin.x; P.x <= bboxmax.x; P.x++) {
-        for (P.y = bboxmin.y; P.y <= bboxmax.y; P.y++) {
-            Vec3f bc_screen = barycentric(pts2[0], pts2[1], pts2[2], Vec2f(P.x, P.y));
+    if (golden) {
+        golden_options.threads = options.threads;
+        int failed = run_golden(golden_options);
+        finish_trace(trace_path);
+        return failed > 0 ? 1 : 0;
+    }
 
-            if (bc_screen.x < 0 || bc_screen.y < 0 || bc_screen.z < 0) continue;
-            
-            float frag_depth = 0;
-            for (int k = 0; k < 3; k++) {
-                frag_depth += bc_screen[k] * clipc[2][k];
-            }
+    if (benchmark) {
+        if (model_given) bench.models.push_back(model_path);
+        bench.threads = options.threads;
+        int result = run_benchmark(bench);
+        finish_trace(trace_path);
+        return result;
+    }
 
-            int idx = P.x + P.y * image.get_width();
-            if (idx < 0 || idx >= WIDTH * HEIGHT) continue;
+    if (depth_format == DEPTH_REVERSED_Z && fov <= 0.f) {
+        std::cerr << "ERROR: --depth reversed requires --perspective" << std::endl;
+        return -1;
+    }
 
+    Framebuffer framebuffer(width, height, TGAImage::RGB, depth_format);
+    framebuffer.enable_hdr(hdr);
 
-            if (frag_depth > clip_plane) { 
-                continue; 
-            }
+    // Настройка камеры
+    Vec3f eye(1, 0, 1);
+    Vec3f center(0, 0, 0);
+    Vec3f up(0, 1, 0);
+    Camera camera(eye, center, up);
+    if (fov > 0.f) {
+        camera.set_perspective(fov, float(width) / height, 0.1f, 10.f, depth_format == DEPTH_REVERSED_Z);
+    }
+    // Целочисленные форматы кодируют диапазон z/w текущей проекции
+    if (depth_format == DEPTH_UNORM24 || depth_format == DEPTH_UNORM16) {
+        framebuffer.set_depth_range(-1.f, 1.f);
+    }
+    // Для ортографии сохраняем разрез модели плоскостью z = 0.15
+    options.clip_plane = camera.is_perspective() ? std::numeric_limits<float>::max() : 0.15f;
+    
+    // Направление света
+    Vec3f light_dir = (Vec3f(1, 1, 1)).normalize();
 
-            if (zbuffer[idx] < frag_depth) {
-                zbuffer[idx] = frag_depth;
-                bool discard = shader.fragment(bc_screen, color);
-                if (!discard) {
-                    image.set(P.x, P.y, color);
-                }
+    // Потоковый режим: сетка не загружается целиком, треугольники идут частями из кэша
+    if (stream) {
+        std::string cache = cache_path ? std::string(cache_path) : std::string(model_path) + ".cg3cache";
+        const char* ext = strrchr(model_path, '.');
+        bool model_is_cache = ext && !strcmp(ext, ".cg3cache");
+        if (model_is_cache) cache.assign(model_path);
+        if (!model_is_cache && !MeshCache::up_to_date(model_path, cache.c_str())) {
+            uint64_t start = PipelineStats::now_ns();
+            MeshCacheInfo info;
+            if (!MeshCache::convert(model_path, cache.c_str(), &info)) {
+                std::cerr << "ERROR: cannot build mesh cache " << cache << std::endl;
+                return -1;
             }
-        
+            std::cout << "Mesh cache built: " << info.nverts << " vertices, " << info.ntriangles << " triangles, "
+                      << info.file_bytes / (1024.0 * 1024.0) << " MB in " << (PipelineStats::now_ns() - start) / 1e6
+                      << " ms" << std::endl;
+            if (info.dropped_faces > 0) {
+                std::cerr << "WARNING: " << info.dropped_faces << " faces with invalid vertex indices dropped" << std::endl;
+            }
+        }
+
+        StreamRenderer streamer(stream_memory);
+        if (!streamer.open(cache.c_str())) {
+            std::cerr << "ERROR: cannot open mesh cache " << cache << std::endl;
+            return -1;
+        }
+        std::cout << "Streaming " << streamer.header().ntriangles << " triangles with " << stream_memory / (1024 * 1024)
+                  << " MB mesh memory" << std::endl;
+        if (print_stats) options.stats = &stats;
+        StreamStats ss;
+        StreamResult streamed = streamer.render(shader_name, camera, light_dir, framebuffer, options, &ss);
+        if (streamed == STREAM_UNKNOWN_SHADER) {
+            std::cerr << "ERROR: unknown shader " << shader_name << std::endl;
+            return -1;
+        }
+        if (streamed == STREAM_READ_ERROR) {
+            std::cerr << "ERROR: corrupt mesh cache " << cache << std::endl;
+            return -1;
         }
+        if (hdr) {
+            resolve_hdr(framebuffer, exposure, TONEMAP_ACES);
+        }
+        if (print_stats) {
+            stats.print(std::cout);
+        }
+        std::cout << "Streamed " << ss.triangles << " triangles in " << ss.chunks << " chunks of " << ss.chunk_triangles
+                  << ": read " << ss.read_ms << " ms, draw " << ss.draw_ms << " ms, peak mapped "
+                  << ss.peak_mapped_bytes / 1024 << " KB (" << ss.window_maps << " window maps), peak chunk "
+                  << ss.peak_chunk_bytes / 1024 << " KB" << std::endl;
+        framebuffer.color().flip_vertically();
+        bool written = write_image(framebuffer.color(), output_path, options.threads);
+        std::cout << "Rendering completed!" << std::endl;
+        finish_trace(trace_path);
+        return written ? 0 : -1;
     }
-}
 
-int main(int argc, char** argv) {
-    Model* model = new Model("obj/123456.obj");
+    Model* model = new Model(model_path);
     if (model->nfaces() == 0) {
         std::cerr << "ERROR: Model not loaded!" << std::endl;
         return -1;
     }
     std::cout << "Model loaded: " << model->nfaces() << " faces" << std::endl;
+    // Пересчет всех нормалей вершин с заданным углом излома
+    if (crease_angle >= 0.f) {
+        model->generate_normals(crease_angle, true);
+    }
+    // 16-битные атрибуты вершин: вдвое меньше памяти, ошибка декодирования — в отчете
+    if (quantize) {
+        QuantizeStats q;
+        model->quantize(&q);
+        std::cout << "Quantized attributes: " << q.bytes_before / 1024.0 << " KB -> " << q.bytes_after / 1024.0
+                  << " KB, position error " << q.position_error << " (bound " << q.position_bound << ")"
+                  << ", normal error " << q.normal_error << " deg, uv error " << q.uv_error << std::endl;
+    }
 
-    TGAImage image(WIDTH, HEIGHT, TGAImage::RGB);
-    
-    float* zbuffer = new float[WIDTH * HEIGHT];
-    for (int i = 0; i < WIDTH * HEIGHT; i++) {
-        zbuffer[i] = -std::numeric_limits<float>::max();
+    // Грань под пикселем выходного изображения (начало — левый верхний угол)
+    if (pick_x >= 0) {
+        uint64_t start = PipelineStats::now_ns();
+        BVH bvh;
+        bvh.build(*model, options.threads);
+        std::cout << "BVH: " << bvh.nnodes() << " nodes, depth " << bvh.depth() << ", "
+                  << bvh.memory_bytes() / 1024 << " KB, built in " << (PipelineStats::now_ns() - start) / 1e6 << " ms" << std::endl;
+        // Луч по глубине видимого диапазона: от разреза (или ближней плоскости) вглубь сцены
+        float z_near = camera.is_perspective() ? 1.f : options.clip_plane;
+        float z_far = camera.is_perspective() ? (depth_format == DEPTH_REVERSED_Z ? 0.01f : -1.f) : -10.f;
+        Matrix screen = framebuffer.viewport() * camera.get_projection_matrix() * camera.get_view_matrix();
+        Ray ray = screen_ray(screen, static_cast<float>(pick_x), static_cast<float>(height - 1 - pick_y), z_near, z_far);
+        RayHit hit;
+        if (bvh.intersect(ray, hit)) {
+            std::cout << "Pick (" << pick_x << ", " << pick_y << "): face " << hit.face << ", distance "
+                      << hit.t * ray.dir.norm() << std::endl;
+        }
+        else {
+            std::cout << "Pick (" << pick_x << ", " << pick_y << "): background" << std::endl;
+        }
     }
 
-    // Настройка камеры
-    Vec3f eye(1, 0, 1);
-    Vec3f center(0, 0, 0);
-    Vec3f up(0, 1, 0);
-    Camera camera(eye, center, up);
-    
-    // Направление света
-    Vec3f light_dir = (Vec3f(1, 1, 1)).normalize();
+    // Уровень детализации по ошибке на экране
+    LodChain lods;
+    if (lod_error > 0.f) {
+        lods.build(*model);
+    }
+    MeshletMesh meshlets;
+    Model* meshlet_model = NULL;
 
-    SimpleShader shader;
-    shader.model = model;
-    shader.ModelView = camera.get_view_matrix();
-    shader.Projection = camera.get_projection_matrix();
-    shader.light_dir = light_dir;
+    // Полупрозрачная модель: фрагменты идут в списки с ограниченной ареной
+    TransparencyBuffer* oit = NULL;
+    if (opacity < 1.f) {
+        size_t budget = oit_budget >= 0 ? (size_t)oit_budget : framebuffer.pixel_count() * 4;
+        oit = new TransparencyBuffer(width, height, budget);
+    }
+
+    if (print_stats) {
+        options.stats = &stats;
+    }
 
-    for (int i = 0; i < model->nfaces(); i++) {
-        if (i % 500 == 0) std::cout << "Rendering face " << i << std::endl;
-        mat<4, 3, float> screen_coords;
-        for (int j = 0; j < 3; j++) {
-            screen_coords.set_col(j, shader.vertex(i, j));
+    VideoStream video;
+    if (video_path) {
+        VideoFormat format = video_format_name ? (strcmp(video_format_name, "raw") ? VIDEO_Y4M : VIDEO_RAW)
+                                               : video_format(video_path);
+        if (!video.open(video_path, format, fps)) {
+            delete oit;
+            delete model;
+            return -1;
+        }
+    }
+
+    // При облете света камера неподвижна: кадры после первого перешейдятся из буфера видимости
+    RelightCache relight;
+    int reshaded = 0;
+
+    // Прогрессивный режим: сначала каждый step-й пиксель, затем уточнение до полного кадра
+    ProgressiveRenderer progressive(progressive_step);
+
+    // Временные данные кадра (копии шейдеров, раскладка кластеров, списки
+    // источников) живут в арене и сбрасываются целиком в начале следующего кадра
+    FrameArena arena;
+    options.arena = &arena;
+    LightClusters clusters;
+    std::string path;
+    std::string preview_path;
+    TGAImage preview;
+    uint64_t steady_allocs = 0;
+
+    // Кадр i записывается в фоне, пока рисуется кадр i + 1
+    OutputQueue output(2, video_path ? &video : NULL);
+    for (int frame = 0; frame < frames; frame++) {
+        TRACE_SCOPE("frame");
+        uint64_t allocs_before = memstats::allocations();
+        arena.reset();
+        // Облет камеры (или света) вокруг модели, первый кадр — исходный ракурс
+        if (frames > 1) {
+            float angle = 0.785398f + 6.283185f * frame / frames;
+            Vec3f orbit = Vec3f(std::sin(angle), 0, std::cos(angle)) * std::sqrt(2.f);
+            if (orbit_light) light_dir = Vec3f(orbit.x, 1.f, orbit.z).normalize();
+            else camera.set_eye(orbit);
+            framebuffer.clear();
+        }
+
+        Model* render_model = model;
+        if (lod_error > 0.f) {
+            int lod = lods.select(camera, framebuffer.viewport(), lod_error);
+            render_model = lods.level(lod).model;
+            if (render_model != meshlet_model) {
+                std::cout << "LOD " << lod << " of " << lods.nlevels() << ": " << render_model->nfaces()
+                          << " faces, error " << lods.level(lod).error << std::endl;
+            }
+        }
+        if (use_meshlets && render_model != meshlet_model) {
+            meshlets.build(*render_model);
+            std::cout << "Meshlets: " << meshlets.nmeshlets() << ", " << meshlets.memory_bytes() / 1024.0 << " KB"
+                      << std::endl;
+        }
+        meshlet_model = render_model;
+
+        IShader* shader = create_shader(shader_name, render_model, camera, light_dir, &arena);
+        if (!shader) {
+            std::cerr << "ERROR: unknown shader " << shader_name << std::endl;
+            delete oit;
+            delete model;
+            return -1;
+        }
+        LightList* light_list = dynamic_cast<LightList*>(shader);
+
+        TranslucentShader* translucent = NULL;
+        if (oit) {
+            translucent = arena.create<TranslucentShader>(shader, opacity);
+            oit->clear();
+            framebuffer.set_transparency(oit);
+        }
+        IShader* draw_shader = translucent ? translucent : shader;
+
+        // Дополнительные точечные источники по спирали вокруг модели
+        for (int i = 0; light_list && i < nlights; i++) {
+            float t = (i + 0.5f) / nlights;
+            float angle = i * 2.39996f; // золотой угол
+            float y = 1.f - 2.f * t;
+            float r = std::sqrt(std::max(0.f, 1.f - y * y));
+            Vec3f pos = Vec3f(r * std::cos(angle), y, r * std::sin(angle)) * 0.8f;
+            Vec3f color(0.5f + 0.5f * std::cos(angle), 0.5f + 0.5f * std::cos(angle + 2.1f), 0.5f + 0.5f * std::cos(angle + 4.2f));
+            light_list->add_light(Light::point(pos, color * 0.8f, 0.6f));
+        }
+        if (light_list && nlights > 0) {
+            light_list->prepare_lights(camera.get_view_matrix());
+            clusters.build(light_list->lights, framebuffer.viewport() * camera.get_projection_matrix() * camera.get_view_matrix(),
+                           width, height, -1.f, 1.f, &arena);
+            light_list->clusters = &clusters;
+        }
+
+        if (use_meshlets && orbit_light) {
+            if (relight.draw(meshlets, render_model, camera, *draw_shader, framebuffer, options)) reshaded++;
+        }
+        else if (use_meshlets && progressive_step > 1) {
+            // Промежуточные кадры уходят в вывод сразу, недорисованные пиксели
+            // заполнены блоками; каждый проход дорисовывает только новые пиксели
+            uint64_t start = PipelineStats::now_ns();
+            if (frames > 1) frame_path(output_path, frame, path);
+            else path.assign(output_path);
+            progressive.begin(framebuffer);
+            for (int pass = 0; progressive.refine(meshlets, camera, *draw_shader, framebuffer, options); pass++) {
+                if (frames == 1) {
+                    std::cout << "Pass " << pass << " (step " << progressive.step() << "): "
+                              << (PipelineStats::now_ns() - start) / 1e6 << " ms" << std::endl;
+                }
+                if (progressive.done()) break;
+                progressive.fill_preview(framebuffer);
+                if (hdr) {
+                    resolve_hdr(framebuffer, exposure, TONEMAP_ACES);
+                }
+                // submit() забирает буфер, а кадр еще дорисовывается — отдаем копию.
+                // После обмена в preview приходит буфер того же размера, его и заполняем
+                TGAImage& color = framebuffer.color();
+                if (preview.get_width() != color.get_width() || preview.get_height() != color.get_height() ||
+                    preview.get_bytespp() != color.get_bytespp()) {
+                    preview = color;
+                }
+                else {
+                    memcpy(preview.buffer(), color.buffer(),
+                           static_cast<size_t>(color.get_width()) * color.get_height() * color.get_bytespp());
+                }
+                frame_path(path.c_str(), pass, preview_path);
+                output.submit(preview, preview_path);
+            }
+        }
+        else if (use_meshlets) {
+            draw_meshlets(meshlets, camera, *draw_shader, framebuffer, options);
+        }
+        else {
+            draw_model(*render_model, *draw_shader, framebuffer, options.clip_plane, options.stats);
+        }
+
+        {
+            TRACE_SCOPE("post-processing");
+            if (oit) {
+                oit->resolve(framebuffer);
+                if (oit->overflow() > 0) {
+                    std::cerr << "WARNING: transparency arena full, " << oit->overflow()
+                              << " fragments blended unsorted into one layer per pixel" << std::endl;
+                }
+                framebuffer.set_transparency(NULL);
+            }
+
+            if (hdr) {
+                resolve_hdr(framebuffer, exposure, TONEMAP_ACES);
+            }
+        }
+        // Переворот и запись — в потоке вывода
+        if (frames > 1) frame_path(output_path, frame, path);
+        else path.assign(output_path);
+        output.submit(framebuffer.color(), path);
+
+        FrameArena::destroy(translucent);
+        FrameArena::destroy(shader);
+
+        if (alloc_stats) {
+            // Первый кадр строит кластеры, буферы и пулы — он не в счет
+            uint64_t allocs = memstats::allocations() - allocs_before;
+            if (frame > 0) steady_allocs = std::max(steady_allocs, allocs);
+            std::cout << "Frame " << frame << ": " << allocs << " heap allocations, arena "
+                      << arena.used() / 1024.0 << " of " << arena.capacity() / 1024 << " KB" << std::endl;
+        }
+    }
+    bool written = output.finish();
+    written = video.close() && written;
+    if (print_stats) {
+        stats.print(std::cout);
+    }
+    if (frames > 1) {
+        std::cout << "Frames written: " << output.written() << ", write " << output.write_ms()
+                  << " ms, render stalled " << output.stall_ms() << " ms" << std::endl;
+    }
+    if (reshaded > 0) {
+        std::cout << "Frames reshaded from visibility buffer: " << reshaded << std::endl;
+    }
+    if (alloc_stats) {
+        if (!memstats::hooks_installed()) {
+            std::cout << "Heap allocations: only frame buffer pool counted, operator new hooks not linked" << std::endl;
+        }
+        if (frames > 1) {
+            std::cout << "Heap allocations per frame after the first: at most " << steady_allocs
+                      << ", arena peak " << arena.peak() / 1024.0 << " KB" << std::endl;
         }
-        float clip_plane = 0.15f;
-        triangle(screen_coords, shader, image, zbuffer, clip_plane);
     }
 
-    image.flip_vertically();
-    image.write_tga_file("output.tga");
-    
     std::cout << "Rendering completed!" << std::endl;
-    
+    finish_trace(trace_path);
+
+    delete oit;
     delete model;
-    delete[] zbuffer;
-    return 0;
-}
\ No newline at end of file
+    return written ? 0 : -1;
+}